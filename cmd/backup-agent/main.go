@@ -1,14 +1,18 @@
 package main
 
 import (
+	"bufio"
 	"context"
 	"fmt"
 	"os"
+	"path/filepath"
 
 	"github.com/spf13/cobra"
 
 	"github.com/hoangsonww/backupagent/config"
 	"github.com/hoangsonww/backupagent/internal/agent"
+	"github.com/hoangsonww/backupagent/internal/persistence"
+	"github.com/hoangsonww/backupagent/internal/storage"
 )
 
 var (
@@ -64,7 +68,46 @@ func main() {
 		},
 	}
 
-	root.AddCommand(initCmd, snapCmd)
+	filterCmd := &cobra.Command{
+		Use:   "export-filter [output]",
+		Short: "Export a filter of stored block hashes for the native bulk tools",
+		Args:  cobra.ExactArgs(1),
+		RunE: func(cmd *cobra.Command, args []string) error {
+			cfg, err := config.Load(cfgFile)
+			if err != nil {
+				return err
+			}
+			db, err := persistence.Open(filepath.Join(cfg.RepositoryPath, "metadata.db"))
+			if err != nil {
+				return err
+			}
+			defer db.Close()
+			tmp := args[0] + ".tmp"
+			f, err := os.OpenFile(tmp, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0644)
+			if err != nil {
+				return err
+			}
+			w := bufio.NewWriter(f)
+			n, err := storage.ExportFilter(db, w)
+			if err == nil {
+				err = w.Flush()
+			}
+			if cerr := f.Close(); err == nil {
+				err = cerr
+			}
+			if err == nil {
+				err = os.Rename(tmp, args[0])
+			}
+			if err != nil {
+				os.Remove(tmp)
+				return err
+			}
+			fmt.Printf("Exported filter of %d blocks to %s\n", n, args[0])
+			return nil
+		},
+	}
+
+	root.AddCommand(initCmd, snapCmd, filterCmd)
 	if err := root.Execute(); err != nil {
 		fmt.Println("Error:", err)
 		os.Exit(1)
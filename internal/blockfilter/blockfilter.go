@@ -0,0 +1,242 @@
+// Package blockfilter builds binary fuse filters (Graf & Lemire, 2022) over
+// block hashes, so native bulk tools can tell which chunks the store
+// probably holds without opening BoltDB. Fingerprints are 8 bits: about 9
+// bits per block and a false-positive rate near 1/256, with no false
+// negatives. The file format is shared with tools/chunkfilter.h:
+//
+//	[4]  magic "SVBF"
+//	[1]  version (1)
+//	[1]  fingerprint bits (8)
+//	[2]  reserved
+//	[8]  seed
+//	[8]  number of distinct keys
+//	[4]  segment length L (a power of two)
+//	[4]  segment count C
+//	[4]  array length ((C + 2) * L)
+//	[4]  reserved
+//	[array length] fingerprints
+//
+// All integers are little-endian. A block's key is the first 8 bytes of its
+// SHA-256, read big-endian.
+package blockfilter
+
+import (
+	"encoding/binary"
+	"encoding/hex"
+	"errors"
+	"io"
+	"math"
+	"math/bits"
+	"sort"
+)
+
+const headerLen = 40
+
+var magic = []byte("SVBF")
+
+// Filter is a binary fuse filter with 8-bit fingerprints.
+type Filter struct {
+	Seed          uint64
+	Keys          uint64
+	SegmentLength uint32
+	SegmentCount  uint32
+	Fingerprints  []byte
+}
+
+// Key returns the filter key of a block given its SHA-256.
+func Key(hash []byte) uint64 {
+	return binary.BigEndian.Uint64(hash[:8])
+}
+
+// KeyFromHex returns the filter key of a block given its hex name.
+func KeyFromHex(name string) (uint64, error) {
+	if len(name) < 16 {
+		return 0, errors.New("block name too short")
+	}
+	b, err := hex.DecodeString(name[:16])
+	if err != nil {
+		return 0, err
+	}
+	return binary.BigEndian.Uint64(b), nil
+}
+
+func mix(key, seed uint64) uint64 {
+	h := key + seed
+	h ^= h >> 33
+	h *= 0xff51afd7ed558ccd
+	h ^= h >> 33
+	h *= 0xc4ceb9fe1a85ec53
+	h ^= h >> 33
+	return h
+}
+
+func fingerprint(h uint64) byte {
+	return byte(h ^ (h >> 32))
+}
+
+func (f *Filter) slots(h uint64) (uint32, uint32, uint32) {
+	hi, _ := bits.Mul64(h, uint64(f.SegmentCount)*uint64(f.SegmentLength))
+	s0 := uint32(hi)
+	mask := f.SegmentLength - 1
+	s1 := (s0 + f.SegmentLength) ^ (uint32(h>>18) & mask)
+	s2 := (s0 + 2*f.SegmentLength) ^ (uint32(h) & mask)
+	return s0, s1, s2
+}
+
+// geometry sizes the filter for n keys, following the reference
+// implementation's rules for arity 3.
+func geometry(n int) (segLen, segCount uint32, err error) {
+	if uint64(n) > 0xF0000000 {
+		return 0, 0, errors.New("too many keys")
+	}
+	l := 4.0
+	if n > 0 {
+		l = math.Ldexp(1, int(math.Floor(math.Log(float64(n))/math.Log(3.33)+2.25)))
+	}
+	segLen = uint32(math.Min(l, 262144))
+	var capacity uint64
+	if n > 1 {
+		factor := math.Max(1.125, 0.875+0.25*math.Log(1e6)/math.Log(float64(n)))
+		capacity = uint64(math.Round(float64(n) * factor))
+	}
+	count := int64((capacity+uint64(segLen)-1)/uint64(segLen)) - 2
+	if count < 1 {
+		count = 1
+	}
+	if (uint64(count)+2)*uint64(segLen) > math.MaxUint32 {
+		return 0, 0, errors.New("too many keys")
+	}
+	return segLen, uint32(count), nil
+}
+
+// Build returns a filter holding keys. Duplicate keys are allowed.
+func Build(keys []uint64) (*Filter, error) {
+	keys = append([]uint64(nil), keys...)
+	sort.Slice(keys, func(i, j int) bool { return keys[i] < keys[j] })
+	uniq := keys[:0]
+	for i, k := range keys {
+		if i == 0 || k != keys[i-1] {
+			uniq = append(uniq, k)
+		}
+	}
+	keys = uniq
+
+	segLen, segCount, err := geometry(len(keys))
+	if err != nil {
+		return nil, err
+	}
+	f := &Filter{Keys: uint64(len(keys)), SegmentLength: segLen, SegmentCount: segCount}
+	size := (segCount + 2) * segLen
+	count := make([]uint32, size)
+	xors := make([]uint64, size)
+	queue := make([]uint32, 0, size)
+	stackHash := make([]uint64, 0, len(keys))
+	stackSlot := make([]uint32, 0, len(keys))
+	rng := uint64(0x2d358dccaa6c78a5)
+	for attempt := 0; attempt < 100; attempt++ {
+		rng += 0x9e3779b97f4a7c15
+		f.Seed = mix(rng, 0)
+		for i := range count {
+			count[i], xors[i] = 0, 0
+		}
+		for _, k := range keys {
+			h := mix(k, f.Seed)
+			s0, s1, s2 := f.slots(h)
+			for _, s := range [3]uint32{s0, s1, s2} {
+				count[s]++
+				xors[s] ^= h
+			}
+		}
+		queue = queue[:0]
+		for i, c := range count {
+			if c == 1 {
+				queue = append(queue, uint32(i))
+			}
+		}
+		stackHash, stackSlot = stackHash[:0], stackSlot[:0]
+		for len(queue) > 0 {
+			i := queue[len(queue)-1]
+			queue = queue[:len(queue)-1]
+			if count[i] != 1 {
+				continue
+			}
+			h := xors[i]
+			stackHash = append(stackHash, h)
+			stackSlot = append(stackSlot, i)
+			s0, s1, s2 := f.slots(h)
+			for _, s := range [3]uint32{s0, s1, s2} {
+				count[s]--
+				xors[s] ^= h
+				if count[s] == 1 {
+					queue = append(queue, s)
+				}
+			}
+		}
+		if len(stackHash) != len(keys) {
+			continue
+		}
+		// Assign in reverse peel order: a key's other two slots are final by
+		// the time its own slot is set.
+		f.Fingerprints = make([]byte, size)
+		for n := len(stackHash) - 1; n >= 0; n-- {
+			h := stackHash[n]
+			s0, s1, s2 := f.slots(h)
+			v := fingerprint(h)
+			for _, s := range [3]uint32{s0, s1, s2} {
+				if s != stackSlot[n] {
+					v ^= f.Fingerprints[s]
+				}
+			}
+			f.Fingerprints[stackSlot[n]] = v
+		}
+		return f, nil
+	}
+	return nil, errors.New("blockfilter: construction failed")
+}
+
+// Contains reports whether key is probably in the filter. False is definite.
+func (f *Filter) Contains(key uint64) bool {
+	h := mix(key, f.Seed)
+	s0, s1, s2 := f.slots(h)
+	return fingerprint(h) == f.Fingerprints[s0]^f.Fingerprints[s1]^f.Fingerprints[s2]
+}
+
+// WriteTo writes the filter in the shared file format.
+func (f *Filter) WriteTo(w io.Writer) (int64, error) {
+	hdr := make([]byte, headerLen)
+	copy(hdr, magic)
+	hdr[4] = 1
+	hdr[5] = 8
+	binary.LittleEndian.PutUint64(hdr[8:], f.Seed)
+	binary.LittleEndian.PutUint64(hdr[16:], f.Keys)
+	binary.LittleEndian.PutUint32(hdr[24:], f.SegmentLength)
+	binary.LittleEndian.PutUint32(hdr[28:], f.SegmentCount)
+	binary.LittleEndian.PutUint32(hdr[32:], uint32(len(f.Fingerprints)))
+	n, err := w.Write(hdr)
+	if err != nil {
+		return int64(n), err
+	}
+	m, err := w.Write(f.Fingerprints)
+	return int64(n + m), err
+}
+
+// Parse decodes a filter file. The fingerprints alias data.
+func Parse(data []byte) (*Filter, error) {
+	if len(data) < headerLen || string(data[:4]) != string(magic) || data[4] != 1 || data[5] != 8 {
+		return nil, errors.New("blockfilter: not a filter file")
+	}
+	f := &Filter{
+		Seed:          binary.LittleEndian.Uint64(data[8:]),
+		Keys:          binary.LittleEndian.Uint64(data[16:]),
+		SegmentLength: binary.LittleEndian.Uint32(data[24:]),
+		SegmentCount:  binary.LittleEndian.Uint32(data[28:]),
+	}
+	size := binary.LittleEndian.Uint32(data[32:])
+	l := f.SegmentLength
+	if l == 0 || l&(l-1) != 0 || f.SegmentCount == 0 ||
+		(uint64(f.SegmentCount)+2)*uint64(l) != uint64(size) || uint64(len(data)-headerLen) != uint64(size) {
+		return nil, errors.New("blockfilter: inconsistent filter header")
+	}
+	f.Fingerprints = data[headerLen:]
+	return f, nil
+}
@@ -0,0 +1,97 @@
+package blockfilter_test
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"encoding/hex"
+	"math/rand"
+	"testing"
+
+	"github.com/hoangsonww/backupagent/internal/blockfilter"
+)
+
+func TestNoFalseNegatives(t *testing.T) {
+	for _, n := range []int{0, 1, 2, 3, 100, 50000} {
+		keys := make([]uint64, n)
+		rng := rand.New(rand.NewSource(int64(n)))
+		for i := range keys {
+			keys[i] = rng.Uint64()
+		}
+		if n > 10 {
+			keys[1] = keys[0] // duplicates are allowed
+		}
+		f, err := blockfilter.Build(keys)
+		if err != nil {
+			t.Fatalf("build %d keys: %v", n, err)
+		}
+		for _, k := range keys {
+			if !f.Contains(k) {
+				t.Fatalf("%d keys: key %x missing", n, k)
+			}
+		}
+	}
+}
+
+func TestFalsePositiveRate(t *testing.T) {
+	rng := rand.New(rand.NewSource(1))
+	keys := make([]uint64, 100000)
+	for i := range keys {
+		keys[i] = rng.Uint64()
+	}
+	f, err := blockfilter.Build(keys)
+	if err != nil {
+		t.Fatalf("build: %v", err)
+	}
+	hits := 0
+	const probes = 200000
+	for i := 0; i < probes; i++ {
+		if f.Contains(rng.Uint64()) {
+			hits++
+		}
+	}
+	if rate := float64(hits) / probes; rate > 0.006 {
+		t.Fatalf("false-positive rate %.4f, want about 1/256", rate)
+	}
+	if bits := float64(len(f.Fingerprints)) * 8 / float64(len(keys)); bits > 10 {
+		t.Fatalf("%.2f bits per key", bits)
+	}
+}
+
+func TestRoundTrip(t *testing.T) {
+	var keys []uint64
+	var names []string
+	for i := 0; i < 1000; i++ {
+		sum := sha256.Sum256([]byte{byte(i), byte(i >> 8)})
+		keys = append(keys, blockfilter.Key(sum[:]))
+		names = append(names, hex.EncodeToString(sum[:]))
+	}
+	f, err := blockfilter.Build(keys)
+	if err != nil {
+		t.Fatalf("build: %v", err)
+	}
+	var buf bytes.Buffer
+	if _, err := f.WriteTo(&buf); err != nil {
+		t.Fatalf("write: %v", err)
+	}
+	g, err := blockfilter.Parse(buf.Bytes())
+	if err != nil {
+		t.Fatalf("parse: %v", err)
+	}
+	for _, name := range names {
+		k, err := blockfilter.KeyFromHex(name)
+		if err != nil {
+			t.Fatalf("key from %s: %v", name, err)
+		}
+		if !g.Contains(k) {
+			t.Fatalf("%s missing after round trip", name)
+		}
+	}
+	corrupt := append([]byte(nil), buf.Bytes()...)
+	corrupt[24] ^= 1 // segment length no longer a power of two
+	if _, err := blockfilter.Parse(corrupt); err == nil {
+		t.Fatalf("corrupt header accepted")
+	}
+	if _, err := blockfilter.Parse(buf.Bytes()[:buf.Len()-1]); err == nil {
+		t.Fatalf("truncated filter accepted")
+	}
+}
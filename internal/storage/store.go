@@ -3,8 +3,11 @@ package storage
 import (
 	"encoding/hex"
 	"errors"
+	"fmt"
+	"io"
 	"sync"
 
+	"github.com/hoangsonww/backupagent/internal/blockfilter"
 	"github.com/hoangsonww/backupagent/internal/crypto"
 	"github.com/hoangsonww/backupagent/internal/persistence"
 	bolt "go.etcd.io/bbolt"
@@ -136,3 +139,32 @@ func (s *Store) Exists(hashStr string) bool {
 	})
 	return err == nil
 }
+
+// ExportFilter writes a binary fuse filter of every stored block hash to w
+// (see internal/blockfilter) and returns the number of blocks it covers.
+// Only hashes are read, so no key is needed.
+func ExportFilter(db *persistence.DB, w io.Writer) (int, error) {
+	var keys []uint64
+	err := db.View(func(tx *bolt.Tx) error {
+		b := tx.Bucket([]byte(persistence.BucketBlocks))
+		return b.ForEach(func(k, v []byte) error {
+			key, err := blockfilter.KeyFromHex(string(k))
+			if err != nil {
+				return fmt.Errorf("block %q: %w", k, err)
+			}
+			keys = append(keys, key)
+			return nil
+		})
+	})
+	if err != nil {
+		return 0, err
+	}
+	f, err := blockfilter.Build(keys)
+	if err != nil {
+		return 0, err
+	}
+	if _, err := f.WriteTo(w); err != nil {
+		return 0, err
+	}
+	return len(keys), nil
+}
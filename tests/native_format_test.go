@@ -0,0 +1,673 @@
+//go:build integration
+// +build integration
+
+package tests
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strings"
+	"testing"
+	"time"
+)
+
+const (
+	v2SegmentSize = 64 << 10
+	v2TagLen      = 16
+)
+
+var v2Pass = []string{"-p", "test-pass", "--kdf=pbkdf2:1000"}
+
+func readFile(t *testing.T, path string) []byte {
+	t.Helper()
+	data, err := os.ReadFile(path)
+	if err != nil {
+		t.Fatalf("Failed to read %s: %v", path, err)
+	}
+	return data
+}
+
+func assertSameFile(t *testing.T, got, want string) {
+	t.Helper()
+	if !bytes.Equal(readFile(t, got), readFile(t, want)) {
+		t.Errorf("%s does not match %s", got, want)
+	}
+}
+
+// v2HeaderLen returns the length of a v2 header: magic, version, segment
+// size, salt, nonce and the extension length, then the extensions.
+func v2HeaderLen(t *testing.T, data []byte) int {
+	t.Helper()
+	const fixed = 4 + 1 + 4 + 16 + 12 + 2
+	if len(data) < fixed || string(data[:4]) != "SVLT" || data[4] != 2 {
+		t.Fatalf("Not a v2 file (%d bytes)", len(data))
+	}
+	return fixed + int(binary.BigEndian.Uint16(data[fixed-2:fixed]))
+}
+
+// encryptV2 writes a random input of size bytes and encrypts it with 64K
+// segments, returning both paths.
+func encryptV2(t *testing.T, bin, dir string, size int, extra ...string) (string, string) {
+	t.Helper()
+	in := filepath.Join(dir, fmt.Sprintf("in-%d", size))
+	enc := in + ".svlt"
+	writeRandomFile(t, in, size)
+	args := append(append([]string{}, v2Pass...), "-e", "-s", "64K")
+	args = append(append(args, extra...), in, enc)
+	if out, ok := runTool(t, bin, args...); !ok {
+		t.Fatalf("Encrypting %s failed: %s", in, out)
+	}
+	return in, enc
+}
+
+// TestV2RoundTrip encrypts and decrypts v2 files inline, threaded, through
+// each I/O backend and compressed, and checks the output matches the input.
+func TestV2RoundTrip(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	modes := [][]string{{"-j", "1"}, {"-j", "4"}, {"--io=mmap"}, {"--io=direct"}, {"--compress=zlib"}}
+	// --io=uring falls back to buffered I/O where the kernel or a seccomp
+	// policy refuses io_uring, so it is only worth running where it works.
+	probe := filepath.Join(tmpDir, "probe")
+	writeRandomFile(t, probe, 1)
+	out, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-e", "--io=uring", probe, probe+".svlt")...)
+	if ok && !strings.Contains(out, "io_uring unavailable") {
+		modes = append(modes, []string{"--io=uring"}, []string{"--io=uring", "-j", "4"})
+	} else {
+		t.Logf("Skipping --io=uring: %s", out)
+	}
+	for _, size := range []int{0, 1, v2SegmentSize, 5*v2SegmentSize + 1234} {
+		for _, mode := range modes {
+			in, enc := encryptV2(t, bin, tmpDir, size, mode...)
+			dec := in + ".out"
+			args := append(append(append([]string{}, v2Pass...), "-d"), mode...)
+			if out, ok := runTool(t, bin, append(args, enc, dec)...); !ok {
+				t.Fatalf("Decrypting %s (%v) failed: %s", enc, mode, out)
+			}
+			assertSameFile(t, dec, in)
+		}
+	}
+}
+
+// TestV2RejectsTampering flips, drops and swaps bytes and segments of a v2
+// file and checks that -d refuses every variant.
+func TestV2RejectsTampering(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	_, enc := encryptV2(t, bin, tmpDir, 4*v2SegmentSize+1000)
+	data := readFile(t, enc)
+	hdr := v2HeaderLen(t, data)
+	record := v2SegmentSize + v2TagLen
+	if len(data) != hdr+4*record+1000+v2TagLen {
+		t.Fatalf("Unexpected v2 layout: %d bytes, header %d", len(data), hdr)
+	}
+
+	cases := map[string]func([]byte) []byte{
+		"flipped header byte": func(d []byte) []byte { d[hdr-1] ^= 1; return d },
+		"flipped ciphertext":  func(d []byte) []byte { d[hdr+record+7] ^= 0x80; return d },
+		"flipped tag":         func(d []byte) []byte { d[len(d)-1] ^= 1; return d },
+		"dropped last segment": func(d []byte) []byte {
+			return d[:hdr+4*record]
+		},
+		"cut mid-segment": func(d []byte) []byte { return d[:hdr+2*record+100] },
+		"cut inside tag":  func(d []byte) []byte { return d[:len(d)-5] },
+		"swapped segments": func(d []byte) []byte {
+			a := append([]byte{}, d[hdr+record:hdr+2*record]...)
+			copy(d[hdr+record:], d[hdr+2*record:hdr+3*record])
+			copy(d[hdr+2*record:], a)
+			return d
+		},
+		"duplicated segment": func(d []byte) []byte {
+			copy(d[hdr+record:], d[hdr:hdr+record])
+			return d
+		},
+		"appended segment": func(d []byte) []byte {
+			return append(d, d[hdr:hdr+record]...)
+		},
+	}
+	for name, mutate := range cases {
+		bad := filepath.Join(tmpDir, "bad.svlt")
+		if err := os.WriteFile(bad, mutate(append([]byte{}, data...)), 0600); err != nil {
+			t.Fatalf("Failed to write %s: %v", bad, err)
+		}
+		for _, mode := range []string{"1", "4"} {
+			dec := filepath.Join(tmpDir, "bad.out")
+			if out, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-d", "-j", mode, bad, dec)...); ok {
+				t.Errorf("%s (-j %s): decryption succeeded: %s", name, mode, out)
+			}
+			if _, err := os.Stat(dec); err == nil {
+				t.Errorf("%s (-j %s): left output behind", name, mode)
+			}
+		}
+	}
+
+	dec := filepath.Join(tmpDir, "wrong.out")
+	if out, ok := runTool(t, bin, "-p", "wrong-pass", "-d", enc, dec); ok {
+		t.Errorf("Decryption with the wrong passphrase succeeded: %s", out)
+	}
+}
+
+// TestV2RangeDecrypt checks --offset/--length against the matching slice of
+// the input, including ranges that start and end mid-segment.
+func TestV2RangeDecrypt(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	size := 6*v2SegmentSize + 777
+	in, enc := encryptV2(t, bin, tmpDir, size)
+	plain := readFile(t, in)
+	dec := filepath.Join(tmpDir, "range.out")
+
+	ranges := [][2]int{
+		{0, 10},
+		{0, size},
+		{v2SegmentSize - 3, 6},
+		{2*v2SegmentSize + 5, 3 * v2SegmentSize},
+		{size - 100, 100},
+		{size - 1, 1},
+	}
+	for _, r := range ranges {
+		args := append(append([]string{}, v2Pass...), "-d",
+			"--offset", fmt.Sprint(r[0]), "--length", fmt.Sprint(r[1]), enc, dec)
+		if out, ok := runTool(t, bin, args...); !ok {
+			t.Fatalf("Range %v failed: %s", r, out)
+		}
+		if !bytes.Equal(readFile(t, dec), plain[r[0]:r[0]+r[1]]) {
+			t.Errorf("Range %v does not match the input", r)
+		}
+	}
+
+	args := append(append([]string{}, v2Pass...), "-d", "--offset", fmt.Sprint(3*v2SegmentSize+9), enc, dec)
+	if out, ok := runTool(t, bin, args...); !ok {
+		t.Fatalf("Open-ended range failed: %s", out)
+	}
+	if !bytes.Equal(readFile(t, dec), plain[3*v2SegmentSize+9:]) {
+		t.Errorf("Open-ended range does not match the input")
+	}
+
+	// A range only authenticates the segments it reads, so damage elsewhere
+	// goes unnoticed but damage inside the range does not.
+	data := readFile(t, enc)
+	hdr := v2HeaderLen(t, data)
+	data[hdr+5*(v2SegmentSize+v2TagLen)+1] ^= 1
+	bad := filepath.Join(tmpDir, "bad.svlt")
+	if err := os.WriteFile(bad, data, 0600); err != nil {
+		t.Fatalf("Failed to write %s: %v", bad, err)
+	}
+	args = append(append([]string{}, v2Pass...), "-d", "--offset", "0", "--length", "100", bad, dec)
+	if out, ok := runTool(t, bin, args...); !ok {
+		t.Errorf("Range before the damaged segment failed: %s", out)
+	}
+	args = append(append([]string{}, v2Pass...), "-d", "--offset", fmt.Sprint(5*v2SegmentSize), "--length", "100", bad, dec)
+	if out, ok := runTool(t, bin, args...); ok {
+		t.Errorf("Range over the damaged segment succeeded: %s", out)
+	}
+}
+
+const libsvltDriver = `#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "svlt.h"
+
+/* svlt_rt e|d PASS IN OUT, or svlt_rt k HEXKEY IN OUT to decrypt under a
+ * raw key: stream IN through libsvlt into OUT. */
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        return 2;
+    }
+    int enc = argv[1][0] == 'e';
+    svlt_encryptor *e = NULL;
+    svlt_decryptor *d = NULL;
+    int rc;
+    if (enc) {
+        rc = svlt_encryptor_new(&e);
+        if (rc == SVLT_OK) rc = svlt_encryptor_set_segment_size(e, 65536);
+        if (rc == SVLT_OK) rc = svlt_encryptor_set_pbkdf2(e, 1000);
+        if (rc == SVLT_OK) rc = svlt_encrypt_init(e, argv[2], strlen(argv[2]));
+    } else {
+        rc = svlt_decryptor_new(&d);
+        if (rc == SVLT_OK && argv[1][0] == 'k') {
+            uint8_t key[SVLT_KEY_LEN];
+            for (int i = 0; i < SVLT_KEY_LEN; i++) {
+                if (sscanf(argv[2] + 2 * i, "%2hhx", &key[i]) != 1) {
+                    return 2;
+                }
+            }
+            rc = svlt_decrypt_init_key(d, key);
+        } else if (rc == SVLT_OK) {
+            rc = svlt_decrypt_init(d, argv[2], strlen(argv[2]));
+        }
+    }
+    FILE *in = fopen(argv[3], "rb"), *out = fopen(argv[4], "wb");
+    if (rc != SVLT_OK || !in || !out) {
+        fprintf(stderr, "setup: %s\n", svlt_strerror(rc));
+        return 1;
+    }
+    size_t cap = 1 << 20;
+    unsigned char *ib = malloc(cap), *ob = malloc(cap);
+    size_t n;
+    while (rc == SVLT_OK && (n = fread(ib, 1, 7777, in)) > 0) {
+        size_t off = 0;
+        while (rc == SVLT_OK && off < n) {
+            size_t used = 0, wrote = 0;
+            rc = enc ? svlt_encrypt_update(e, ib + off, n - off, &used, ob, cap, &wrote)
+                     : svlt_decrypt_update(d, ib + off, n - off, &used, ob, cap, &wrote);
+            fwrite(ob, 1, wrote, out);
+            off += used;
+        }
+    }
+    size_t wrote = 0;
+    if (rc == SVLT_OK) {
+        rc = enc ? svlt_encrypt_final(e, ob, cap, &wrote) : svlt_decrypt_final(d, ob, cap, &wrote);
+        fwrite(ob, 1, wrote, out);
+    }
+    fclose(in);
+    fclose(out);
+    svlt_encryptor_free(e);
+    svlt_decryptor_free(d);
+    if (rc != SVLT_OK) {
+        fprintf(stderr, "%s\n", svlt_strerror(rc));
+        return 1;
+    }
+    return 0;
+}
+`
+
+// buildLibsvltDriver compiles libsvltDriver into dir against
+// bin/libsvlt.so, skipping the test without a C compiler.
+func buildLibsvltDriver(t *testing.T, dir string) string {
+	t.Helper()
+	lib := nativeTool(t, "libsvlt.so")
+	cc, err := exec.LookPath("cc")
+	if err != nil {
+		t.Skip("no C compiler to build the libsvlt driver")
+	}
+	src := filepath.Join(dir, "svlt_rt.c")
+	driver := filepath.Join(dir, "svlt_rt")
+	if err := os.WriteFile(src, []byte(libsvltDriver), 0600); err != nil {
+		t.Fatalf("Failed to write %s: %v", src, err)
+	}
+	tools, err := filepath.Abs(filepath.Join("..", "tools"))
+	if err != nil {
+		t.Fatalf("Failed to resolve tools dir: %v", err)
+	}
+	libDir := filepath.Dir(lib)
+	if out, err := exec.Command(cc, "-o", driver, src, "-I"+tools, "-L"+libDir,
+		"-Wl,-rpath,"+libDir, "-lsvlt").CombinedOutput(); err != nil {
+		t.Fatalf("Failed to build the libsvlt driver: %v: %s", err, out)
+	}
+	return driver
+}
+
+// TestLibsvltRoundTrip builds a small C driver against bin/libsvlt.so and
+// checks that files it writes decrypt with aesgcm_file and the reverse,
+// and that it rejects a tampered file.
+func TestLibsvltRoundTrip(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	driver := buildLibsvltDriver(t, tmpDir)
+
+	for _, size := range []int{0, 100, 3*v2SegmentSize + 17} {
+		in, cliEnc := encryptV2(t, bin, tmpDir, size)
+		libEnc, cliDec := in+".lib.svlt", in+".cli.out"
+		if out, ok := runTool(t, driver, "e", "test-pass", in, libEnc); !ok {
+			t.Fatalf("libsvlt encrypt failed: %s", out)
+		}
+		if out, ok := runTool(t, bin, "-p", "test-pass", "-d", libEnc, cliDec); !ok {
+			t.Fatalf("aesgcm_file could not decrypt libsvlt output: %s", out)
+		}
+		assertSameFile(t, cliDec, in)
+
+		libDec := in + ".lib.out"
+		if out, ok := runTool(t, driver, "d", "test-pass", cliEnc, libDec); !ok {
+			t.Fatalf("libsvlt could not decrypt aesgcm_file output: %s", out)
+		}
+		assertSameFile(t, libDec, in)
+
+		data := readFile(t, cliEnc)
+		data[len(data)-1] ^= 1
+		bad := in + ".bad.svlt"
+		if err := os.WriteFile(bad, data, 0600); err != nil {
+			t.Fatalf("Failed to write %s: %v", bad, err)
+		}
+		if out, ok := runTool(t, driver, "d", "test-pass", bad, libDec); ok {
+			t.Errorf("libsvlt accepted a tampered file: %s", out)
+		}
+	}
+}
+
+// setHeaderKdf overwrites the parameters of the KDF record in a v2 header,
+// keeping its id, and returns the patched copy.
+func setHeaderKdf(t *testing.T, data []byte, params ...uint32) []byte {
+	t.Helper()
+	data = append([]byte{}, data...)
+	hdr := v2HeaderLen(t, data)
+	for p := 4 + 1 + 4 + 16 + 12 + 2; p+3 <= hdr; {
+		vlen := int(binary.BigEndian.Uint16(data[p+1 : p+3]))
+		if data[p] == 0x02 {
+			if vlen != 1+4*len(params) {
+				t.Fatalf("KDF record has %d bytes, expected %d", vlen, 1+4*len(params))
+			}
+			for i, v := range params {
+				binary.BigEndian.PutUint32(data[p+4+4*i:], v)
+			}
+			return data
+		}
+		p += 3 + vlen
+	}
+	t.Fatalf("No KDF record in the header")
+	return nil
+}
+
+// TestV2KdfLimits patches the KDF record of v2 headers to costs past the
+// reader's limits and checks that aesgcm_file and libsvlt refuse them
+// without deriving, and that --max-kdf-* moves the limits both ways.
+func TestV2KdfLimits(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	in := filepath.Join(tmpDir, "in")
+	writeRandomFile(t, in, 100000)
+	argon, pbkdf2 := in+".argon2id.svlt", in+".pbkdf2.svlt"
+	for enc, kdf := range map[string]string{argon: "argon2id:t=1,m=64K,p=1", pbkdf2: "pbkdf2:1000"} {
+		if out, ok := runTool(t, bin, "-p", "test-pass", "--kdf="+kdf, "-e", in, enc); !ok {
+			t.Fatalf("Encrypting with --kdf=%s failed: %s", kdf, out)
+		}
+	}
+
+	hostile := map[string][]byte{
+		"argon2id t=64 m=4G": setHeaderKdf(t, readFile(t, argon), 64, 4<<20, 4),
+		"argon2id t=9":       setHeaderKdf(t, readFile(t, argon), 9, 64, 1),
+		"argon2id m=2G":      setHeaderKdf(t, readFile(t, argon), 1, 2<<20, 1),
+		"pbkdf2 1e8":         setHeaderKdf(t, readFile(t, pbkdf2), 100000000),
+	}
+	driver := ""
+	if _, err := exec.LookPath("cc"); err == nil {
+		driver = buildLibsvltDriver(t, tmpDir)
+	}
+	for name, data := range hostile {
+		bad := filepath.Join(tmpDir, "bad.svlt")
+		if err := os.WriteFile(bad, data, 0600); err != nil {
+			t.Fatalf("Failed to write %s: %v", bad, err)
+		}
+		dec := filepath.Join(tmpDir, "bad.out")
+		start := time.Now()
+		out, ok := runTool(t, bin, "-p", "wrong-pass", "-d", bad, dec)
+		if ok || !strings.Contains(out, "over this reader's limit") {
+			t.Errorf("%s: expected the header to be refused, got: %s", name, out)
+		}
+		if elapsed := time.Since(start); elapsed > 5*time.Second {
+			t.Errorf("%s: refusing the header took %v", name, elapsed)
+		}
+		if _, err := os.Stat(dec); err == nil {
+			t.Errorf("%s: left output behind", name)
+		}
+		if driver != "" {
+			out, ok := runTool(t, driver, "d", "wrong-pass", bad, dec+".lib")
+			if ok || !strings.Contains(out, "unsupported or malformed stream") {
+				t.Errorf("%s: expected libsvlt to fail with SVLT_EFORMAT, got: %s", name, out)
+			}
+		}
+	}
+
+	dec := filepath.Join(tmpDir, "out")
+	if out, ok := runTool(t, bin, "-p", "test-pass", "--max-kdf-memory=32K", "-d", argon, dec); ok {
+		t.Errorf("A 64K Argon2id header passed a 32K memory limit: %s", out)
+	}
+	if out, ok := runTool(t, bin, "-p", "test-pass", "--max-kdf-iterations=1000", "-d", pbkdf2, dec); !ok {
+		t.Errorf("A 1000-iteration header failed a 1000-iteration limit: %s", out)
+	}
+	passes := filepath.Join(tmpDir, "passes.svlt")
+	if out, ok := runTool(t, bin, "-p", "test-pass", "--kdf=argon2id:t=9,m=64K,p=1", "-e", in, passes); ok {
+		t.Errorf("Encrypting with 9 passes succeeded under the default limit: %s", out)
+	}
+	raised := []string{"-p", "test-pass", "--max-kdf-passes=9"}
+	if out, ok := runTool(t, bin, append(raised, "--kdf=argon2id:t=9,m=64K,p=1", "-e", in, passes)...); !ok {
+		t.Fatalf("Encrypting with 9 passes and --max-kdf-passes=9 failed: %s", out)
+	}
+	if out, ok := runTool(t, bin, "-p", "test-pass", "-d", passes, dec); ok {
+		t.Errorf("A 9-pass header passed the default limit: %s", out)
+	}
+	if out, ok := runTool(t, bin, append(raised, "-d", passes, dec)...); !ok {
+		t.Fatalf("Decrypting with --max-kdf-passes=9 failed: %s", out)
+	}
+	assertSameFile(t, dec, in)
+}
+
+// v1Pass opens testdata/v1-baseline.svlt, which the single-tag v1 code
+// wrote before the v2 format existed, from testdata/v1-baseline.txt.
+const v1Pass = "v1-fixture-pass"
+
+// TestV1Compat decrypts the checked-in v1 file, round trips --v1 files, and
+// checks that tampered or truncated v1 files are refused with no output
+// left behind.
+func TestV1Compat(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	fixture := filepath.Join("testdata", "v1-baseline.svlt")
+	dec := filepath.Join(tmpDir, "fixture.out")
+	if out, ok := runTool(t, bin, "-p", v1Pass, "-d", fixture, dec); !ok {
+		t.Fatalf("Decrypting the v1 fixture failed: %s", out)
+	}
+	assertSameFile(t, dec, filepath.Join("testdata", "v1-baseline.txt"))
+
+	encs := []string{fixture}
+	for _, size := range []int{0, 1, 300000} {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", size))
+		enc, dec := in+".svlt", in+".out"
+		writeRandomFile(t, in, size)
+		if out, ok := runTool(t, bin, "-p", v1Pass, "--v1", "-e", in, enc); !ok {
+			t.Fatalf("Encrypting %s with --v1 failed: %s", in, out)
+		}
+		if data := readFile(t, enc); len(data) < 5 || string(data[:4]) != "SVLT" || data[4] != 1 {
+			t.Fatalf("--v1 did not write a v1 file")
+		}
+		if out, ok := runTool(t, bin, "-p", v1Pass, "-d", enc, dec); !ok {
+			t.Fatalf("Decrypting %s failed: %s", enc, out)
+		}
+		assertSameFile(t, dec, in)
+		encs = append(encs, enc)
+	}
+
+	const header = 4 + 1 + 16 + 12
+	for _, enc := range encs {
+		data := readFile(t, enc)
+		cases := map[string][]byte{
+			"flipped salt": append([]byte{}, data...),
+			"flipped tag":  append([]byte{}, data...),
+			"cut tag":      data[:len(data)-1],
+		}
+		cases["flipped salt"][5] ^= 1
+		cases["flipped tag"][len(data)-1] ^= 1
+		if len(data) > header+16 {
+			cases["flipped ciphertext"] = append([]byte{}, data...)
+			cases["flipped ciphertext"][header] ^= 0x80
+			cases["cut ciphertext"] = append(append([]byte{}, data[:header]...), data[header+1:]...)
+		}
+		for name, bad := range cases {
+			path := filepath.Join(tmpDir, "bad.svlt")
+			if err := os.WriteFile(path, bad, 0600); err != nil {
+				t.Fatalf("Failed to write %s: %v", path, err)
+			}
+			out := filepath.Join(tmpDir, "bad.out")
+			if msg, ok := runTool(t, bin, "-p", v1Pass, "-d", path, out); ok {
+				t.Errorf("%s, %s: decryption succeeded: %s", filepath.Base(enc), name, msg)
+			}
+			if _, err := os.Stat(out); err == nil {
+				t.Errorf("%s, %s: left output behind", filepath.Base(enc), name)
+			}
+		}
+		if out, ok := runTool(t, bin, "-p", "wrong-pass", "-d", enc, dec); ok {
+			t.Errorf("%s: decryption with the wrong passphrase succeeded: %s", filepath.Base(enc), out)
+		}
+	}
+}
+
+// TestV2Rekey writes files whose segments span three key epochs of two
+// segments each and checks they round trip, that ranges across an epoch
+// boundary decrypt, and that a segment moved into another epoch fails.
+func TestV2Rekey(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	rekey := fmt.Sprintf("--rekey=%d", 2*v2SegmentSize)
+	size := 5*v2SegmentSize + 1234
+	_, unrotated := encryptV2(t, bin, tmpDir, 1)
+	for _, threads := range []string{"1", "4"} {
+		in, enc := encryptV2(t, bin, tmpDir, size, rekey, "-j", threads)
+		if v2HeaderLen(t, readFile(t, enc)) <= v2HeaderLen(t, readFile(t, unrotated)) {
+			t.Fatalf("-j %s: %s has no key rotation record", threads, rekey)
+		}
+		for _, mode := range []string{"1", "4"} {
+			dec := in + ".out"
+			if out, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-d", "-j", mode, enc, dec)...); !ok {
+				t.Fatalf("Decrypting %s (-j %s, then -j %s) failed: %s", enc, threads, mode, out)
+			}
+			assertSameFile(t, dec, in)
+		}
+	}
+
+	in, enc := encryptV2(t, bin, tmpDir, size, rekey)
+	plain := readFile(t, in)
+	dec := filepath.Join(tmpDir, "range.out")
+	for _, r := range [][2]int{{2*v2SegmentSize - 10, 20}, {v2SegmentSize + 5, 3 * v2SegmentSize}, {4 * v2SegmentSize, size - 4*v2SegmentSize}} {
+		args := append(append([]string{}, v2Pass...), "-d",
+			"--offset", fmt.Sprint(r[0]), "--length", fmt.Sprint(r[1]), enc, dec)
+		if out, ok := runTool(t, bin, args...); !ok {
+			t.Fatalf("Range %v failed: %s", r, out)
+		}
+		if !bytes.Equal(readFile(t, dec), plain[r[0]:r[0]+r[1]]) {
+			t.Errorf("Range %v does not match the input", r)
+		}
+	}
+
+	data := readFile(t, enc)
+	hdr := v2HeaderLen(t, data)
+	record := v2SegmentSize + v2TagLen
+	if len(data) != hdr+5*record+1234+v2TagLen {
+		t.Fatalf("Unexpected v2 layout: %d bytes, header %d", len(data), hdr)
+	}
+	seg := func(d []byte, i int) []byte { return d[hdr+i*record : hdr+(i+1)*record] }
+	// Each case moves a segment into segment to, in another epoch.
+	cases := []struct {
+		name   string
+		to     int
+		mutate func([]byte)
+	}{
+		{"swapped across epochs", 2, func(d []byte) {
+			a := append([]byte{}, seg(d, 1)...)
+			copy(seg(d, 1), seg(d, 2))
+			copy(seg(d, 2), a)
+		}},
+		{"epoch 0 segment in epoch 1", 2, func(d []byte) { copy(seg(d, 2), seg(d, 0)) }},
+		{"epoch 2 segment in epoch 0", 1, func(d []byte) { copy(seg(d, 1), seg(d, 4)) }},
+	}
+	for _, c := range cases {
+		name := c.name
+		moved := append([]byte{}, data...)
+		c.mutate(moved)
+		bad := filepath.Join(tmpDir, "bad.svlt")
+		if err := os.WriteFile(bad, moved, 0600); err != nil {
+			t.Fatalf("Failed to write %s: %v", bad, err)
+		}
+		for _, mode := range []string{"1", "4"} {
+			out := filepath.Join(tmpDir, "bad.out")
+			if msg, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-d", "-j", mode, bad, out)...); ok {
+				t.Errorf("%s (-j %s): decryption succeeded: %s", name, mode, msg)
+			}
+			if _, err := os.Stat(out); err == nil {
+				t.Errorf("%s (-j %s): left output behind", name, mode)
+			}
+		}
+		args := append(append([]string{}, v2Pass...), "-d",
+			"--offset", fmt.Sprint(c.to*v2SegmentSize), "--length", "100", bad, dec)
+		if msg, ok := runTool(t, bin, args...); ok {
+			t.Errorf("%s: range over the moved segment succeeded: %s", name, msg)
+		}
+	}
+}
+
+// pipeTool runs bin with stdin as its standard input and returns what it
+// wrote to stdout and stderr, and whether it exited with status 0.
+func pipeTool(t *testing.T, stdin []byte, bin string, args ...string) ([]byte, string, bool) {
+	t.Helper()
+	var stdout, stderr bytes.Buffer
+	cmd := exec.Command(bin, args...)
+	cmd.Stdin = bytes.NewReader(stdin)
+	cmd.Stdout = &stdout
+	cmd.Stderr = &stderr
+	err := cmd.Run()
+	if _, failed := err.(*exec.ExitError); err != nil && !failed {
+		t.Fatalf("Failed to run %s: %v", bin, err)
+	}
+	return stdout.Bytes(), stderr.String(), err == nil
+}
+
+// TestV2Pipe encrypts from stdin to stdout and back with "-" paths, mixed
+// with files, and checks that a damaged file decrypted to stdout exits
+// non-zero even though earlier segments were already written.
+func TestV2Pipe(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	for _, size := range []int{0, 1000, 5*v2SegmentSize + 1234} {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", size))
+		writeRandomFile(t, in, size)
+		plain := readFile(t, in)
+		for _, threads := range []string{"1", "4"} {
+			args := append(append([]string{}, v2Pass...), "-s", "64K", "-j", threads)
+			enc, errText, ok := pipeTool(t, plain, bin, append(args, "-e", "-", "-")...)
+			if !ok {
+				t.Fatalf("Encrypting stdin (-j %s) failed: %s", threads, errText)
+			}
+			got, errText, ok := pipeTool(t, enc, bin, append(args, "-d", "-", "-")...)
+			if !ok {
+				t.Fatalf("Decrypting stdin (-j %s) failed: %s", threads, errText)
+			}
+			if !bytes.Equal(got, plain) {
+				t.Errorf("Size %d, -j %s: stdin to stdout round trip does not match the input", size, threads)
+			}
+
+			// File to stdout, and stdin to file.
+			encFile, dec := in+".svlt", in+".out"
+			if err := os.WriteFile(encFile, enc, 0600); err != nil {
+				t.Fatalf("Failed to write %s: %v", encFile, err)
+			}
+			if got, errText, ok := pipeTool(t, nil, bin, append(args, "-d", encFile, "-")...); !ok || !bytes.Equal(got, plain) {
+				t.Errorf("Size %d, -j %s: decrypting a file to stdout failed or differs: %s", size, threads, errText)
+			}
+			if _, errText, ok := pipeTool(t, enc, bin, append(args, "-d", "-", dec)...); !ok {
+				t.Fatalf("Decrypting stdin to %s failed: %s", dec, errText)
+			}
+			assertSameFile(t, dec, in)
+		}
+	}
+
+	in, enc := encryptV2(t, bin, tmpDir, 5*v2SegmentSize+1234)
+	data := readFile(t, enc)
+	hdr := v2HeaderLen(t, data)
+	record := v2SegmentSize + v2TagLen
+	flipped := append([]byte{}, data...)
+	flipped[hdr+3*record+10] ^= 1
+	cases := map[string][]byte{
+		"flipped segment 3":    flipped,
+		"dropped last segment": data[:hdr+5*record],
+		"cut mid-segment":      data[:hdr+2*record+100],
+	}
+	plain := readFile(t, in)
+	for name, bad := range cases {
+		path := filepath.Join(tmpDir, "bad.svlt")
+		if err := os.WriteFile(path, bad, 0600); err != nil {
+			t.Fatalf("Failed to write %s: %v", path, err)
+		}
+		for _, src := range []string{path, "-"} {
+			got, errText, ok := pipeTool(t, bad, bin, append(append([]string{}, v2Pass...), "-d", src, "-")...)
+			if ok {
+				t.Errorf("%s from %s: decrypting to stdout exited 0: %s", name, src, errText)
+			}
+			if len(got) >= len(plain) || !bytes.Equal(got, plain[:len(got)]) {
+				t.Errorf("%s from %s: wrote %d bytes that are not a prefix of the input", name, src, len(got))
+			}
+		}
+	}
+}
@@ -0,0 +1,250 @@
+//go:build integration
+// +build integration
+
+package tests
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"testing"
+)
+
+// merkleRoot folds SHA-256 leaves of leafSize bytes into the RFC 6962 root
+// hashfile --tree prints: leaves are H(0x00 || data), nodes H(0x01 || l || r)
+// and an odd node is promoted unchanged.
+func merkleRoot(data []byte, leafSize int) []byte {
+	if len(data) == 0 {
+		sum := sha256.Sum256(nil)
+		return sum[:]
+	}
+	var level [][]byte
+	for off := 0; off < len(data); off += leafSize {
+		end := off + leafSize
+		if end > len(data) {
+			end = len(data)
+		}
+		sum := sha256.Sum256(append([]byte{0x00}, data[off:end]...))
+		level = append(level, sum[:])
+	}
+	for len(level) > 1 {
+		var next [][]byte
+		for i := 0; i+1 < len(level); i += 2 {
+			node := append(append([]byte{0x01}, level[i]...), level[i+1]...)
+			sum := sha256.Sum256(node)
+			next = append(next, sum[:])
+		}
+		if len(level)%2 == 1 {
+			next = append(next, level[len(level)-1])
+		}
+		level = next
+	}
+	return level[0]
+}
+
+// TestHashfileTree checks the --tree root against a Go Merkle tree for leaf
+// counts around powers of two, with one and several threads, and the
+// --leaves listing against the leaf hashes.
+func TestHashfileTree(t *testing.T) {
+	bin := nativeTool(t, "hashfile")
+	tmpDir := t.TempDir()
+	const leaf = 4096
+	for _, size := range []int{0, 1, leaf, leaf + 1, 3 * leaf, 4*leaf - 1, 5*leaf + 7, 17 * leaf} {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", size))
+		writeRandomFile(t, in, size)
+		data := readFile(t, in)
+		want := hex.EncodeToString(merkleRoot(data, leaf))
+		for _, threads := range []string{"1", "4"} {
+			out, ok := runTool(t, bin, "--tree", "--leaf-size=4K", "-j", threads, in)
+			if !ok {
+				t.Fatalf("hashfile --tree %s failed: %s", in, out)
+			}
+			if out != want+"  "+in+"\n" {
+				t.Errorf("Size %d, -j %s: expected root %s, got: %s", size, threads, want, out)
+			}
+		}
+
+		if size == 0 {
+			continue
+		}
+		leaves := filepath.Join(tmpDir, "leaves")
+		if out, ok := runTool(t, bin, "--tree", "--leaf-size=4K", "--leaves="+leaves, in); !ok {
+			t.Fatalf("hashfile --leaves %s failed: %s", in, out)
+		}
+		lines := strings.Split(strings.TrimSpace(string(readFile(t, leaves))), "\n")
+		if len(lines) != (size+leaf-1)/leaf {
+			t.Fatalf("Size %d: expected %d leaves, got %d", size, (size+leaf-1)/leaf, len(lines))
+		}
+		for i, line := range lines {
+			f := strings.Fields(line)
+			if len(f) != 4 {
+				t.Fatalf("Size %d: bad leaf line %q", size, line)
+			}
+			off, _ := strconv.Atoi(f[1])
+			n, _ := strconv.Atoi(f[2])
+			if f[0] != strconv.Itoa(i) || off != i*leaf || off+n > size {
+				t.Fatalf("Size %d: bad leaf line %q", size, line)
+			}
+			sum := sha256.Sum256(append([]byte{0x00}, data[off:off+n]...))
+			if f[3] != hex.EncodeToString(sum[:]) {
+				t.Errorf("Size %d: leaf %d hash does not match its bytes", size, i)
+			}
+		}
+	}
+}
+
+// TestHashfileRecursive hashes a directory tree with -r and checks every
+// regular file is listed once with its SHA-256.
+func TestHashfileRecursive(t *testing.T) {
+	bin := nativeTool(t, "hashfile")
+	tmpDir := t.TempDir()
+	want := map[string]string{}
+	for i, rel := range []string{"a", "b/c", "b/d/e", "b/d/f", "g/h"} {
+		path := filepath.Join(tmpDir, rel)
+		if err := os.MkdirAll(filepath.Dir(path), 0755); err != nil {
+			t.Fatalf("Failed to create %s: %v", filepath.Dir(path), err)
+		}
+		writeRandomFile(t, path, i*70000)
+		sum := sha256.Sum256(readFile(t, path))
+		want[path] = hex.EncodeToString(sum[:])
+	}
+	if err := os.Mkdir(filepath.Join(tmpDir, "empty"), 0755); err != nil {
+		t.Fatalf("Failed to create empty dir: %v", err)
+	}
+
+	for _, threads := range []string{"1", "4"} {
+		out, ok := runTool(t, bin, "-j", threads, "-r", tmpDir)
+		if !ok {
+			t.Fatalf("hashfile -r failed: %s", out)
+		}
+		got := map[string]string{}
+		for _, line := range strings.Split(strings.TrimSpace(out), "\n") {
+			parts := strings.SplitN(line, "  ", 2)
+			if len(parts) != 2 {
+				t.Fatalf("Bad output line %q", line)
+			}
+			if _, dup := got[parts[1]]; dup {
+				t.Errorf("%s listed twice", parts[1])
+			}
+			got[parts[1]] = parts[0]
+		}
+		if len(got) != len(want) {
+			t.Errorf("-j %s: expected %d files, got %d: %s", threads, len(want), len(got), out)
+		}
+		for path, sum := range want {
+			if got[path] != sum {
+				t.Errorf("-j %s: %s: expected %s, got %q", threads, path, sum, got[path])
+			}
+		}
+	}
+
+	if out, ok := runTool(t, bin, "-r", filepath.Join(tmpDir, "missing")); ok {
+		t.Errorf("hashfile -r on a missing directory succeeded: %s", out)
+	}
+}
+
+type chunk struct {
+	sum      string
+	off, len int
+}
+
+func runChunker(t *testing.T, bin string, args ...string) []chunk {
+	t.Helper()
+	out, ok := runTool(t, bin, args...)
+	if !ok {
+		t.Fatalf("chunker %v failed: %s", args, out)
+	}
+	var chunks []chunk
+	for _, line := range strings.Split(out, "\n") {
+		f := strings.Fields(line)
+		if len(f) != 4 || len(f[0]) != 64 {
+			continue
+		}
+		off, err1 := strconv.Atoi(f[1])
+		n, err2 := strconv.Atoi(f[2])
+		if err1 != nil || err2 != nil {
+			t.Fatalf("Bad chunk line %q", line)
+		}
+		chunks = append(chunks, chunk{f[0], off, n})
+	}
+	return chunks
+}
+
+// TestChunkerBoundaries checks that chunks tile the file within the size
+// bounds, hash to their contents, and mostly survive an insertion at the
+// front of the file.
+func TestChunkerBoundaries(t *testing.T) {
+	bin := nativeTool(t, "chunker")
+	tmpDir := t.TempDir()
+	in := filepath.Join(tmpDir, "in")
+	writeRandomFile(t, in, 2<<20+333)
+	data := readFile(t, in)
+
+	const min, max = 2 << 10, 64 << 10
+	chunks := runChunker(t, bin, "--min=2K", "--avg=8K", "--max=64K", in)
+	if len(chunks) < 2 {
+		t.Fatalf("Expected many chunks, got %d", len(chunks))
+	}
+	off := 0
+	for i, c := range chunks {
+		if c.off != off {
+			t.Fatalf("Chunk %d starts at %d, expected %d", i, c.off, off)
+		}
+		if c.len > max || (c.len < min && i != len(chunks)-1) {
+			t.Errorf("Chunk %d has length %d outside [%d, %d]", i, c.len, min, max)
+		}
+		sum := sha256.Sum256(data[c.off : c.off+c.len])
+		if c.sum != hex.EncodeToString(sum[:]) {
+			t.Errorf("Chunk %d hash does not match its bytes", i)
+		}
+		off += c.len
+	}
+	if off != len(data) {
+		t.Errorf("Chunks cover %d of %d bytes", off, len(data))
+	}
+
+	shifted := filepath.Join(tmpDir, "shifted")
+	if err := os.WriteFile(shifted, append([]byte("a few inserted bytes"), data...), 0600); err != nil {
+		t.Fatalf("Failed to write %s: %v", shifted, err)
+	}
+	seen := map[string]bool{}
+	for _, c := range chunks {
+		seen[c.sum] = true
+	}
+	kept := 0
+	for _, c := range runChunker(t, bin, "--min=2K", "--avg=8K", "--max=64K", shifted) {
+		if seen[c.sum] {
+			kept++
+		}
+	}
+	if kept*10 < len(chunks)*9 {
+		t.Errorf("Only %d of %d chunks survived a prefix insertion", kept, len(chunks))
+	}
+
+	// Chunking a directory with several workers gives each file the same
+	// chunks as chunking it alone.
+	dir := filepath.Join(tmpDir, "dir")
+	copyFile(t, in, filepath.Join(dir, "x"))
+	copyFile(t, shifted, filepath.Join(dir, "y"))
+	out, ok := runTool(t, bin, "-j", "2", dir)
+	if !ok {
+		t.Fatalf("chunker -j 2 %s failed: %s", dir, out)
+	}
+	var gotX []string
+	for _, line := range strings.Split(out, "\n") {
+		if strings.HasSuffix(line, "  "+filepath.Join(dir, "x")) {
+			gotX = append(gotX, line[:64])
+		}
+	}
+	var wantX []string
+	for _, c := range chunks {
+		wantX = append(wantX, c.sum)
+	}
+	if strings.Join(gotX, ",") != strings.Join(wantX, ",") {
+		t.Errorf("Directory chunking of x differs from chunking it alone")
+	}
+}
@@ -0,0 +1,44 @@
+//go:build integration
+// +build integration
+
+package tests
+
+import (
+	"encoding/hex"
+	"path/filepath"
+	"testing"
+
+	"github.com/hoangsonww/backupagent/internal/crypto"
+)
+
+// TestArgon2idMatchesGo checks that the native tools' Argon2id derives the
+// agent's keys: crypto.DeriveKey against a vector from the RFC 9106
+// reference implementation, then a file aesgcm_file sealed with
+// --kdf=argon2id at the agent's parameters opened under the key Go derives
+// from its header salt.
+func TestArgon2idMatchesGo(t *testing.T) {
+	// libargon2 argon2id_hash_raw(1, 65536, 4, ...), 32 bytes.
+	const want = "e391a3cbe1765bd80ca65a6cf5ce2ea58e390eabc4d19b134da3b2347828ce40"
+	if got := hex.EncodeToString(crypto.DeriveKey("correct horse battery staple", []byte("shadowvault-salt"))); got != want {
+		t.Fatalf("crypto.DeriveKey gave %s, expected %s", got, want)
+	}
+
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	driver := buildLibsvltDriver(t, tmpDir)
+	in := filepath.Join(tmpDir, "in")
+	enc, dec := in+".svlt", in+".out"
+	writeRandomFile(t, in, 3*v2SegmentSize+99)
+	const pass = "agent-pass"
+	if out, ok := runTool(t, bin, "-p", pass, "--kdf=argon2id:t=1,m=64M,p=4", "-e", in, enc); !ok {
+		t.Fatalf("Encrypting %s failed: %s", in, out)
+	}
+	data := readFile(t, enc)
+	v2HeaderLen(t, data)
+	salt := data[4+1+4 : 4+1+4+16]
+	key := hex.EncodeToString(crypto.DeriveKey(pass, salt))
+	if out, ok := runTool(t, driver, "k", key, enc, dec); !ok {
+		t.Fatalf("The key crypto.DeriveKey gives does not open %s: %s", enc, out)
+	}
+	assertSameFile(t, dec, in)
+}
@@ -0,0 +1,184 @@
+//go:build integration
+// +build integration
+
+package tests
+
+import (
+	"encoding/json"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+)
+
+// keySources runs aesgcm_file with --stats=json and returns how many keys
+// it derived with the KDF and how many it took from the key agent.
+func keySources(t *testing.T, bin string, args ...string) (kdf, agent int) {
+	t.Helper()
+	statsFile := filepath.Join(t.TempDir(), "stats.json")
+	out, ok := runTool(t, bin, append([]string{"--stats=json", "--stats-file=" + statsFile}, args...)...)
+	if !ok {
+		t.Fatalf("aesgcm_file %v failed: %s", args, out)
+	}
+	var stats struct {
+		Keys struct {
+			KDF   *int `json:"kdf"`
+			Agent *int `json:"agent"`
+		} `json:"keys"`
+	}
+	if err := json.Unmarshal(readFile(t, statsFile), &stats); err != nil {
+		t.Fatalf("Failed to parse stats: %v", err)
+	}
+	if stats.Keys.KDF == nil || stats.Keys.Agent == nil {
+		t.Fatalf("No key sources in stats: %s", readFile(t, statsFile))
+	}
+	return *stats.Keys.KDF, *stats.Keys.Agent
+}
+
+// TestKeyAgentReuse decrypts the same file twice through a key agent and
+// checks that the second run takes its key from the agent, that a wrong
+// passphrase still fails, and that an agent in a shared directory is
+// refused.
+func TestKeyAgentReuse(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	agentDir := filepath.Join(tmpDir, "agent")
+	if err := os.Mkdir(agentDir, 0700); err != nil {
+		t.Fatalf("Failed to create agent dir: %v", err)
+	}
+	sock := filepath.Join(agentDir, "sock")
+	startTool(t, sock, bin, "--key-agent", sock)
+
+	in := filepath.Join(tmpDir, "in")
+	enc, dec := in+".svlt", in+".out"
+	writeRandomFile(t, in, 300000)
+	if out, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-e", "--agent="+sock, in, enc)...); !ok {
+		t.Fatalf("Encrypting %s failed: %s", in, out)
+	}
+	for i, want := range [][2]int{{1, 0}, {0, 1}} {
+		kdf, agent := keySources(t, bin, append(append([]string{}, v2Pass...), "-d", "--agent="+sock, enc, dec)...)
+		assertSameFile(t, dec, in)
+		if kdf != want[0] || agent != want[1] {
+			t.Errorf("Decrypt %d: expected %d derived and %d agent keys, got %d and %d", i+1, want[0], want[1], kdf, agent)
+		}
+	}
+
+	if out, ok := runTool(t, bin, "-p", "wrong-pass", "--agent="+sock, "-d", enc, dec); ok {
+		t.Errorf("Decryption with the wrong passphrase succeeded through the agent: %s", out)
+	}
+
+	sharedDir := filepath.Join(tmpDir, "shared")
+	if err := os.Mkdir(sharedDir, 0700); err != nil {
+		t.Fatalf("Failed to create shared dir: %v", err)
+	}
+	if err := os.Chmod(sharedDir, 0755); err != nil {
+		t.Fatalf("Failed to chmod shared dir: %v", err)
+	}
+	if out, ok := runTool(t, bin, "--key-agent", filepath.Join(sharedDir, "sock")); ok {
+		t.Errorf("Key agent started in a 0755 directory: %s", out)
+	}
+}
+
+// TestSinkReceive streams encrypted output to a sink receiver over a unix
+// socket and checks the published file decrypts to the input.
+func TestSinkReceive(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	recvDir := filepath.Join(tmpDir, "recv")
+	if err := os.Mkdir(recvDir, 0700); err != nil {
+		t.Fatalf("Failed to create receive dir: %v", err)
+	}
+	sock := filepath.Join(tmpDir, "sink.sock")
+	startTool(t, sock, bin, "--sink-listen", "unix:"+sock, recvDir)
+
+	for _, size := range []int{0, 1000, 3<<20 + 5} {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", size))
+		writeRandomFile(t, in, size)
+		name := fmt.Sprintf("out-%d.svlt", size)
+		args := append(append([]string{}, v2Pass...), "-e", "-s", "64K", "-j", "2", in, "unix:"+sock+"#"+name)
+		if out, ok := runTool(t, bin, args...); !ok {
+			t.Fatalf("Streaming %s failed: %s", in, out)
+		}
+		dec := in + ".out"
+		if out, ok := runTool(t, bin, append(append([]string{}, v2Pass...), "-d", filepath.Join(recvDir, name), dec)...); !ok {
+			t.Fatalf("Decrypting received %s failed: %s", name, out)
+		}
+		assertSameFile(t, dec, in)
+	}
+
+	entries, err := os.ReadDir(recvDir)
+	if err != nil {
+		t.Fatalf("Failed to list %s: %v", recvDir, err)
+	}
+	for _, e := range entries {
+		if !strings.HasSuffix(e.Name(), ".svlt") {
+			t.Errorf("Receiver left %s behind", e.Name())
+		}
+	}
+}
+
+// TestBatchCacheRekey reruns a cached batch: unchanged inputs are
+// skipped, a modified input is encrypted again, and a new passphrase or
+// new options discard the cache and re-encrypt everything.
+func TestBatchCacheRekey(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	manifest := filepath.Join(tmpDir, "manifest")
+	cache := filepath.Join(tmpDir, "batch.cache")
+	var lines []string
+	var ins []string
+	for i := 0; i < 3; i++ {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", i))
+		writeRandomFile(t, in, 1000*(i+1))
+		ins = append(ins, in)
+		lines = append(lines, in+"\t"+in+".svlt")
+	}
+	if err := os.WriteFile(manifest, []byte(strings.Join(lines, "\n")+"\n"), 0600); err != nil {
+		t.Fatalf("Failed to write manifest: %v", err)
+	}
+
+	batch := func(pass string, extra ...string) string {
+		t.Helper()
+		args := append([]string{"-p", pass, "--kdf=pbkdf2:1000", "-e", "--batch", manifest, "--cache=" + cache}, extra...)
+		out, ok := runTool(t, bin, args...)
+		if !ok {
+			t.Fatalf("Batch failed: %s", out)
+		}
+		return out
+	}
+	expect := func(out string, unchanged, encrypted int) {
+		t.Helper()
+		want := fmt.Sprintf("Cache: %d unchanged", unchanged)
+		if !strings.Contains(out, want) || !strings.Contains(out, fmt.Sprintf(", %d encrypted", encrypted)) {
+			t.Errorf("Expected %q and %d encrypted, got: %s", want, encrypted, out)
+		}
+	}
+	decrypts := func(pass string) {
+		t.Helper()
+		for _, in := range ins {
+			dec := in + ".out"
+			if out, ok := runTool(t, bin, "-p", pass, "-d", in+".svlt", dec); !ok {
+				t.Fatalf("Decrypting %s.svlt with %s failed: %s", in, pass, out)
+			}
+			assertSameFile(t, dec, in)
+		}
+	}
+
+	expect(batch("old-pass"), 0, 3)
+	expect(batch("old-pass"), 3, 0)
+	writeRandomFile(t, ins[1], 1500)
+	expect(batch("old-pass"), 2, 1)
+	decrypts("old-pass")
+
+	out := batch("new-pass")
+	expect(out, 0, 3)
+	if !strings.Contains(out, "another key or options") {
+		t.Errorf("Expected a cache mismatch warning, got: %s", out)
+	}
+	decrypts("new-pass")
+
+	expect(batch("new-pass", "--compress=zlib"), 0, 3)
+	expect(batch("new-pass", "--compress=zlib"), 3, 0)
+	decrypts("new-pass")
+}
@@ -0,0 +1,218 @@
+//go:build integration
+// +build integration
+
+package tests
+
+import (
+	"crypto/rand"
+	"encoding/json"
+	"fmt"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"sort"
+	"strings"
+	"testing"
+	"time"
+)
+
+// nativeTool returns the path of bin/<name>, skipping the test when
+// `make tools` has not been run.
+func nativeTool(t *testing.T, name string) string {
+	t.Helper()
+	bin, err := filepath.Abs(filepath.Join("..", "bin", name))
+	if err != nil {
+		t.Fatalf("Failed to resolve tool path: %v", err)
+	}
+	if _, err := os.Stat(bin); err != nil {
+		t.Skipf("bin/%s not built; run `make tools`", name)
+	}
+	return bin
+}
+
+// aesgcmFile returns the path of the native aesgcm_file tool.
+func aesgcmFile(t *testing.T) string {
+	t.Helper()
+	return nativeTool(t, "aesgcm_file")
+}
+
+// runTool runs the tool and returns its combined output and whether it
+// exited successfully.
+func runTool(t *testing.T, bin string, args ...string) (string, bool) {
+	t.Helper()
+	out, err := exec.Command(bin, args...).CombinedOutput()
+	if _, failed := err.(*exec.ExitError); err != nil && !failed {
+		t.Fatalf("Failed to run %s: %v", bin, err)
+	}
+	return string(out), err == nil
+}
+
+// startTool runs a long-lived tool (a key agent or sink receiver) until the
+// test ends, returning once ready exists.
+func startTool(t *testing.T, ready, bin string, args ...string) {
+	t.Helper()
+	cmd := exec.Command(bin, args...)
+	if err := cmd.Start(); err != nil {
+		t.Fatalf("Failed to start %s: %v", bin, err)
+	}
+	t.Cleanup(func() {
+		cmd.Process.Kill()
+		cmd.Wait()
+	})
+	for i := 0; i < 100; i++ {
+		if _, err := os.Stat(ready); err == nil {
+			return
+		}
+		time.Sleep(50 * time.Millisecond)
+	}
+	t.Fatalf("%s did not create %s", bin, ready)
+}
+
+func writeRandomFile(t *testing.T, path string, size int) {
+	t.Helper()
+	data := make([]byte, size)
+	if _, err := rand.Read(data); err != nil {
+		t.Fatalf("Failed to generate data: %v", err)
+	}
+	if err := os.WriteFile(path, data, 0600); err != nil {
+		t.Fatalf("Failed to write %s: %v", path, err)
+	}
+}
+
+func copyFile(t *testing.T, from, to string) {
+	t.Helper()
+	data, err := os.ReadFile(from)
+	if err != nil {
+		t.Fatalf("Failed to read %s: %v", from, err)
+	}
+	if err := os.MkdirAll(filepath.Dir(to), 0755); err != nil {
+		t.Fatalf("Failed to create %s: %v", filepath.Dir(to), err)
+	}
+	if err := os.WriteFile(to, data, 0600); err != nil {
+		t.Fatalf("Failed to write %s: %v", to, err)
+	}
+}
+
+// TestSnapshotVerifyMixedStore checks --chunks=verify --snapshot against an
+// objects directory holding a chunk pack next to loose objects, both flat
+// and under <2hex>/<rest>.
+func TestSnapshotVerifyMixedStore(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	keyFile := filepath.Join(tmpDir, "master.key")
+	writeRandomFile(t, keyFile, 32)
+
+	srcDir := filepath.Join(tmpDir, "src")
+	exportDir := filepath.Join(tmpDir, "export")
+	if err := os.MkdirAll(srcDir, 0755); err != nil {
+		t.Fatalf("Failed to create source dir: %v", err)
+	}
+	for i := 0; i < 30; i++ {
+		writeRandomFile(t, filepath.Join(srcDir, fmt.Sprintf("chunk%02d", i)), 1000+i*97)
+	}
+	if out, ok := runTool(t, bin, "--chunks=encrypt", "--key-file="+keyFile, srcDir, exportDir); !ok {
+		t.Fatalf("Encrypting chunks failed: %s", out)
+	}
+	entries, err := os.ReadDir(exportDir)
+	if err != nil {
+		t.Fatalf("Failed to list export: %v", err)
+	}
+	var hashes []string
+	for _, e := range entries {
+		hashes = append(hashes, e.Name())
+	}
+	sort.Strings(hashes)
+	if len(hashes) != 30 {
+		t.Fatalf("Expected 30 exported chunks, got %d", len(hashes))
+	}
+
+	// The first 10 chunks go into a pack; the rest stay loose.
+	packSrc := filepath.Join(tmpDir, "to-pack")
+	objectsDir := filepath.Join(tmpDir, "objects")
+	for _, h := range hashes[:10] {
+		copyFile(t, filepath.Join(exportDir, h), filepath.Join(packSrc, h))
+	}
+	if out, ok := runTool(t, bin, "--chunks=pack", packSrc, objectsDir); !ok {
+		t.Fatalf("Packing chunks failed: %s", out)
+	}
+	var loose []string
+	for i, h := range hashes[10:] {
+		to := filepath.Join(objectsDir, h)
+		if i%2 == 1 {
+			to = filepath.Join(objectsDir, h[:2], h[2:])
+		}
+		copyFile(t, filepath.Join(exportDir, h), to)
+		loose = append(loose, to)
+	}
+
+	meta := map[string]interface{}{
+		"files": []map[string]interface{}{{"path": "data.bin", "chunk_hashes": hashes}},
+	}
+	metaJSON, err := json.Marshal(meta)
+	if err != nil {
+		t.Fatalf("Failed to encode snapshot metadata: %v", err)
+	}
+	metaFile := filepath.Join(tmpDir, "snapshot.json")
+	if err := os.WriteFile(metaFile, metaJSON, 0600); err != nil {
+		t.Fatalf("Failed to write snapshot metadata: %v", err)
+	}
+
+	args := []string{"--chunks=verify", "--key-file=" + keyFile, "--snapshot=" + metaFile, "-j", "2", objectsDir}
+	out, ok := runTool(t, bin, args...)
+	if !ok {
+		t.Fatalf("Verifying a mixed store failed: %s", out)
+	}
+	for _, want := range []string{"Packs: 1, 10 of the chunks found in them", "30 verified, 0 corrupt, 0 missing"} {
+		if !strings.Contains(out, want) {
+			t.Errorf("Expected %q in output: %s", want, out)
+		}
+	}
+
+	// A loose chunk that disappears is reported missing.
+	if err := os.Remove(loose[1]); err != nil {
+		t.Fatalf("Failed to remove a loose chunk: %v", err)
+	}
+	out, ok = runTool(t, bin, args...)
+	if ok || !strings.Contains(out, "29 verified, 0 corrupt, 1 missing") {
+		t.Errorf("Expected one missing chunk, got: %s", out)
+	}
+}
+
+// TestSparseTailEmbeddedDigest encrypts sparse inputs that end in a hole
+// with --embed-digest and checks that -d and --show-digest still see the
+// plaintext digest, whether the trailer lands in the last zero segment or
+// in a segment of its own.
+func TestSparseTailEmbeddedDigest(t *testing.T) {
+	bin := aesgcmFile(t)
+	tmpDir := t.TempDir()
+	for _, size := range []int64{20<<20 + 300000, 20 << 20} {
+		in := filepath.Join(tmpDir, fmt.Sprintf("in-%d", size))
+		writeRandomFile(t, in, 100000)
+		if err := os.Truncate(in, size); err != nil {
+			t.Fatalf("Failed to extend %s: %v", in, err)
+		}
+		enc, dec := in+".svlt", in+".out"
+		pass := []string{"-p", "test-pass", "--kdf=pbkdf2:1000"}
+		out, ok := runTool(t, bin, append(pass, "-e", "--sparse", "--embed-digest", "--sha256", in, enc)...)
+		if !ok {
+			t.Fatalf("Encrypting %s failed: %s", in, out)
+		}
+		sum := ""
+		for _, line := range strings.Split(out, "\n") {
+			if strings.HasSuffix(line, "  "+in) {
+				sum = strings.Fields(line)[0]
+			}
+		}
+		if sum == "" {
+			t.Fatalf("No digest line for %s in: %s", in, out)
+		}
+		if out, ok := runTool(t, bin, append(pass, "-d", enc, dec)...); !ok {
+			t.Fatalf("Decrypting %s failed: %s", enc, out)
+		}
+		assertSameFile(t, dec, in)
+		out, ok = runTool(t, bin, append(pass, "--show-digest", enc)...)
+		if !ok || !strings.HasPrefix(out, sum+"  ") {
+			t.Errorf("Expected embedded digest %s, got: %s", sum, out)
+		}
+	}
+}
@@ -0,0 +1,381 @@
+// Self-contained Argon2id (RFC 9106, version 0x13) and the BLAKE2b it is
+// built on, so the tools can derive the same keys as the Go agent's
+// argon2.IDKey without depending on OpenSSL 3.2+ or libargon2.
+// Lanes are filled on separate threads, one slice at a time.
+// Header-only so each tool still compiles as a single translation unit.
+
+#ifndef SVLT_ARGON2ID_H
+#define SVLT_ARGON2ID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// ---- BLAKE2b (RFC 7693), unkeyed, variable output length ----
+
+struct Blake2bState {
+    uint64_t h[8];
+    uint64_t t[2];
+    unsigned char buf[128];
+    size_t buflen;
+    size_t outlen;
+};
+
+static const uint64_t BLAKE2B_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const unsigned char BLAKE2B_SIGMA[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+static inline uint64_t load_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void store_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i, v >>= 8) p[i] = static_cast<unsigned char>(v);
+}
+
+static inline void store_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i, v >>= 8) p[i] = static_cast<unsigned char>(v);
+}
+
+static inline uint64_t rotr64(uint64_t x, unsigned n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+static inline void blake2b_compress(Blake2bState &s, const unsigned char *block, bool last) {
+    uint64_t m[16], v[16];
+    for (int i = 0; i < 16; ++i) m[i] = load_le64(block + 8 * i);
+    for (int i = 0; i < 8; ++i) {
+        v[i] = s.h[i];
+        v[i + 8] = BLAKE2B_IV[i];
+    }
+    v[12] ^= s.t[0];
+    v[13] ^= s.t[1];
+    if (last) v[14] = ~v[14];
+#define SVLT_B2B_G(a, b, c, d, x, y)               \
+    do {                                          \
+        v[a] = v[a] + v[b] + (x);                 \
+        v[d] = rotr64(v[d] ^ v[a], 32);           \
+        v[c] = v[c] + v[d];                       \
+        v[b] = rotr64(v[b] ^ v[c], 24);           \
+        v[a] = v[a] + v[b] + (y);                 \
+        v[d] = rotr64(v[d] ^ v[a], 16);           \
+        v[c] = v[c] + v[d];                       \
+        v[b] = rotr64(v[b] ^ v[c], 63);           \
+    } while (0)
+    for (int r = 0; r < 12; ++r) {
+        const unsigned char *sg = BLAKE2B_SIGMA[r];
+        SVLT_B2B_G(0, 4, 8, 12, m[sg[0]], m[sg[1]]);
+        SVLT_B2B_G(1, 5, 9, 13, m[sg[2]], m[sg[3]]);
+        SVLT_B2B_G(2, 6, 10, 14, m[sg[4]], m[sg[5]]);
+        SVLT_B2B_G(3, 7, 11, 15, m[sg[6]], m[sg[7]]);
+        SVLT_B2B_G(0, 5, 10, 15, m[sg[8]], m[sg[9]]);
+        SVLT_B2B_G(1, 6, 11, 12, m[sg[10]], m[sg[11]]);
+        SVLT_B2B_G(2, 7, 8, 13, m[sg[12]], m[sg[13]]);
+        SVLT_B2B_G(3, 4, 9, 14, m[sg[14]], m[sg[15]]);
+    }
+#undef SVLT_B2B_G
+    for (int i = 0; i < 8; ++i) s.h[i] ^= v[i] ^ v[i + 8];
+}
+
+static inline void blake2b_init(Blake2bState &s, size_t outlen) {
+    memset(&s, 0, sizeof(s));
+    for (int i = 0; i < 8; ++i) s.h[i] = BLAKE2B_IV[i];
+    s.h[0] ^= 0x01010000ULL ^ outlen; // depth 1, fanout 1, no key
+    s.outlen = outlen;
+}
+
+static inline void blake2b_update(Blake2bState &s, const void *data, size_t len) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    while (len > 0) {
+        // The final block must be compressed with the last flag, so a full
+        // buffer is only flushed once more input is known to follow.
+        if (s.buflen == 128) {
+            s.t[0] += 128;
+            if (s.t[0] < 128) ++s.t[1];
+            blake2b_compress(s, s.buf, false);
+            s.buflen = 0;
+        }
+        size_t n = 128 - s.buflen;
+        if (n > len) n = len;
+        memcpy(s.buf + s.buflen, p, n);
+        s.buflen += n;
+        p += n;
+        len -= n;
+    }
+}
+
+static inline void blake2b_final(Blake2bState &s, unsigned char *out) {
+    s.t[0] += s.buflen;
+    if (s.t[0] < s.buflen) ++s.t[1];
+    memset(s.buf + s.buflen, 0, 128 - s.buflen);
+    blake2b_compress(s, s.buf, true);
+    unsigned char full[64];
+    for (int i = 0; i < 8; ++i) store_le64(full + 8 * i, s.h[i]);
+    memcpy(out, full, s.outlen);
+}
+
+static inline void blake2b(unsigned char *out, size_t outlen, const void *in, size_t inlen) {
+    Blake2bState s;
+    blake2b_init(s, outlen);
+    blake2b_update(s, in, inlen);
+    blake2b_final(s, out);
+}
+
+// ---- Argon2id ----
+
+static constexpr size_t ARGON2_BLOCK_WORDS = 128; // 1 KiB blocks
+static constexpr uint32_t ARGON2_SYNC_POINTS = 4;
+static constexpr uint32_t ARGON2_VERSION = 0x13;
+
+struct Argon2Block {
+    uint64_t v[ARGON2_BLOCK_WORDS];
+};
+
+// H' from RFC 9106 section 3.3: variable-length hash built from BLAKE2b.
+static inline void argon2_hprime(unsigned char *out, size_t outlen, const unsigned char *in, size_t inlen) {
+    unsigned char lenbuf[4];
+    store_le32(lenbuf, static_cast<uint32_t>(outlen));
+    Blake2bState s;
+    if (outlen <= 64) {
+        blake2b_init(s, outlen);
+        blake2b_update(s, lenbuf, 4);
+        blake2b_update(s, in, inlen);
+        blake2b_final(s, out);
+        return;
+    }
+    unsigned char v[64];
+    blake2b_init(s, 64);
+    blake2b_update(s, lenbuf, 4);
+    blake2b_update(s, in, inlen);
+    blake2b_final(s, v);
+    memcpy(out, v, 32);
+    out += 32;
+    size_t remaining = outlen - 32;
+    while (remaining > 64) {
+        blake2b(v, 64, v, 64);
+        memcpy(out, v, 32);
+        out += 32;
+        remaining -= 32;
+    }
+    blake2b(v, remaining, v, 64);
+    memcpy(out, v, remaining);
+}
+
+static inline uint64_t argon2_fblamka(uint64_t x, uint64_t y) {
+    return x + y + 2 * (x & 0xffffffffULL) * (y & 0xffffffffULL);
+}
+
+#define SVLT_ARGON2_G(a, b, c, d)                   \
+    do {                                           \
+        a = argon2_fblamka(a, b);                  \
+        d = rotr64(d ^ a, 32);                     \
+        c = argon2_fblamka(c, d);                  \
+        b = rotr64(b ^ c, 24);                     \
+        a = argon2_fblamka(a, b);                  \
+        d = rotr64(d ^ a, 16);                     \
+        c = argon2_fblamka(c, d);                  \
+        b = rotr64(b ^ c, 63);                     \
+    } while (0)
+
+#define SVLT_ARGON2_P(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15) \
+    do {                                                                                  \
+        SVLT_ARGON2_G(v0, v4, v8, v12);                                                   \
+        SVLT_ARGON2_G(v1, v5, v9, v13);                                                   \
+        SVLT_ARGON2_G(v2, v6, v10, v14);                                                  \
+        SVLT_ARGON2_G(v3, v7, v11, v15);                                                  \
+        SVLT_ARGON2_G(v0, v5, v10, v15);                                                  \
+        SVLT_ARGON2_G(v1, v6, v11, v12);                                                  \
+        SVLT_ARGON2_G(v2, v7, v8, v13);                                                   \
+        SVLT_ARGON2_G(v3, v4, v9, v14);                                                   \
+    } while (0)
+
+// out = G(x, y), or out ^= G(x, y) when xor_into is set (passes after the first).
+static inline void argon2_compress(Argon2Block &out, const Argon2Block &x, const Argon2Block &y, bool xor_into) {
+    Argon2Block r, z;
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; ++i) r.v[i] = x.v[i] ^ y.v[i];
+    z = r;
+    uint64_t *q = z.v;
+    for (int i = 0; i < 8; ++i) { // rows
+        uint64_t *w = q + 16 * i;
+        SVLT_ARGON2_P(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], w[9], w[10], w[11], w[12], w[13],
+                      w[14], w[15]);
+    }
+    for (int i = 0; i < 8; ++i) { // columns
+        uint64_t *w = q + 2 * i;
+        SVLT_ARGON2_P(w[0], w[1], w[16], w[17], w[32], w[33], w[48], w[49], w[64], w[65], w[80], w[81], w[96],
+                      w[97], w[112], w[113]);
+    }
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; ++i) {
+        uint64_t nv = z.v[i] ^ r.v[i];
+        out.v[i] = xor_into ? out.v[i] ^ nv : nv;
+    }
+}
+
+#undef SVLT_ARGON2_P
+#undef SVLT_ARGON2_G
+
+struct Argon2Ctx {
+    std::vector<Argon2Block> mem;
+    uint32_t passes, lanes, lane_len, seg_len, total_blocks;
+};
+
+static inline void argon2_fill_segment(Argon2Ctx &c, uint32_t pass, uint32_t lane, uint32_t slice) {
+    const bool data_independent = pass == 0 && slice < ARGON2_SYNC_POINTS / 2;
+    Argon2Block addr{}, input{}, zero{};
+    if (data_independent) {
+        input.v[0] = pass;
+        input.v[1] = lane;
+        input.v[2] = slice;
+        input.v[3] = c.total_blocks;
+        input.v[4] = c.passes;
+        input.v[5] = 2; // Argon2id
+    }
+    auto next_addresses = [&]() {
+        ++input.v[6];
+        Argon2Block tmp;
+        argon2_compress(tmp, zero, input, false);
+        argon2_compress(addr, zero, tmp, false);
+    };
+
+    uint32_t start = (pass == 0 && slice == 0) ? 2 : 0;
+    if (data_independent && start != 0) {
+        next_addresses();
+    }
+    uint32_t offset = lane * c.lane_len + slice * c.seg_len + start;
+    for (uint32_t i = start; i < c.seg_len; ++i, ++offset) {
+        uint32_t prev = (offset % c.lane_len == 0) ? offset + c.lane_len - 1 : offset - 1;
+        uint64_t rand;
+        if (data_independent) {
+            if (i % ARGON2_BLOCK_WORDS == 0) next_addresses();
+            rand = addr.v[i % ARGON2_BLOCK_WORDS];
+        } else {
+            rand = c.mem[prev].v[0];
+        }
+        uint32_t ref_lane = (pass == 0 && slice == 0) ? lane : static_cast<uint32_t>((rand >> 32) % c.lanes);
+        bool same_lane = ref_lane == lane;
+
+        // Size of the window that may be referenced, per RFC 9106 3.4.1.2
+        uint32_t area;
+        if (pass == 0) {
+            if (slice == 0) {
+                area = i - 1;
+            } else {
+                area = slice * c.seg_len + (same_lane ? i - 1 : (i == 0 ? uint32_t(-1) : 0));
+            }
+        } else {
+            area = c.lane_len - c.seg_len + (same_lane ? i - 1 : (i == 0 ? uint32_t(-1) : 0));
+        }
+        uint64_t rel = rand & 0xffffffffULL;
+        rel = (rel * rel) >> 32;
+        rel = area - 1 - ((uint64_t(area) * rel) >> 32);
+        uint32_t window_start = (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) ? (slice + 1) * c.seg_len : 0;
+        uint32_t ref_index = static_cast<uint32_t>((window_start + rel) % c.lane_len);
+
+        argon2_compress(c.mem[offset], c.mem[prev], c.mem[ref_lane * c.lane_len + ref_index], pass != 0);
+    }
+}
+
+// Derives outlen bytes with Argon2id. t_cost passes over m_cost_kib KiB of
+// memory split into `lanes` lanes. Returns false on invalid parameters.
+static inline bool argon2id_hash(uint32_t t_cost, uint32_t m_cost_kib, uint32_t lanes, const void *pwd,
+                                 size_t pwdlen, const void *salt, size_t saltlen, unsigned char *out,
+                                 size_t outlen) {
+    if (t_cost < 1 || lanes < 1 || lanes > 0xffffff || outlen < 4 || saltlen < 8 ||
+        m_cost_kib < 8 * lanes) {
+        return false;
+    }
+    Argon2Ctx c;
+    c.passes = t_cost;
+    c.lanes = lanes;
+    c.seg_len = m_cost_kib / (lanes * ARGON2_SYNC_POINTS);
+    c.lane_len = c.seg_len * ARGON2_SYNC_POINTS;
+    c.total_blocks = c.lane_len * lanes;
+    c.mem.resize(c.total_blocks);
+
+    // H0
+    unsigned char h0[64 + 8];
+    {
+        Blake2bState s;
+        blake2b_init(s, 64);
+        unsigned char w[4];
+        auto put32 = [&](uint32_t v) {
+            store_le32(w, v);
+            blake2b_update(s, w, 4);
+        };
+        put32(lanes);
+        put32(static_cast<uint32_t>(outlen));
+        put32(m_cost_kib);
+        put32(t_cost);
+        put32(ARGON2_VERSION);
+        put32(2); // Argon2id
+        put32(static_cast<uint32_t>(pwdlen));
+        blake2b_update(s, pwd, pwdlen);
+        put32(static_cast<uint32_t>(saltlen));
+        blake2b_update(s, salt, saltlen);
+        put32(0); // no secret
+        put32(0); // no associated data
+        blake2b_final(s, h0);
+    }
+
+    // First two blocks of every lane
+    unsigned char blockbytes[1024];
+    for (uint32_t l = 0; l < lanes; ++l) {
+        for (uint32_t j = 0; j < 2; ++j) {
+            store_le32(h0 + 64, j);
+            store_le32(h0 + 68, l);
+            argon2_hprime(blockbytes, sizeof(blockbytes), h0, sizeof(h0));
+            Argon2Block &b = c.mem[l * c.lane_len + j];
+            for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) b.v[k] = load_le64(blockbytes + 8 * k);
+        }
+    }
+
+    // Lanes of one slice are independent; slices are the sync points.
+    std::vector<std::thread> pool;
+    for (uint32_t pass = 0; pass < t_cost; ++pass) {
+        for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
+            for (uint32_t l = 1; l < lanes; ++l) {
+                pool.emplace_back([&c, pass, l, slice]() { argon2_fill_segment(c, pass, l, slice); });
+            }
+            argon2_fill_segment(c, pass, 0, slice);
+            for (auto &t : pool) t.join();
+            pool.clear();
+        }
+    }
+
+    Argon2Block final = c.mem[c.lane_len - 1];
+    for (uint32_t l = 1; l < lanes; ++l) {
+        const Argon2Block &last = c.mem[l * c.lane_len + c.lane_len - 1];
+        for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) final.v[k] ^= last.v[k];
+    }
+    for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) store_le64(blockbytes + 8 * k, final.v[k]);
+    argon2_hprime(out, outlen, blockbytes, sizeof(blockbytes));
+
+    // Wipe the working memory; volatile so the stores are not elided.
+    volatile unsigned char *vp = reinterpret_cast<volatile unsigned char *>(c.mem.data());
+    for (size_t i = 0; i < c.mem.size() * sizeof(Argon2Block); ++i) vp[i] = 0;
+    volatile unsigned char *vb = blockbytes;
+    for (size_t i = 0; i < sizeof(blockbytes); ++i) vb[i] = 0;
+    return true;
+}
+
+#endif // SVLT_ARGON2ID_H
@@ -0,0 +1,715 @@
+// Native content-defined chunker for offline dedup analysis and for
+// pre-chunking data before it is imported into the agent. Files (and
+// directories, recursively) are split with the gear/FastCDC chunker in
+// fastcdc.h, and each chunk is printed as
+//   <sha256 hex> <offset> <length>  <path>
+// The SHA-256 is the same name Store.PutChunk files the chunk under.
+// With -j N, files are chunked in parallel and lines of different files
+// may interleave; each line is written whole.
+//
+// --estimate prints no chunks. It reports how much Store.PutChunk dedup
+// would save on the inputs, a projected compression ratio and a chunk size
+// histogram, in memory bounded by --mem (see FingerprintSet).
+//
+// --known=FILTER takes a block filter from `backup-agent export-filter`
+// (chunkfilter.h). With --new-only, listing prints only the chunks the
+// filter misses, which the store certainly lacks; about 1 in 256 new chunks
+// hits the filter anyway and is left out. --estimate also reports how much
+// of the unique data the store probably has already.
+// --make-filter=OUT builds such a filter from chunk listings instead.
+//
+// Compile with:
+//   g++ -std=c++17 -O2 -pthread -o chunker tools/chunker.cpp -lcrypto -lz
+
+#include "chunkfilter.h"
+#include "fastcdc.h"
+
+#include <openssl/evp.h>
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct Options {
+    CdcParams cdc;
+    unsigned threads = 1;
+    bool hash = true;
+    bool estimate = false;
+    uint64_t mem_budget = 512ull << 20;
+    uint32_t compress_every = 16; // zlib 1 in N new sampled chunks; 0 = off
+    const ChunkFilter *known = nullptr;
+    bool new_only = false;
+};
+
+static void to_hex(const unsigned char *d, size_t n, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; ++i) {
+        out[2 * i] = digits[d[i] >> 4];
+        out[2 * i + 1] = digits[d[i] & 0x0f];
+    }
+    out[2 * n] = '\0';
+}
+
+static uint64_t load_be64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+// Parses a byte count with an optional K/M/G (binary) suffix.
+static bool parse_size(const char *s, uint64_t &out) {
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s) return false;
+    unsigned shift = 0;
+    switch (*end) {
+    case 'K': case 'k': shift = 10; ++end; break;
+    case 'M': case 'm': shift = 20; ++end; break;
+    case 'G': case 'g': shift = 30; ++end; break;
+    default: break;
+    }
+    if (*end != '\0' || v > (UINT64_MAX >> shift)) return false;
+    out = v << shift;
+    return true;
+}
+
+static bool parse_size32(const char *s, uint32_t &out) {
+    uint64_t v = 0;
+    if (!parse_size(s, v) || v > UINT32_MAX) return false;
+    out = static_cast<uint32_t>(v);
+    return true;
+}
+
+static std::string human_bytes(double b) {
+    static const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB"};
+    int u = 0;
+    while (b >= 1024 && u < 6) b /= 1024, ++u;
+    char buf[32];
+    snprintf(buf, sizeof(buf), u ? "%.1f %s" : "%.0f %s", b, units[u]);
+    return buf;
+}
+
+// Expands directories into their regular files, sorted, so output order is
+// stable from run to run.
+static bool collect_inputs(const std::vector<std::string> &args, std::vector<std::string> &files) {
+    for (const std::string &a : args) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(a, ec)) {
+            files.push_back(a);
+            continue;
+        }
+        std::vector<std::string> found;
+        std::filesystem::recursive_directory_iterator it(a, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec)) found.push_back(it->path().string());
+        }
+        if (ec) {
+            fprintf(stderr, "cannot read directory %s: %s\n", a.c_str(), ec.message().c_str());
+            return false;
+        }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    return true;
+}
+
+// Hands out input files one at a time while walking directories lazily, so
+// trees with millions of files are never listed in memory (--estimate).
+class InputWalker {
+public:
+    explicit InputWalker(const std::vector<std::string> &args) : args_(args) {}
+
+    bool next(std::string &path, std::atomic<bool> &failed) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (;;) {
+            if (in_dir_) {
+                std::error_code ec;
+                while (it_ != std::filesystem::recursive_directory_iterator()) {
+                    bool regular = it_->is_regular_file(ec);
+                    std::string p = it_->path().string();
+                    it_.increment(ec);
+                    if (ec) {
+                        fprintf(stderr, "cannot read directory %s: %s\n", dir_.c_str(), ec.message().c_str());
+                        failed = true;
+                        it_ = std::filesystem::recursive_directory_iterator();
+                    }
+                    if (regular) {
+                        path = p;
+                        return true;
+                    }
+                }
+                in_dir_ = false;
+            }
+            if (next_arg_ >= args_.size()) return false;
+            const std::string &a = args_[next_arg_++];
+            std::error_code ec;
+            if (!std::filesystem::is_directory(a, ec)) {
+                path = a;
+                return true;
+            }
+            it_ = std::filesystem::recursive_directory_iterator(a, ec);
+            if (ec) {
+                fprintf(stderr, "cannot read directory %s: %s\n", a.c_str(), ec.message().c_str());
+                failed = true;
+                continue;
+            }
+            dir_ = a;
+            in_dir_ = true;
+        }
+    }
+
+private:
+    std::mutex mu_;
+    const std::vector<std::string> &args_;
+    size_t next_arg_ = 0;
+    std::filesystem::recursive_directory_iterator it_;
+    std::string dir_;
+    bool in_dir_ = false;
+};
+
+struct Totals {
+    std::atomic<uint64_t> files{0}, chunks{0}, bytes{0};
+    std::atomic<bool> failed{false};
+    std::mutex out_mu;
+};
+
+// ---- dedup estimation ----
+//
+// Chunks are fingerprinted by the first 8 bytes of their SHA-256 and kept
+// in a sharded open-addressing set with each fingerprint's length and
+// occurrence count. While the set fits the memory budget it is exact. When
+// a shard fills up, the sampling level goes up by one: only fingerprints
+// whose low `level` bits are zero are kept, and from then on only those are
+// inserted. Every copy of a chunk has the same fingerprint, so a chunk and
+// all its duplicates are either all in the sample or all out, and the
+// sample's dedup ratio estimates the whole data set's without bias.
+// Distinct chunks are counted by a HyperLogLog sketch over the next 8 bytes
+// of the digest, which does not depend on the sampling level.
+
+struct FpSlot {
+    uint64_t fp;          // 0 = empty
+    uint64_t len : 27;    // up to CDC_MAX_SIZE
+    uint64_t known : 1;   // hit in the --known filter
+    uint64_t count : 36;
+};
+
+class FingerprintSet {
+public:
+    static constexpr unsigned SHARD_BITS = 6;
+
+    explicit FingerprintSet(uint64_t budget) {
+        uint64_t per_shard = budget / sizeof(FpSlot) >> SHARD_BITS;
+        max_slots_ = 1024;
+        while (max_slots_ * 2 <= per_shard) max_slots_ *= 2;
+        for (Shard &s : shards_) s.slots.assign(std::min<size_t>(max_slots_, 4096), FpSlot{});
+    }
+
+    // Counts one occurrence of fp. True if fp was not in the sample before.
+    bool add(uint64_t fp, uint32_t len, bool known) {
+        if (fp == 0) fp = 1;
+        for (;;) {
+            unsigned level = level_.load(std::memory_order_acquire);
+            if (fp & low_mask(level)) return false;
+            Shard &s = shards_[fp >> (64 - SHARD_BITS)];
+            std::unique_lock<std::mutex> lk(s.mu);
+            // The level only changes while every shard is locked.
+            if (level_.load(std::memory_order_relaxed) != level) continue;
+            if (s.used * 4 >= s.slots.size() * 3) {
+                if (s.slots.size() < max_slots_) {
+                    rehash(s, s.slots.size() * 2, level);
+                } else {
+                    lk.unlock();
+                    raise_level(level);
+                    continue;
+                }
+            }
+            size_t mask = s.slots.size() - 1;
+            for (size_t i = slot_index(fp, mask);; i = (i + 1) & mask) {
+                FpSlot &e = s.slots[i];
+                if (e.fp == fp) {
+                    ++e.count;
+                    return false;
+                }
+                if (e.fp == 0) {
+                    e.fp = fp;
+                    e.len = len;
+                    e.known = known;
+                    e.count = 1;
+                    ++s.used;
+                    return true;
+                }
+            }
+        }
+    }
+
+    unsigned level() const { return level_.load(); }
+    uint64_t memory() const {
+        uint64_t m = 0;
+        for (const Shard &s : shards_) m += s.slots.size() * sizeof(FpSlot);
+        return m;
+    }
+
+    // Sums over the sample. Only valid once all add() calls have returned.
+    void totals(uint64_t &unique_chunks, uint64_t &unique_bytes, uint64_t &known_bytes, uint64_t &chunks,
+                uint64_t &bytes) const {
+        unique_chunks = unique_bytes = known_bytes = chunks = bytes = 0;
+        for (const Shard &s : shards_) {
+            for (const FpSlot &e : s.slots) {
+                if (e.fp == 0) continue;
+                ++unique_chunks;
+                unique_bytes += e.len;
+                if (e.known) known_bytes += e.len;
+                chunks += e.count;
+                bytes += uint64_t(e.len) * e.count;
+            }
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex mu;
+        std::vector<FpSlot> slots;
+        size_t used = 0;
+    };
+
+    static uint64_t low_mask(unsigned level) { return level >= 64 ? ~0ULL : (1ULL << level) - 1; }
+    static size_t slot_index(uint64_t fp, size_t mask) {
+        return static_cast<size_t>((fp * 0x9e3779b97f4a7c15ULL) >> 20) & mask;
+    }
+
+    // Rebuilds s with `size` slots, keeping only fingerprints sampled at level.
+    static void rehash(Shard &s, size_t size, unsigned level) {
+        std::vector<FpSlot> old(size, FpSlot{});
+        old.swap(s.slots);
+        s.used = 0;
+        size_t mask = size - 1;
+        for (const FpSlot &e : old) {
+            if (e.fp == 0 || (e.fp & low_mask(level))) continue;
+            size_t i = slot_index(e.fp, mask);
+            while (s.slots[i].fp != 0) i = (i + 1) & mask;
+            s.slots[i] = e;
+            ++s.used;
+        }
+    }
+
+    void raise_level(unsigned seen) {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(shards_.size());
+        for (Shard &s : shards_) locks.emplace_back(s.mu);
+        if (level_.load() != seen) return;
+        unsigned level = seen + 1;
+        for (Shard &s : shards_) rehash(s, s.slots.size(), level);
+        level_.store(level, std::memory_order_release);
+    }
+
+    std::array<Shard, 1u << SHARD_BITS> shards_;
+    size_t max_slots_;
+    std::atomic<unsigned> level_{0};
+};
+
+// HyperLogLog with 2^14 registers (about 0.8% standard error).
+struct Hll {
+    static constexpr unsigned P = 14;
+    uint8_t reg[1u << P] = {};
+
+    void add(uint64_t h) {
+        uint64_t w = h << P;
+        uint8_t rank = w ? static_cast<uint8_t>(__builtin_clzll(w) + 1) : static_cast<uint8_t>(64 - P + 1);
+        uint8_t &r = reg[h >> (64 - P)];
+        if (rank > r) r = rank;
+    }
+    void merge(const Hll &o) {
+        for (size_t i = 0; i < (1u << P); ++i) reg[i] = std::max(reg[i], o.reg[i]);
+    }
+    double estimate() const {
+        const double m = 1u << P;
+        double sum = 0;
+        unsigned zeros = 0;
+        for (uint8_t r : reg) {
+            sum += std::ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+        double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (e <= 2.5 * m && zeros) e = m * std::log(m / zeros); // linear counting
+        return e;
+    }
+};
+
+static_assert(sizeof(FpSlot) == 16, "FpSlot packs into 16 bytes");
+static_assert(CDC_MAX_SIZE < (1u << 27), "FpSlot::len holds any chunk length");
+
+static constexpr unsigned HIST_BUCKETS = 27; // log2 size classes up to 64 MiB
+
+struct EstimateStats {
+    Hll hll;
+    uint64_t hist_count[HIST_BUCKETS] = {};
+    uint64_t hist_bytes[HIST_BUCKETS] = {};
+    uint64_t comp_in = 0, comp_out = 0, comp_chunks = 0;
+
+    void merge(const EstimateStats &o) {
+        hll.merge(o.hll);
+        for (unsigned i = 0; i < HIST_BUCKETS; ++i) {
+            hist_count[i] += o.hist_count[i];
+            hist_bytes[i] += o.hist_bytes[i];
+        }
+        comp_in += o.comp_in;
+        comp_out += o.comp_out;
+        comp_chunks += o.comp_chunks;
+    }
+};
+
+// Per-thread state reused across files and chunks.
+struct Worker {
+    CdcStream stream;
+    EVP_MD_CTX *md = nullptr;
+    std::string out;
+    std::vector<unsigned char> zbuf;
+    std::unique_ptr<EstimateStats> est;
+
+    explicit Worker(const CdcParams &p) : stream(-1, p), md(EVP_MD_CTX_new()) {}
+    ~Worker() { EVP_MD_CTX_free(md); }
+    Worker(const Worker &) = delete;
+    Worker &operator=(const Worker &) = delete;
+
+    void flush(Totals &t) {
+        if (out.empty()) return;
+        std::lock_guard<std::mutex> lk(t.out_mu);
+        fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
+    }
+};
+
+// Chunks one file, calling on_chunk(chunk, sha256, sha256_len) for each
+// chunk; the digest length is 0 with --no-hash.
+template <typename F>
+static bool chunk_file(Worker &w, const std::string &path, const Options &opts, Totals &t, F on_chunk) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    w.stream.reset(fd);
+    CdcChunk c;
+    uint64_t chunks = 0, bytes = 0;
+    bool ok = true;
+    while (ok && w.stream.next(c)) {
+        unsigned char sum[EVP_MAX_MD_SIZE];
+        unsigned int len = 0;
+        if (opts.hash) {
+            ok = w.md && EVP_DigestInit_ex(w.md, EVP_sha256(), nullptr) == 1 &&
+                 EVP_DigestUpdate(w.md, c.data, c.len) == 1 && EVP_DigestFinal_ex(w.md, sum, &len) == 1;
+            if (!ok) {
+                fprintf(stderr, "%s: SHA-256 failed\n", path.c_str());
+                break;
+            }
+        }
+        on_chunk(c, sum, len);
+        ++chunks;
+        bytes += c.len;
+    }
+    if (ok && w.stream.error() != 0) {
+        fprintf(stderr, "%s: read error: %s\n", path.c_str(), strerror(w.stream.error()));
+        ok = false;
+    }
+    close(fd);
+    t.files += 1;
+    t.chunks += chunks;
+    t.bytes += bytes;
+    return ok;
+}
+
+static bool list_file(Worker &w, const std::string &path, const Options &opts, Totals &t) {
+    char line[2 * EVP_MAX_MD_SIZE + 64];
+    bool ok = chunk_file(w, path, opts, t, [&](const CdcChunk &c, const unsigned char *sum, unsigned len) {
+        if (opts.new_only && opts.known->probably_contains(filter_key(sum))) return;
+        to_hex(sum, len, line);
+        size_t n = strlen(line);
+        snprintf(line + n, sizeof(line) - n, "%s%llu %zu  ", n ? " " : "",
+                 static_cast<unsigned long long>(c.offset), c.len);
+        w.out += line;
+        w.out += path;
+        w.out += '\n';
+        if (w.out.size() >= (64u << 10)) w.flush(t);
+    });
+    w.flush(t);
+    return ok;
+}
+
+static bool estimate_file(Worker &w, const std::string &path, const Options &opts, Totals &t, FingerprintSet &set) {
+    EstimateStats &st = *w.est;
+    return chunk_file(w, path, opts, t, [&](const CdcChunk &c, const unsigned char *sum, unsigned) {
+        uint64_t fp = load_be64(sum), h2 = load_be64(sum + 8);
+        unsigned b = 0;
+        while (b + 1 < HIST_BUCKETS && (size_t(2) << b) <= c.len) ++b;
+        st.hist_count[b] += 1;
+        st.hist_bytes[b] += c.len;
+        st.hll.add(h2);
+        bool fresh = set.add(fp, static_cast<uint32_t>(c.len), opts.known && opts.known->probably_contains(fp));
+        if (fresh && opts.compress_every && (h2 & 0xffffffffu) % opts.compress_every == 0) {
+            uLongf out_len = compressBound(static_cast<uLong>(c.len));
+            if (w.zbuf.size() < out_len) w.zbuf.resize(out_len);
+            if (compress2(w.zbuf.data(), &out_len, c.data, static_cast<uLong>(c.len), 1) != Z_OK) {
+                out_len = c.len;
+            }
+            // Incompressible chunks would be stored as they are.
+            st.comp_in += c.len;
+            st.comp_out += std::min<uint64_t>(out_len, c.len);
+            st.comp_chunks += 1;
+        }
+    });
+}
+
+static void print_estimate(const FingerprintSet &set, const EstimateStats &st, const Totals &t, const Options &opts) {
+    uint64_t su_chunks, su_bytes, sk_bytes, s_chunks, s_bytes;
+    set.totals(su_chunks, su_bytes, sk_bytes, s_chunks, s_bytes);
+    uint64_t bytes = t.bytes, chunks = t.chunks;
+    double dedup = su_bytes ? double(s_bytes) / double(su_bytes) : 1.0;
+    double unique_bytes = bytes / dedup;
+    double comp = st.comp_out ? double(st.comp_in) / double(st.comp_out) : 1.0;
+    unsigned level = set.level();
+
+    printf("Input:             %llu files, %llu chunks, %s\n", static_cast<unsigned long long>(t.files.load()),
+           static_cast<unsigned long long>(chunks), human_bytes(double(bytes)).c_str());
+    printf("Chunking:          min %u, avg %u, max %u (mean chunk %llu bytes)\n", opts.cdc.min, opts.cdc.avg,
+           opts.cdc.max, static_cast<unsigned long long>(chunks ? bytes / chunks : 0));
+    if (level == 0) {
+        printf("Fingerprints:      exact, %llu distinct in %s\n", static_cast<unsigned long long>(su_chunks),
+               human_bytes(double(set.memory())).c_str());
+    } else {
+        printf("Fingerprints:      sampled 1 in %.0f (%llu distinct kept in %s)\n", std::ldexp(1.0, level),
+               static_cast<unsigned long long>(su_chunks), human_bytes(double(set.memory())).c_str());
+    }
+    printf("Distinct chunks:   ~%.0f (HyperLogLog)\n", st.hll.estimate());
+    printf("Unique data:       %s%s\n", level ? "~" : "", human_bytes(unique_bytes).c_str());
+    printf("Dedup ratio:       %.2fx (saves %.1f%%)\n", dedup, bytes ? 100.0 * (1 - 1 / dedup) : 0.0);
+    if (st.comp_chunks) {
+        printf("Compression:       %.2fx on unique data (zlib level 1, %llu chunks sampled)\n", comp,
+               static_cast<unsigned long long>(st.comp_chunks));
+    }
+    double stored = unique_bytes / comp;
+    printf("Projected stored:  %s (%.2fx overall)\n", human_bytes(stored).c_str(), stored > 0 ? bytes / stored : 1.0);
+    if (opts.known) {
+        // Filter false positives (~1/256) make this a slight overestimate.
+        double known = su_bytes ? unique_bytes * double(sk_bytes) / double(su_bytes) : 0.0;
+        printf("Already stored:    ~%s of unique data (%.1f%%, %llu-block filter)\n", human_bytes(known).c_str(),
+               unique_bytes > 0 ? 100.0 * known / unique_bytes : 0.0,
+               static_cast<unsigned long long>(opts.known->keys()));
+        printf("Projected new:     %s%s after compression\n", level ? "~" : "",
+               human_bytes((unique_bytes - known) / comp).c_str());
+    }
+    printf("Chunk sizes:\n");
+    for (unsigned b = 0; b < HIST_BUCKETS; ++b) {
+        if (!st.hist_count[b]) continue;
+        std::string lo = human_bytes(double(uint64_t(1) << b)), hi = human_bytes(double(uint64_t(2) << b));
+        printf("  %10s - %-10s %12llu chunks %6.2f%%  %12s\n", lo.c_str(), hi.c_str(),
+               static_cast<unsigned long long>(st.hist_count[b]), chunks ? 100.0 * st.hist_count[b] / chunks : 0.0,
+               human_bytes(double(st.hist_bytes[b])).c_str());
+    }
+}
+
+// Builds a block filter from chunk listings: the first token of each line
+// is taken as a SHA-256 hex name, as in this tool's output or a plain list
+// of block names.
+static bool make_filter(const std::string &out_path, const std::vector<std::string> &lists) {
+    std::vector<uint64_t> keys;
+    for (const std::string &path : lists) {
+        FILE *f = path == "-" ? stdin : fopen(path.c_str(), "r");
+        if (!f) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        char line[4096];
+        uint64_t lineno = 0;
+        bool ok = true;
+        while (fgets(line, sizeof(line), f)) {
+            ++lineno;
+            size_t n = strcspn(line, " \t\r\n");
+            if (n == 0) continue;
+            uint64_t k = 0;
+            if (n != 64 || !filter_key_hex(line, k)) {
+                fprintf(stderr, "%s:%llu: expected a 64-digit hex chunk name\n", path.c_str(),
+                        static_cast<unsigned long long>(lineno));
+                ok = false;
+                break;
+            }
+            keys.push_back(k);
+            // Skip the rest of an overlong line.
+            while (!strchr(line, '\n') && fgets(line, sizeof(line), f)) {
+            }
+        }
+        if (ok && ferror(f)) {
+            fprintf(stderr, "%s: read error\n", path.c_str());
+            ok = false;
+        }
+        if (f != stdin) fclose(f);
+        if (!ok) return false;
+    }
+    std::vector<unsigned char> image;
+    if (!build_chunk_filter(std::move(keys), image)) {
+        fprintf(stderr, "cannot build a filter over these keys\n");
+        return false;
+    }
+    std::string tmp = out_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    bool ok = f && fwrite(image.data(), 1, image.size(), f) == image.size();
+    if (f && fclose(f) != 0) ok = false;
+    if (!ok || rename(tmp.c_str(), out_path.c_str()) != 0) {
+        fprintf(stderr, "%s: %s\n", out_path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    ChunkFilter check;
+    if (!check.open(out_path)) return false;
+    fprintf(stderr, "Wrote filter of %llu blocks (%zu bytes) to %s\n", static_cast<unsigned long long>(check.keys()),
+            check.bytes(), out_path.c_str());
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--min=SIZE] [--avg=SIZE] [--max=SIZE] [-j N] [--no-hash] <file|dir>...\n"
+            "       %s --estimate [--mem=SIZE] [--compress-sample=N] [chunking options] <file|dir>...\n"
+            "       %s --make-filter=OUT <listing|->...\n"
+            "  --min/--avg/--max  chunk size bounds (default 2K/8K/64K, as in config.go);\n"
+            "                     avg must be a power of two\n"
+            "  -j                 files chunked in parallel (default 1)\n"
+            "  --no-hash          print offsets and lengths only\n"
+            "  --estimate         report dedup/compression ratios and a size histogram\n"
+            "  --mem              fingerprint memory budget (default 512M); beyond it the\n"
+            "                     estimate switches to hash sampling\n"
+            "  --compress-sample  zlib-compress 1 in N new chunks (default 16, 0 = off)\n"
+            "  --known=FILTER     block filter of the store (backup-agent export-filter);\n"
+            "                     --estimate then reports the data already stored\n"
+            "  --new-only         with --known, list only chunks the filter misses\n"
+            "  --make-filter=OUT  write a filter of the chunk names (first field) in listings\n"
+            "Prints \"<sha256> <offset> <length>  <path>\" per chunk and a summary on stderr.\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    std::vector<std::string> args;
+    std::string known_path, filter_out;
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (strncmp(a, "--min=", 6) == 0) {
+            if (!parse_size32(a + 6, opts.cdc.min)) return usage(argv[0]), 1;
+        } else if (strncmp(a, "--avg=", 6) == 0) {
+            if (!parse_size32(a + 6, opts.cdc.avg)) return usage(argv[0]), 1;
+        } else if (strncmp(a, "--max=", 6) == 0) {
+            if (!parse_size32(a + 6, opts.cdc.max)) return usage(argv[0]), 1;
+        } else if (strcmp(a, "-j") == 0 && i + 1 < argc) {
+            opts.threads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+            if (opts.threads == 0) opts.threads = std::max(1u, std::thread::hardware_concurrency());
+        } else if (strcmp(a, "--no-hash") == 0) {
+            opts.hash = false;
+        } else if (strcmp(a, "--estimate") == 0) {
+            opts.estimate = true;
+        } else if (strncmp(a, "--mem=", 6) == 0) {
+            if (!parse_size(a + 6, opts.mem_budget) || opts.mem_budget < (1u << 20)) {
+                fprintf(stderr, "--mem needs at least 1M\n");
+                return 1;
+            }
+        } else if (strncmp(a, "--compress-sample=", 18) == 0) {
+            if (!parse_size32(a + 18, opts.compress_every)) return usage(argv[0]), 1;
+        } else if (strncmp(a, "--known=", 8) == 0) {
+            known_path = a + 8;
+        } else if (strcmp(a, "--new-only") == 0) {
+            opts.new_only = true;
+        } else if (strncmp(a, "--make-filter=", 14) == 0) {
+            filter_out = a + 14;
+        } else if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (a[0] == '-' && a[1] != '\0') {
+            fprintf(stderr, "Unknown option: %s\n", a);
+            usage(argv[0]);
+            return 1;
+        } else {
+            args.push_back(a);
+        }
+    }
+    if (args.empty() || (opts.estimate && !opts.hash) || (opts.new_only && (known_path.empty() || !opts.hash))) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!filter_out.empty()) {
+        return make_filter(filter_out, args) ? 0 : 1;
+    }
+    ChunkFilter known;
+    if (!known_path.empty()) {
+        if (!known.open(known_path)) return 1;
+        opts.known = &known;
+    }
+    if (!cdc_params_valid(opts.cdc)) {
+        fprintf(stderr, "Chunk sizes need %u <= min < avg < max <= %u and avg a power of two >= 256\n",
+                CDC_MIN_SIZE, CDC_MAX_SIZE);
+        return 1;
+    }
+
+    Totals totals;
+    std::vector<std::string> files;
+    std::unique_ptr<InputWalker> walker;
+    std::unique_ptr<FingerprintSet> set;
+    EstimateStats est;
+    std::mutex est_mu;
+    if (opts.estimate) {
+        walker.reset(new InputWalker(args));
+        set.reset(new FingerprintSet(opts.mem_budget));
+    } else if (!collect_inputs(args, files)) {
+        return 1;
+    }
+
+    std::atomic<size_t> next{0};
+    auto start = std::chrono::steady_clock::now();
+    auto run = [&] {
+        Worker w(opts.cdc);
+        if (opts.estimate) {
+            w.est.reset(new EstimateStats());
+            for (std::string path; walker->next(path, totals.failed);) {
+                if (!estimate_file(w, path, opts, totals, *set)) totals.failed = true;
+            }
+            std::lock_guard<std::mutex> lk(est_mu);
+            est.merge(*w.est);
+            return;
+        }
+        for (size_t i; (i = next.fetch_add(1)) < files.size();) {
+            if (!list_file(w, files[i], opts, totals)) totals.failed = true;
+        }
+    };
+    unsigned n = std::max(1u, opts.threads);
+    if (!opts.estimate) n = static_cast<unsigned>(std::min<size_t>(n, std::max<size_t>(1, files.size())));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < n; ++i) pool.emplace_back(run);
+    run();
+    for (auto &th : pool) th.join();
+    if (opts.estimate) print_estimate(*set, est, totals, opts);
+    fflush(stdout);
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t chunks = totals.chunks, bytes = totals.bytes;
+    fprintf(stderr, "Chunked %llu files: %llu chunks, %llu bytes (mean %llu) in %.2f s (%.1f MB/s)\n",
+            static_cast<unsigned long long>(totals.files.load()), static_cast<unsigned long long>(chunks),
+            static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(chunks ? bytes / chunks : 0),
+            secs, secs > 0 ? bytes / secs / 1e6 : 0.0);
+    return totals.failed ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+// Binary fuse filter (Graf & Lemire, "Binary Fuse Filters: Fast and Smaller
+// Than Xor Filters", 2022) over the agent's block hashes, so bulk tools can
+// tell which chunks the store probably has without opening BoltDB. 8-bit
+// fingerprints: about 9 bits per block and a false-positive rate near
+// 1/256. There are no false negatives, so a miss means the chunk is
+// certainly new; a hit only means it is probably stored already.
+// Written by `backup-agent export-filter` (internal/blockfilter) or
+// build_chunk_filter() below. Header-only so each tool still compiles as a
+// single translation unit.
+//
+// File layout, little-endian, fingerprints start at byte 40 so the file can
+// be used straight from mmap:
+//   [4]  magic "SVBF"
+//   [1]  version (1)
+//   [1]  fingerprint bits (8)
+//   [2]  reserved (0)
+//   [8]  seed
+//   [8]  number of distinct keys
+//   [4]  segment length L (a power of two)
+//   [4]  segment count C
+//   [4]  array length ((C + 2) * L)
+//   [4]  reserved (0)
+//   [array length] fingerprints
+// A block's key is the first 8 bytes of its SHA-256, read big-endian (the
+// first 16 hex digits of its name in the store).
+
+#ifndef SVLT_CHUNKFILTER_H
+#define SVLT_CHUNKFILTER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr size_t CHUNK_FILTER_HEADER = 40;
+static constexpr unsigned char CHUNK_FILTER_MAGIC[4] = {'S', 'V', 'B', 'F'};
+
+static inline uint64_t filter_mix(uint64_t key, uint64_t seed) {
+    uint64_t h = key + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t filter_key(const unsigned char *sha256) {
+    uint64_t k = 0;
+    for (int i = 0; i < 8; ++i) k = (k << 8) | sha256[i];
+    return k;
+}
+
+// The key of a 64-hex-digit block name; false if it does not start with 16
+// hex digits.
+static inline bool filter_key_hex(const char *hex, uint64_t &key) {
+    key = 0;
+    for (int i = 0; i < 16; ++i) {
+        char c = hex[i];
+        unsigned v = c >= '0' && c <= '9' ? unsigned(c - '0')
+                     : c >= 'a' && c <= 'f' ? unsigned(c - 'a' + 10)
+                     : c >= 'A' && c <= 'F' ? unsigned(c - 'A' + 10)
+                                            : 16u;
+        if (v == 16) return false;
+        key = (key << 4) | v;
+    }
+    return true;
+}
+
+struct FilterGeometry {
+    uint32_t segment_length = 0;
+    uint32_t segment_count = 0;
+    uint32_t array_length = 0;
+};
+
+// Sizing rules from the paper's reference implementation for arity 3.
+static inline bool filter_geometry(uint64_t n, FilterGeometry &g) {
+    if (n > 0xF0000000ULL) return false;
+    double len = n == 0 ? 4 : std::ldexp(1.0, int(std::floor(std::log(double(n)) / std::log(3.33) + 2.25)));
+    g.segment_length = uint32_t(std::min(len, 262144.0));
+    double factor = n <= 1 ? 0 : std::max(1.125, 0.875 + 0.25 * std::log(1e6) / std::log(double(n)));
+    uint64_t capacity = n <= 1 ? 0 : uint64_t(std::llround(double(n) * factor));
+    int64_t count = int64_t((capacity + g.segment_length - 1) / g.segment_length) - 2;
+    g.segment_count = uint32_t(std::max<int64_t>(1, count));
+    uint64_t array = (uint64_t(g.segment_count) + 2) * g.segment_length;
+    if (array > UINT32_MAX) return false;
+    g.array_length = uint32_t(array);
+    return true;
+}
+
+static inline void filter_slots(uint64_t h, const FilterGeometry &g, uint32_t s[3]) {
+    uint64_t span = uint64_t(g.segment_count) * g.segment_length;
+    s[0] = uint32_t((static_cast<unsigned __int128>(h) * span) >> 64);
+    s[1] = (s[0] + g.segment_length) ^ (uint32_t(h >> 18) & (g.segment_length - 1));
+    s[2] = (s[0] + 2 * g.segment_length) ^ (uint32_t(h) & (g.segment_length - 1));
+}
+
+static inline uint8_t filter_fingerprint(uint64_t h) { return uint8_t(h ^ (h >> 32)); }
+
+// A filter mapped read-only from disk.
+class ChunkFilter {
+public:
+    ChunkFilter() = default;
+    ~ChunkFilter() {
+        if (map_) munmap(map_, map_len_);
+    }
+    ChunkFilter(const ChunkFilter &) = delete;
+    ChunkFilter &operator=(const ChunkFilter &) = delete;
+
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && size_t(st.st_size) >= CHUNK_FILTER_HEADER;
+        if (ok) {
+            map_len_ = size_t(st.st_size);
+            void *m = mmap(nullptr, map_len_, PROT_READ, MAP_SHARED, fd, 0);
+            map_ = m == MAP_FAILED ? nullptr : static_cast<unsigned char *>(m);
+            ok = map_ != nullptr;
+        }
+        ::close(fd);
+        if (ok) ok = parse();
+        if (!ok) fprintf(stderr, "%s: not a chunk filter file\n", path.c_str());
+        return ok;
+    }
+
+    bool probably_contains(uint64_t key) const {
+        uint64_t h = filter_mix(key, seed_);
+        uint32_t s[3];
+        filter_slots(h, g_, s);
+        return filter_fingerprint(h) == (fp_[s[0]] ^ fp_[s[1]] ^ fp_[s[2]]);
+    }
+
+    uint64_t keys() const { return keys_; }
+    size_t bytes() const { return map_len_; }
+
+private:
+    static uint32_t le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24; }
+    static uint64_t le64(const unsigned char *p) { return le32(p) | uint64_t(le32(p + 4)) << 32; }
+
+    bool parse() {
+        const unsigned char *p = map_;
+        if (memcmp(p, CHUNK_FILTER_MAGIC, 4) != 0 || p[4] != 1 || p[5] != 8) return false;
+        seed_ = le64(p + 8);
+        keys_ = le64(p + 16);
+        g_.segment_length = le32(p + 24);
+        g_.segment_count = le32(p + 28);
+        g_.array_length = le32(p + 32);
+        uint32_t l = g_.segment_length;
+        if (l == 0 || (l & (l - 1)) != 0 || g_.segment_count == 0 ||
+            (uint64_t(g_.segment_count) + 2) * l != g_.array_length ||
+            map_len_ != CHUNK_FILTER_HEADER + size_t(g_.array_length)) {
+            return false;
+        }
+        fp_ = p + CHUNK_FILTER_HEADER;
+        return true;
+    }
+
+    unsigned char *map_ = nullptr;
+    size_t map_len_ = 0;
+    const unsigned char *fp_ = nullptr;
+    FilterGeometry g_;
+    uint64_t seed_ = 0;
+    uint64_t keys_ = 0;
+};
+
+// Builds the filter file image for keys (duplicates are fine). Peels the
+// 3-hypergraph; a failed peel (rare) retries with the next seed.
+static inline bool build_chunk_filter(std::vector<uint64_t> keys, std::vector<unsigned char> &out) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    FilterGeometry g;
+    if (!filter_geometry(keys.size(), g)) return false;
+
+    std::vector<uint32_t> count(g.array_length);
+    std::vector<uint64_t> xors(g.array_length);
+    std::vector<uint32_t> queue;
+    std::vector<uint64_t> stack_hash;
+    std::vector<uint32_t> stack_slot;
+    stack_hash.reserve(keys.size());
+    stack_slot.reserve(keys.size());
+    uint64_t rng = 0x2d358dccaa6c78a5ULL;
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        rng += 0x9e3779b97f4a7c15ULL;
+        uint64_t seed = filter_mix(rng, 0);
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(xors.begin(), xors.end(), 0);
+        for (uint64_t k : keys) {
+            uint64_t h = filter_mix(k, seed);
+            uint32_t s[3];
+            filter_slots(h, g, s);
+            for (uint32_t i : s) {
+                ++count[i];
+                xors[i] ^= h;
+            }
+        }
+        queue.clear();
+        for (uint32_t i = 0; i < g.array_length; ++i) {
+            if (count[i] == 1) queue.push_back(i);
+        }
+        stack_hash.clear();
+        stack_slot.clear();
+        while (!queue.empty()) {
+            uint32_t i = queue.back();
+            queue.pop_back();
+            if (count[i] != 1) continue;
+            uint64_t h = xors[i];
+            stack_hash.push_back(h);
+            stack_slot.push_back(i);
+            uint32_t s[3];
+            filter_slots(h, g, s);
+            for (uint32_t j : s) {
+                --count[j];
+                xors[j] ^= h;
+                if (count[j] == 1) queue.push_back(j);
+            }
+        }
+        if (stack_hash.size() != keys.size()) continue;
+
+        out.assign(CHUNK_FILTER_HEADER + g.array_length, 0);
+        unsigned char *p = out.data();
+        auto put32 = [](unsigned char *d, uint32_t v) {
+            for (int i = 0; i < 4; ++i) d[i] = static_cast<unsigned char>(v >> (8 * i));
+        };
+        auto put64 = [&](unsigned char *d, uint64_t v) {
+            put32(d, uint32_t(v));
+            put32(d + 4, uint32_t(v >> 32));
+        };
+        memcpy(p, CHUNK_FILTER_MAGIC, 4);
+        p[4] = 1;
+        p[5] = 8;
+        put64(p + 8, seed);
+        put64(p + 16, keys.size());
+        put32(p + 24, g.segment_length);
+        put32(p + 28, g.segment_count);
+        put32(p + 32, g.array_length);
+        unsigned char *fp = p + CHUNK_FILTER_HEADER;
+        // Reverse peel order: when a key is assigned, its other two slots
+        // are final, so its own slot can make the three XOR to its print.
+        for (size_t n = stack_hash.size(); n-- > 0;) {
+            uint64_t h = stack_hash[n];
+            uint32_t s[3];
+            filter_slots(h, g, s);
+            uint32_t own = stack_slot[n];
+            uint8_t v = filter_fingerprint(h);
+            for (uint32_t j : s) {
+                if (j != own) v ^= fp[j];
+            }
+            fp[own] = v;
+        }
+        return true;
+    }
+    return false;
+}
+
+#endif // SVLT_CHUNKFILTER_H
@@ -0,0 +1,465 @@
+// Chunk packs: many of the agent's chunk blobs (nonce || ciphertext || tag,
+// as Store.PutChunk keeps them) bundled into one large append-only file
+// with a sorted index, so the block store can be exported, shipped,
+// archived and verified with sequential I/O rather than one object per
+// chunk. Written by `aesgcm_file --chunks=pack` and read by its other
+// --chunks modes. Header-only so each tool still compiles as a single
+// translation unit.
+//
+// File layout, little-endian; the index starts 8-byte aligned so it can be
+// used straight from mmap:
+//   [4]  magic "SVPK"
+//   [1]  version (1)
+//   [3]  reserved (0)
+//   records, back to back from byte 8, in the order they were added:
+//     [32] SHA-256 of the chunk's plaintext (its name in the store)
+//     [4]  blob length N (28 <= N <= 1 GiB)
+//     [N]  the blob
+//   zero padding to a multiple of 8, then the index at offset X:
+//     [256 x 4]    fanout: entry b counts the chunks whose hash starts with a byte <= b
+//     [count x 32] hashes, ascending
+//     [count x 8]  offset of each chunk's record, in hash order
+//     [count x 4]  blob length of each chunk, in hash order
+//   footer, the last 56 bytes:
+//     [8]  index offset X
+//     [8]  chunk count
+//     [4]  magic "SVPK"
+//     [4]  reserved (0)
+//     [32] SHA-256 of every byte before it
+// A lookup takes its bucket from two fanout entries and binary-searches
+// only that (about count / 256 hashes), so it touches a few index pages
+// however large the pack is. Packs are named pack-<checksum hex>.svpk.
+
+#ifndef SVLT_CHUNKPACK_H
+#define SVLT_CHUNKPACK_H
+
+#include <openssl/evp.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr unsigned char CHUNK_PACK_MAGIC[4] = {'S', 'V', 'P', 'K'};
+static constexpr unsigned char CHUNK_PACK_VERSION = 1;
+static constexpr size_t PACK_HEADER_LEN = 8;
+static constexpr size_t PACK_HASH_LEN = 32;
+static constexpr size_t PACK_RECORD_HEAD = PACK_HASH_LEN + 4;
+static constexpr size_t PACK_FANOUT_LEN = 256 * 4;
+static constexpr size_t PACK_ENTRY_LEN = PACK_HASH_LEN + 8 + 4;
+static constexpr size_t PACK_FOOTER_LEN = 8 + 8 + 4 + 4 + PACK_HASH_LEN;
+static constexpr size_t PACK_MIN_BLOB = 12 + 16; // nonce and tag
+static constexpr size_t PACK_MAX_BLOB = size_t(1) << 30;
+static constexpr uint64_t DEFAULT_PACK_SIZE = uint64_t(1) << 30;
+
+using PackHash = std::array<unsigned char, PACK_HASH_LEN>;
+
+struct PackHashHasher {
+    size_t operator()(const PackHash &h) const {
+        uint64_t v;
+        memcpy(&v, h.data(), sizeof(v)); // already uniform: a SHA-256
+        return size_t(v);
+    }
+};
+
+static inline void pack_put32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+static inline void pack_put64(unsigned char *p, uint64_t v) {
+    pack_put32(p, uint32_t(v));
+    pack_put32(p + 4, uint32_t(v >> 32));
+}
+static inline uint32_t pack_le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+static inline uint64_t pack_le64(const unsigned char *p) { return pack_le32(p) | uint64_t(pack_le32(p + 4)) << 32; }
+
+static inline void pack_hex(const unsigned char *d, size_t n, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; ++i) {
+        out[2 * i] = digits[d[i] >> 4];
+        out[2 * i + 1] = digits[d[i] & 0x0f];
+    }
+    out[2 * n] = '\0';
+}
+
+// Writes one pack into a directory: records are appended through a buffer
+// as chunks arrive and the index is laid out by finish(). The file is a
+// hidden temporary until then, so a failed or interrupted export never
+// leaves a pack that looks complete.
+class ChunkPackWriter {
+public:
+    ChunkPackWriter() = default;
+    ~ChunkPackWriter() {
+        abort();
+        EVP_MD_CTX_free(md_);
+    }
+    ChunkPackWriter(const ChunkPackWriter &) = delete;
+    ChunkPackWriter &operator=(const ChunkPackWriter &) = delete;
+
+    bool open(const std::string &dir) {
+        abort();
+        dir_ = dir;
+        tmp_ = dir + "/.pack-XXXXXX";
+        fd_ = mkstemp(&tmp_[0]);
+        if (fd_ < 0) {
+            fprintf(stderr, "cannot create a pack in %s: %s\n", dir.c_str(), strerror(errno));
+            return false;
+        }
+        if (!md_ && !(md_ = EVP_MD_CTX_new())) return fail("cannot create digest context");
+        if (1 != EVP_DigestInit_ex(md_, EVP_sha256(), nullptr)) return fail("digest failed");
+        buf_.resize(1 << 20);
+        buf_len_ = 0;
+        off_ = 0;
+        entries_.clear();
+        seen_.clear();
+        unsigned char head[PACK_HEADER_LEN] = {};
+        memcpy(head, CHUNK_PACK_MAGIC, 4);
+        head[4] = CHUNK_PACK_VERSION;
+        return put(head, sizeof(head));
+    }
+
+    // Appends a chunk stored under hash; added is false when the pack
+    // already holds that hash and the blob was left out.
+    bool add(const unsigned char *hash, const unsigned char *blob, size_t len, bool &added) {
+        added = false;
+        if (len < PACK_MIN_BLOB || len > PACK_MAX_BLOB) return fail("chunk blob of unsupported length");
+        Entry e;
+        memcpy(e.hash.data(), hash, PACK_HASH_LEN);
+        if (!seen_.insert(e.hash).second) return true;
+        e.offset = off_;
+        e.length = uint32_t(len);
+        unsigned char head[PACK_RECORD_HEAD];
+        memcpy(head, hash, PACK_HASH_LEN);
+        pack_put32(head + PACK_HASH_LEN, e.length);
+        if (!put(head, sizeof(head)) || !put(blob, len)) return false;
+        entries_.push_back(e);
+        added = true;
+        return true;
+    }
+
+    // Bytes the pack will take so far, index and footer included.
+    uint64_t size() const {
+        return ((off_ + 7) & ~uint64_t(7)) + PACK_FANOUT_LEN + entries_.size() * PACK_ENTRY_LEN + PACK_FOOTER_LEN;
+    }
+    size_t count() const { return entries_.size(); }
+    bool active() const { return fd_ >= 0; }
+
+    // Lays out padding, index and footer, syncs, and publishes the pack as
+    // dir/pack-<checksum>.svpk; path receives that name.
+    bool finish(std::string &path) {
+        static const unsigned char zeros[8] = {};
+        if (off_ % 8 != 0 && !put(zeros, 8 - off_ % 8)) return false;
+        const uint64_t index_at = off_;
+        std::sort(entries_.begin(), entries_.end(),
+                  [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+        unsigned char fanout[PACK_FANOUT_LEN];
+        size_t i = 0;
+        for (unsigned b = 0; b < 256; ++b) {
+            while (i < entries_.size() && entries_[i].hash[0] == b) ++i;
+            pack_put32(fanout + 4 * b, uint32_t(i));
+        }
+        bool ok = put(fanout, sizeof(fanout));
+        for (size_t k = 0; ok && k < entries_.size(); ++k) ok = put(entries_[k].hash.data(), PACK_HASH_LEN);
+        for (size_t k = 0; ok && k < entries_.size(); ++k) {
+            unsigned char v[8];
+            pack_put64(v, entries_[k].offset);
+            ok = put(v, 8);
+        }
+        for (size_t k = 0; ok && k < entries_.size(); ++k) {
+            unsigned char v[4];
+            pack_put32(v, entries_[k].length);
+            ok = put(v, 4);
+        }
+        unsigned char foot[8 + 8 + 4 + 4] = {};
+        pack_put64(foot, index_at);
+        pack_put64(foot + 8, entries_.size());
+        memcpy(foot + 16, CHUNK_PACK_MAGIC, 4);
+        ok = ok && put(foot, sizeof(foot));
+        unsigned char sum[PACK_HASH_LEN];
+        unsigned int sum_len = 0;
+        if (ok && 1 != EVP_DigestFinal_ex(md_, sum, &sum_len)) return fail("digest failed");
+        if (!ok || !raw_write(sum, sizeof(sum)) || !flush() || fsync(fd_) != 0) return fail("write failed");
+        char hex[2 * PACK_HASH_LEN + 1];
+        pack_hex(sum, sizeof(sum), hex);
+        path = dir_ + "/pack-" + hex + ".svpk";
+        if (::close(fd_) != 0) {
+            fd_ = -1;
+            return fail("write failed");
+        }
+        fd_ = -1;
+        if (rename(tmp_.c_str(), path.c_str()) != 0) {
+            fprintf(stderr, "cannot publish %s: %s\n", path.c_str(), strerror(errno));
+            unlink(tmp_.c_str());
+            return false;
+        }
+        tmp_.clear();
+        return true;
+    }
+
+    // Drops an unfinished pack.
+    void abort() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (!tmp_.empty()) {
+            unlink(tmp_.c_str());
+            tmp_.clear();
+        }
+    }
+
+private:
+    struct Entry {
+        PackHash hash;
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    bool fail(const char *what) {
+        fprintf(stderr, "%s: %s\n", tmp_.empty() ? dir_.c_str() : tmp_.c_str(), what);
+        abort();
+        return false;
+    }
+
+    // Counts and hashes n bytes, then buffers or writes them.
+    bool put(const void *p, size_t n) {
+        if (1 != EVP_DigestUpdate(md_, p, n)) return fail("digest failed");
+        off_ += n;
+        return raw_write(p, n) || fail("write failed");
+    }
+
+    bool raw_write(const void *p, size_t n) {
+        const unsigned char *src = static_cast<const unsigned char *>(p);
+        if (buf_len_ + n > buf_.size()) {
+            if (!flush()) return false;
+            if (n >= buf_.size()) return write_out(src, n);
+        }
+        memcpy(buf_.data() + buf_len_, src, n);
+        buf_len_ += n;
+        return true;
+    }
+
+    bool flush() {
+        bool ok = write_out(buf_.data(), buf_len_);
+        buf_len_ = 0;
+        return ok;
+    }
+
+    bool write_out(const unsigned char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = ::write(fd_, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w;
+            n -= size_t(w);
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    std::string dir_, tmp_;
+    EVP_MD_CTX *md_ = nullptr;
+    std::vector<unsigned char> buf_;
+    size_t buf_len_ = 0;
+    uint64_t off_ = 0; // bytes put so far
+    std::vector<Entry> entries_;
+    std::unordered_set<PackHash, PackHashHasher> seen_;
+};
+
+// A pack mapped read-only. open() checks the header and that the footer
+// and index fit the file, which is all a lookup relies on; check_index()
+// and checksum_ok() audit the rest.
+class ChunkPack {
+public:
+    ChunkPack() = default;
+    ~ChunkPack() { close(); }
+    ChunkPack(const ChunkPack &) = delete;
+    ChunkPack &operator=(const ChunkPack &) = delete;
+    ChunkPack(ChunkPack &&o) noexcept { *this = std::move(o); }
+    ChunkPack &operator=(ChunkPack &&o) noexcept {
+        if (this != &o) {
+            close();
+            std::swap(map_, o.map_);
+            std::swap(size_, o.size_);
+            std::swap(index_at_, o.index_at_);
+            std::swap(count_, o.count_);
+            path_.swap(o.path_);
+        }
+        return *this;
+    }
+
+    bool open(const std::string &path) {
+        close();
+        path_ = path;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                  uint64_t(st.st_size) >= PACK_HEADER_LEN + PACK_FANOUT_LEN + PACK_FOOTER_LEN;
+        if (ok) {
+            size_ = size_t(st.st_size);
+            void *m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            map_ = m == MAP_FAILED ? nullptr : static_cast<const unsigned char *>(m);
+            ok = map_ != nullptr;
+            if (ok) madvise(m, size_, MADV_RANDOM); // lookups; verify_pack reads sequentially
+        }
+        ::close(fd);
+        if (ok) ok = parse();
+        if (!ok) {
+            fprintf(stderr, "%s: not a chunk pack\n", path.c_str());
+            close();
+        }
+        return ok;
+    }
+
+    void close() {
+        if (map_) munmap(const_cast<unsigned char *>(map_), size_);
+        map_ = nullptr;
+        size_ = 0;
+        index_at_ = count_ = 0;
+    }
+
+    const std::string &path() const { return path_; }
+    uint64_t count() const { return count_; }
+    size_t size() const { return size_; }
+    const unsigned char *data() const { return map_; }
+    uint64_t index_offset() const { return index_at_; }
+
+    // Entry i of the index, in hash order.
+    const unsigned char *hash_at(uint64_t i) const { return hashes() + i * PACK_HASH_LEN; }
+    uint64_t offset_at(uint64_t i) const { return pack_le64(hashes() + count_ * PACK_HASH_LEN + 8 * i); }
+    uint32_t length_at(uint64_t i) const { return pack_le32(hashes() + count_ * (PACK_HASH_LEN + 8) + 4 * i); }
+
+    // The blob of a record whose index entry is i, or nullptr if the entry
+    // points outside the record area.
+    const unsigned char *blob_at(uint64_t i) const {
+        uint64_t off = offset_at(i), len = length_at(i);
+        if (off < PACK_HEADER_LEN || off > index_at_ || index_at_ - off < PACK_RECORD_HEAD + len) return nullptr;
+        return map_ + off + PACK_RECORD_HEAD;
+    }
+
+    // Looks hash up through the fanout table: entry index, or -1 if absent.
+    int64_t find(const unsigned char *hash) const {
+        const unsigned char *fan = map_ + index_at_;
+        uint64_t lo = hash[0] == 0 ? 0 : pack_le32(fan + 4 * (hash[0] - 1));
+        uint64_t hi = pack_le32(fan + 4 * hash[0]);
+        hi = std::min(hi, count_);
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            int c = memcmp(hash_at(mid), hash, PACK_HASH_LEN);
+            if (c == 0) return int64_t(mid);
+            if (c < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return -1;
+    }
+
+    // Audits the index against the records: the fanout matches the hashes,
+    // which ascend strictly, and the records it names tile the record area
+    // exactly (padding aside), each carrying the hash and length its entry
+    // gives. order receives the entries sorted by offset, which is the order
+    // to read them in. why names the first problem.
+    bool check_index(std::vector<uint64_t> &order, const char *&why) const {
+        const unsigned char *fan = map_ + index_at_;
+        uint64_t i = 0;
+        for (unsigned b = 0; b < 256; ++b) {
+            while (i < count_ && hash_at(i)[0] == b) ++i;
+            if (pack_le32(fan + 4 * b) != i) {
+                why = "fanout table does not match the hashes";
+                return false;
+            }
+        }
+        for (i = 1; i < count_; ++i) {
+            if (memcmp(hash_at(i - 1), hash_at(i), PACK_HASH_LEN) >= 0) {
+                why = "index hashes out of order";
+                return false;
+            }
+        }
+        order.resize(count_);
+        for (i = 0; i < count_; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) { return offset_at(a) < offset_at(b); });
+        uint64_t at = PACK_HEADER_LEN;
+        for (uint64_t k : order) {
+            const unsigned char *blob = blob_at(k);
+            if (offset_at(k) != at || !blob) {
+                why = "index does not tile the records";
+                return false;
+            }
+            const unsigned char *rec = map_ + at;
+            if (memcmp(rec, hash_at(k), PACK_HASH_LEN) != 0 || pack_le32(rec + PACK_HASH_LEN) != length_at(k) ||
+                length_at(k) < PACK_MIN_BLOB) {
+                why = "record does not match its index entry";
+                return false;
+            }
+            at += PACK_RECORD_HEAD + length_at(k);
+        }
+        if (at > index_at_ || index_at_ - at >= 8 || (index_at_ & 7) != 0) {
+            why = "index does not tile the records";
+            return false;
+        }
+        for (; at < index_at_; ++at) {
+            if (map_[at] != 0) {
+                why = "nonzero padding before the index";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the trailing SHA-256 matches everything before it. Reads the
+    // whole pack, so it is hinted sequential first.
+    bool checksum_ok() const {
+        madvise(const_cast<unsigned char *>(map_), size_, MADV_SEQUENTIAL);
+        EVP_MD_CTX *md = EVP_MD_CTX_new();
+        unsigned char sum[PACK_HASH_LEN];
+        unsigned int sum_len = 0;
+        bool ok = md && 1 == EVP_DigestInit_ex(md, EVP_sha256(), nullptr) &&
+                  1 == EVP_DigestUpdate(md, map_, size_ - PACK_HASH_LEN) && 1 == EVP_DigestFinal_ex(md, sum, &sum_len);
+        EVP_MD_CTX_free(md);
+        return ok && memcmp(sum, map_ + size_ - PACK_HASH_LEN, PACK_HASH_LEN) == 0;
+    }
+
+private:
+    const unsigned char *hashes() const { return map_ + index_at_ + PACK_FANOUT_LEN; }
+
+    bool parse() {
+        const unsigned char *p = map_;
+        const unsigned char *foot = map_ + size_ - PACK_FOOTER_LEN;
+        if (memcmp(p, CHUNK_PACK_MAGIC, 4) != 0 || p[4] != CHUNK_PACK_VERSION ||
+            memcmp(foot + 16, CHUNK_PACK_MAGIC, 4) != 0) {
+            return false;
+        }
+        index_at_ = pack_le64(foot);
+        count_ = pack_le64(foot + 8);
+        // Sizes are checked by division, so no count can overflow them.
+        uint64_t room = size_ - PACK_FOOTER_LEN;
+        return index_at_ >= PACK_HEADER_LEN && index_at_ % 8 == 0 && index_at_ <= room &&
+               room - index_at_ >= PACK_FANOUT_LEN && (room - index_at_ - PACK_FANOUT_LEN) % PACK_ENTRY_LEN == 0 &&
+               (room - index_at_ - PACK_FANOUT_LEN) / PACK_ENTRY_LEN == count_;
+    }
+
+    const unsigned char *map_ = nullptr;
+    size_t size_ = 0;
+    uint64_t index_at_ = 0;
+    uint64_t count_ = 0;
+    std::string path_;
+};
+
+#endif // SVLT_CHUNKPACK_H
@@ -0,0 +1,182 @@
+// Runtime CPU feature detection for the native tools: which crypto
+// instructions this host has and which AES-GCM and SHA-256 kernels that
+// makes OpenSSL pick. OpenSSL dispatches on its own capability vector at
+// startup; this mirrors that choice (including masks set through the
+// OPENSSL_ia32cap / OPENSSL_armcap environment variables) so the tools can
+// report it and warn when AES falls back to software. Header-only so each
+// tool still compiles as a single translation unit.
+
+#ifndef SVLT_CPUFEATURES_H
+#define SVLT_CPUFEATURES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define SVLT_CPU_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#define SVLT_CPU_ARM64 1
+#endif
+
+struct CpuFeatures {
+    const char *arch = "unknown";
+    // x86
+    bool ssse3 = false, aesni = false, pclmul = false, movbe = false, avx = false, avx2 = false;
+    bool avx512f = false, avx512dq = false, avx512bw = false, avx512vl = false;
+    bool vaes = false, vpclmulqdq = false, shani = false;
+    // ARMv8 crypto extensions
+    bool arm_aes = false, arm_pmull = false, arm_sha2 = false;
+    std::string masked_by; // environment variable that narrowed OpenSSL's view, if any
+
+    bool aes_hardware() const { return aesni || arm_aes; }
+};
+
+#ifdef SVLT_CPU_X86
+static inline uint64_t cpu_xgetbv0() {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (uint64_t(hi) << 32) | lo;
+}
+
+// Applies one word of an OPENSSL_ia32cap value: "~0x..." clears bits,
+// "0x..." replaces the word, as OpenSSL does.
+static inline void cpu_apply_ia32cap(const char *item, uint64_t &word) {
+    bool invert = *item == '~';
+    uint64_t v = strtoull(item + invert, nullptr, 0);
+    word = invert ? word & ~v : v;
+}
+#endif
+
+static inline CpuFeatures detect_cpu_features() {
+    CpuFeatures f;
+#ifdef SVLT_CPU_X86
+    f.arch = sizeof(void *) == 8 ? "x86_64" : "x86";
+    unsigned a = 0, b = 0, c = 0, d = 0;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return f;
+    // OpenSSL's layout: word 0 = CPUID.1 EDX | ECX << 32, word 1 = CPUID.7 EBX | ECX << 32.
+    uint64_t w0 = d | (uint64_t(c) << 32), w1 = 0;
+    unsigned max_leaf = __get_cpuid_max(0, nullptr);
+    if (max_leaf >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        w1 = b | (uint64_t(c) << 32);
+    }
+    const bool osxsave = (w0 >> 59) & 1;
+    const uint64_t xcr0 = osxsave ? cpu_xgetbv0() : 0;
+    const bool os_avx = (xcr0 & 0x6) == 0x6;      // XMM and YMM state
+    const bool os_avx512 = (xcr0 & 0xe6) == 0xe6; // plus opmask and ZMM state
+    if (const char *env = getenv("OPENSSL_ia32cap")) {
+        std::string s = env;
+        size_t colon = s.find(':');
+        cpu_apply_ia32cap(s.substr(0, colon).c_str(), w0);
+        if (colon != std::string::npos) cpu_apply_ia32cap(s.c_str() + colon + 1, w1);
+        f.masked_by = "OPENSSL_ia32cap=" + s;
+    }
+    auto bit = [](uint64_t w, unsigned n) { return ((w >> n) & 1) != 0; };
+    f.ssse3 = bit(w0, 32 + 9);
+    f.pclmul = bit(w0, 32 + 1);
+    f.movbe = bit(w0, 32 + 22);
+    f.aesni = bit(w0, 32 + 25);
+    f.avx = bit(w0, 32 + 28) && os_avx;
+    f.avx2 = bit(w1, 5) && os_avx;
+    f.avx512f = bit(w1, 16) && os_avx512;
+    f.avx512dq = bit(w1, 17) && os_avx512;
+    f.avx512bw = bit(w1, 30) && os_avx512;
+    f.avx512vl = bit(w1, 31) && os_avx512;
+    f.shani = bit(w1, 29);
+    f.vaes = bit(w1, 32 + 9) && os_avx;
+    f.vpclmulqdq = bit(w1, 32 + 10) && os_avx;
+#elif defined(SVLT_CPU_ARM64)
+    f.arch = "aarch64";
+    unsigned long hw = getauxval(AT_HWCAP);
+    // HWCAP_AES, HWCAP_PMULL, HWCAP_SHA2 from <asm/hwcap.h>
+    f.arm_aes = (hw >> 3) & 1;
+    f.arm_pmull = (hw >> 4) & 1;
+    f.arm_sha2 = (hw >> 6) & 1;
+    if (const char *env = getenv("OPENSSL_armcap")) {
+        // OpenSSL's ARMV7_NEON/AES/SHA1/SHA256/PMULL bits: 0, 2, 3, 4, 5
+        unsigned long cap = strtoul(env, nullptr, 0);
+        f.arm_aes = f.arm_aes && (cap >> 2) & 1;
+        f.arm_pmull = f.arm_pmull && (cap >> 5) & 1;
+        f.arm_sha2 = f.arm_sha2 && (cap >> 4) & 1;
+        f.masked_by = std::string("OPENSSL_armcap=") + env;
+    }
+#endif
+    return f;
+}
+
+struct CryptoKernel {
+    const char *name;
+    bool hardware;
+};
+
+// The AES-GCM code path OpenSSL selects for these features. The AVX-512
+// VAES/VPCLMULQDQ kernel only exists from OpenSSL 3.1 on.
+static inline CryptoKernel gcm_kernel(const CpuFeatures &f, unsigned long openssl_version) {
+    if (f.aesni) {
+        if (openssl_version >= 0x30100000UL && f.vaes && f.vpclmulqdq && f.avx512f && f.avx512bw &&
+            f.avx512vl && f.avx512dq) {
+            return {"VAES + VPCLMULQDQ, AVX-512 (aes-gcm-avx512)", true};
+        }
+        if (f.avx && f.movbe && f.pclmul) return {"AES-NI + PCLMULQDQ, AVX stitched (aesni-gcm-x86_64)", true};
+        if (f.pclmul) return {"AES-NI + PCLMULQDQ (aesni, ghash-x86_64 clmul)", true};
+        return {"AES-NI with table GHASH", true};
+    }
+    if (f.arm_aes) {
+        return {f.arm_pmull ? "ARMv8 AES + PMULL (aesv8-armx, ghashv8-armx)" : "ARMv8 AES with NEON GHASH", true};
+    }
+    if (f.ssse3) return {"software: constant-time vector AES (vpaes), no AES instructions", false};
+    return {"software: table AES, no AES instructions", false};
+}
+
+static inline CryptoKernel sha256_kernel(const CpuFeatures &f) {
+    if (f.shani) return {"SHA-NI", true};
+    if (f.arm_sha2) return {"ARMv8 SHA2", true};
+    if (f.avx2) return {"software: AVX2", false};
+    if (f.avx) return {"software: AVX", false};
+    if (f.ssse3) return {"software: SSSE3", false};
+    return {"software: generic", false};
+}
+
+static inline void print_cpu_features(FILE *out, const CpuFeatures &f) {
+    std::string list;
+    auto add = [&](bool on, const char *name) {
+        if (!on) return;
+        if (!list.empty()) list += ' ';
+        list += name;
+    };
+    add(f.aesni, "aes");
+    add(f.pclmul, "pclmulqdq");
+    add(f.vaes, "vaes");
+    add(f.vpclmulqdq, "vpclmulqdq");
+    add(f.shani, "sha_ni");
+    add(f.movbe, "movbe");
+    add(f.ssse3, "ssse3");
+    add(f.avx, "avx");
+    add(f.avx2, "avx2");
+    add(f.avx512f, "avx512f");
+    add(f.avx512bw, "avx512bw");
+    add(f.avx512vl, "avx512vl");
+    add(f.avx512dq, "avx512dq");
+    add(f.arm_aes, "aes");
+    add(f.arm_pmull, "pmull");
+    add(f.arm_sha2, "sha2");
+    fprintf(out, "Architecture:  %s\n", f.arch);
+    fprintf(out, "Crypto flags:  %s\n", list.empty() ? "(none)" : list.c_str());
+    if (!f.masked_by.empty()) fprintf(out, "Masked by:     %s\n", f.masked_by.c_str());
+}
+
+// Loud stderr warning when AES has no hardware support here.
+static inline void warn_software_aes(const CpuFeatures &f) {
+    if (f.aes_hardware()) return;
+    std::string why = f.masked_by.empty() ? "" : " (masked by " + f.masked_by + ")";
+    fprintf(stderr,
+            "WARNING: no AES hardware acceleration on this %s host%s; AES-GCM runs in software\n"
+            "WARNING: and is typically 5-10x slower. Run with --cpu-info for details.\n",
+            f.arch, why.c_str());
+}
+
+#endif // SVLT_CPUFEATURES_H
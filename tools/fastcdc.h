@@ -0,0 +1,225 @@
+// Content-defined chunking with a gear rolling hash and FastCDC's normalized
+// chunking (Xia et al., USENIX ATC '16), using the same min/avg/max knobs as
+// internal/chunker. Header-only so each tool still compiles as a single
+// translation unit.
+//
+// A chunk never ends before min bytes or runs past max. From min to avg a
+// position is a cut point when the top (log2(avg) + 2) bits of the hash are
+// zero; from avg on, the top (log2(avg) - 2) bits, which pulls chunk sizes
+// towards avg. The hash starts from zero at min and is rolled as
+// h = (h << 1) + GEAR[byte], so it only depends on the last 64 bytes. That
+// is what lets cdc_cut() scan several stretches of the input at once, each
+// warmed up on the 64 bytes in front of it, and still find exactly the cut
+// point the byte-at-a-time cdc_cut_scalar() finds.
+
+#ifndef SVLT_FASTCDC_H
+#define SVLT_FASTCDC_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+static constexpr uint32_t CDC_MIN_SIZE = 64;
+static constexpr uint32_t CDC_MAX_SIZE = 64u << 20;
+static constexpr unsigned CDC_NORMALIZATION = 2;
+
+struct CdcParams {
+    uint32_t min = 2048; // config.go defaults
+    uint32_t avg = 8192;
+    uint32_t max = 65536;
+};
+
+static inline bool cdc_params_valid(const CdcParams &p) {
+    return p.min >= CDC_MIN_SIZE && p.min < p.avg && p.avg < p.max && p.max <= CDC_MAX_SIZE &&
+           (p.avg & (p.avg - 1)) == 0 && p.avg >= 256;
+}
+
+// 256 pseudo-random 64-bit words from splitmix64 with a fixed seed. The
+// table is part of the chunk boundary definition: changing it moves every
+// cut point.
+struct CdcGearTable {
+    uint64_t v[256];
+    constexpr CdcGearTable() : v() {
+        uint64_t x = 0x53564c5443444301ULL; // "SVLTCDC\1"
+        for (int i = 0; i < 256; ++i) {
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+static constexpr CdcGearTable CDC_GEAR{};
+
+struct CdcMasks {
+    uint64_t small; // before avg: harder to match
+    uint64_t large; // from avg on: easier to match
+};
+
+static inline CdcMasks cdc_masks(const CdcParams &p) {
+    unsigned bits = 0;
+    while ((1u << (bits + 1)) <= p.avg) ++bits;
+    auto top = [](unsigned n) { return n == 0 ? 0 : ~0ULL << (64 - n); };
+    return {top(bits + CDC_NORMALIZATION), top(bits - CDC_NORMALIZATION)};
+}
+
+// Length of the chunk starting at p, given n available bytes. If n is
+// smaller than p.max the caller must only pass fewer bytes at end of input.
+static inline size_t cdc_cut_scalar(const unsigned char *p, size_t n, const CdcParams &prm, const CdcMasks &m) {
+    if (n <= prm.min) return n;
+    size_t end = n < prm.max ? n : prm.max;
+    size_t mid = end < prm.avg ? end : prm.avg;
+    uint64_t h = 0;
+    size_t i = prm.min;
+    for (; i < mid; ++i) {
+        h = (h << 1) + CDC_GEAR.v[p[i]];
+        if ((h & m.small) == 0) return i + 1;
+    }
+    for (; i < end; ++i) {
+        h = (h << 1) + CDC_GEAR.v[p[i]];
+        if ((h & m.large) == 0) return i + 1;
+    }
+    return end;
+}
+
+static constexpr size_t CDC_LANES = 4; // cdc_scan() unrolls exactly four
+static constexpr size_t CDC_STRIDE = 256; // bytes per lane per round
+
+// First cut point in [lo, hi) for a hash that started from zero at base, or
+// hi if there is none. Each round hashes CDC_LANES adjacent stretches of
+// CDC_STRIDE bytes side by side; the lanes have no dependency on each other,
+// so their shift/add chains overlap instead of serializing on one register.
+// (Lane state lives in scalar registers: x86 has no cheap 64-bit table
+// gather, and packing the lanes into vector registers measured slower.)
+static inline size_t cdc_scan(const unsigned char *p, size_t base, size_t lo, size_t hi, uint64_t mask) {
+    const size_t round = CDC_LANES * CDC_STRIDE;
+    while (hi - lo >= round) {
+        uint64_t start[CDC_LANES];
+        uint64_t h[CDC_LANES];
+        for (size_t k = 0; k < CDC_LANES; ++k) {
+            size_t s = lo + k * CDC_STRIDE;
+            size_t w = s - base > 64 ? s - 64 : base;
+            uint64_t x = 0;
+            for (; w < s; ++w) x = (x << 1) + CDC_GEAR.v[p[w]];
+            start[k] = s;
+            h[k] = x;
+        }
+        // (h & mask) == 0 for a top-bits mask is h < lim: one compare and a
+        // well-predicted branch per lane and byte.
+        const uint64_t lim = ~mask + 1;
+        uint64_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3];
+        const unsigned char *p0 = p + start[0], *p1 = p + start[1], *p2 = p + start[2], *p3 = p + start[3];
+        // Lanes are in input order: a hit in lane 0 ends the search, and a
+        // later lane's hit only stands if no earlier lane hits in this round.
+        size_t first = CDC_LANES, at = 0;
+        for (size_t j = 0; j < CDC_STRIDE; ++j) {
+            h0 = (h0 << 1) + CDC_GEAR.v[p0[j]];
+            h1 = (h1 << 1) + CDC_GEAR.v[p1[j]];
+            h2 = (h2 << 1) + CDC_GEAR.v[p2[j]];
+            h3 = (h3 << 1) + CDC_GEAR.v[p3[j]];
+            if (__builtin_expect(h0 < lim, 0)) return start[0] + j;
+            if (__builtin_expect(h1 < lim, 0) && first > 1) first = 1, at = j;
+            if (__builtin_expect(h2 < lim, 0) && first > 2) first = 2, at = j;
+            if (__builtin_expect(h3 < lim, 0) && first > 3) first = 3, at = j;
+        }
+        if (first < CDC_LANES) return start[first] + at;
+        lo += round;
+    }
+    size_t w = lo - base > 64 ? lo - 64 : base;
+    uint64_t x = 0;
+    for (; w < lo; ++w) x = (x << 1) + CDC_GEAR.v[p[w]];
+    for (; lo < hi; ++lo) {
+        x = (x << 1) + CDC_GEAR.v[p[lo]];
+        if ((x & mask) == 0) return lo;
+    }
+    return hi;
+}
+
+// Same result as cdc_cut_scalar().
+static inline size_t cdc_cut(const unsigned char *p, size_t n, const CdcParams &prm, const CdcMasks &m) {
+    if (n <= prm.min) return n;
+    size_t end = n < prm.max ? n : prm.max;
+    size_t mid = end < prm.avg ? end : prm.avg;
+    size_t i = cdc_scan(p, prm.min, prm.min, mid, m.small);
+    if (i < mid) return i + 1;
+    i = cdc_scan(p, prm.min, mid, end, m.large);
+    return i < end ? i + 1 : end;
+}
+
+struct CdcChunk {
+    uint64_t offset;
+    const unsigned char *data;
+    size_t len;
+};
+
+// Splits a file descriptor into chunks. Input goes through one reusable
+// arena that is refilled in place, so no memory is allocated per chunk;
+// a chunk's data stays valid until the next call to next().
+class CdcStream {
+public:
+    CdcStream(int fd, const CdcParams &p, size_t arena = 4u << 20)
+        : fd_(fd), p_(p), m_(cdc_masks(p)), buf_(arena < 2 * size_t(p.max) ? 2 * size_t(p.max) : arena) {}
+
+    // Rebinds the stream to another descriptor, keeping the arena.
+    void reset(int fd) {
+        fd_ = fd;
+        pos_ = len_ = 0;
+        offset_ = 0;
+        eof_ = false;
+        err_ = 0;
+    }
+
+    // False at end of input or on a read error (see error()).
+    bool next(CdcChunk &c) {
+        if (len_ - pos_ < p_.max && !eof_ && !fill()) return false;
+        if (pos_ == len_) return false;
+        size_t n = cdc_cut(buf_.data() + pos_, len_ - pos_, p_, m_);
+        c.offset = offset_;
+        c.data = buf_.data() + pos_;
+        c.len = n;
+        pos_ += n;
+        offset_ += n;
+        return true;
+    }
+
+    int error() const { return err_; }
+
+private:
+    bool fill() {
+        if (pos_ > 0) {
+            std::memmove(buf_.data(), buf_.data() + pos_, len_ - pos_);
+            len_ -= pos_;
+            pos_ = 0;
+        }
+        while (len_ < buf_.size()) {
+            ssize_t r = ::read(fd_, buf_.data() + len_, buf_.size() - len_);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) {
+                err_ = errno;
+                return false;
+            }
+            if (r == 0) {
+                eof_ = true;
+                break;
+            }
+            len_ += static_cast<size_t>(r);
+        }
+        return true;
+    }
+
+    int fd_;
+    CdcParams p_;
+    CdcMasks m_;
+    std::vector<unsigned char> buf_;
+    size_t pos_ = 0, len_ = 0;
+    uint64_t offset_ = 0;
+    bool eof_ = false;
+    int err_ = 0;
+};
+
+#endif // SVLT_FASTCDC_H
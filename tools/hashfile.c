@@ -1,19 +1,49 @@
 // utility to compute SHA256 of a file and print it in hex.
-// Compile with: gcc -o hashfile tools/hashfile.c -lcrypto
+//
+// Default mode hashes the file as one stream (plain SHA-256, as used by the
+// snapshot checks). --tree splits it into fixed-size leaves hashed in
+// parallel and prints the RFC 6962 Merkle tree root instead:
+//   leaf  = SHA-256(0x00 || leaf bytes)
+//   node  = SHA-256(0x01 || left || right)
+// pairing bottom-up and promoting an odd last node unchanged, which gives
+// the same root as the RFC's recursive definition. An empty file hashes to
+// SHA-256(""). --leaves=FILE ("-" for stdout) also writes one
+// "index offset length hex" line per leaf.
+//
+// -r DIR and --files-from=LIST ("-" for stdin, -0 for NUL-separated names)
+// hash many files at once: names are streamed to a pool of worker threads
+// that each reuse one digest context and read buffer, and results are
+// printed as "hex  path" lines in input order.
+//
+// Compile with: gcc -O2 -pthread -o hashfile tools/hashfile.c -lcrypto
+#define _XOPEN_SOURCE 700
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
-        return 1;
+#define DEFAULT_LEAF_SIZE (1u << 20)
+#define BATCH_RING 4096
+#define BATCH_BUF (64u << 10)
+
+static void print_hex(FILE *out, const unsigned char *d, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%02x", d[i]);
     }
-    const char *path = argv[1];
+}
+
+static int hash_stream(const char *path, unsigned char *out) {
     FILE *f = fopen(path, "rb");
     if (!f) {
         perror("fopen");
-        return 1;
+        return -1;
     }
     unsigned char buf[8192];
     SHA256_CTX ctx;
@@ -22,12 +52,469 @@ int main(int argc, char **argv) {
     while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
         SHA256_Update(&ctx, buf, n);
     }
+    int err = ferror(f);
     fclose(f);
-    unsigned char out[SHA256_DIGEST_LENGTH];
+    if (err) {
+        fprintf(stderr, "read error: %s\n", path);
+        return -1;
+    }
     SHA256_Final(out, &ctx);
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        printf("%02x", out[i]);
+    return 0;
+}
+
+// ---- tree mode ----
+
+struct tree_job {
+    int fd;
+    off_t size;
+    size_t leaf_size;
+    size_t leaves;
+    unsigned char *digests; // leaves * SHA256_DIGEST_LENGTH
+    pthread_mutex_t mu;
+    size_t next;
+    int failed;
+};
+
+static void *tree_worker(void *arg) {
+    struct tree_job *job = arg;
+    unsigned char *buf = malloc(job->leaf_size);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    static const unsigned char leaf_prefix = 0x00;
+    int ok = buf && md;
+    while (ok) {
+        pthread_mutex_lock(&job->mu);
+        size_t i = job->next++;
+        int stop = job->failed || i >= job->leaves;
+        pthread_mutex_unlock(&job->mu);
+        if (stop) {
+            break;
+        }
+        off_t off = (off_t)i * (off_t)job->leaf_size;
+        size_t len = job->leaf_size;
+        if ((off_t)len > job->size - off) {
+            len = (size_t)(job->size - off);
+        }
+        size_t got = 0;
+        while (ok && got < len) {
+            ssize_t r = pread(job->fd, buf + got, len - got, off + (off_t)got);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                fprintf(stderr, "read error at offset %lld\n", (long long)(off + (off_t)got));
+                ok = 0;
+                break;
+            }
+            got += (size_t)r;
+        }
+        unsigned int dlen = 0;
+        ok = ok && EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1 &&
+             EVP_DigestUpdate(md, &leaf_prefix, 1) == 1 && EVP_DigestUpdate(md, buf, len) == 1 &&
+             EVP_DigestFinal_ex(md, job->digests + i * SHA256_DIGEST_LENGTH, &dlen) == 1;
+    }
+    if (!ok) {
+        pthread_mutex_lock(&job->mu);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->mu);
+    }
+    EVP_MD_CTX_free(md);
+    free(buf);
+    return NULL;
+}
+
+// Folds n digests in place, level by level, into the root at level[0].
+static void merkle_root(unsigned char *level, size_t n) {
+    while (n > 1) {
+        size_t out = 0;
+        for (size_t i = 0; i + 1 < n; i += 2, out++) {
+            unsigned char node[1 + 2 * SHA256_DIGEST_LENGTH];
+            node[0] = 0x01;
+            memcpy(node + 1, level + i * SHA256_DIGEST_LENGTH, 2 * SHA256_DIGEST_LENGTH);
+            SHA256(node, sizeof(node), level + out * SHA256_DIGEST_LENGTH);
+        }
+        if (n % 2) {
+            memmove(level + out * SHA256_DIGEST_LENGTH, level + (n - 1) * SHA256_DIGEST_LENGTH,
+                    SHA256_DIGEST_LENGTH);
+            out++;
+        }
+        n = out;
+    }
+}
+
+static int hash_tree(const char *path, size_t leaf_size, unsigned threads, const char *leaves_path,
+                     unsigned char *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "--tree needs a regular file: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        SHA256((const unsigned char *)"", 0, out);
+        return 0;
+    }
+
+    struct tree_job job;
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.size = st.st_size;
+    job.leaf_size = leaf_size;
+    job.leaves = (size_t)((st.st_size + (off_t)leaf_size - 1) / (off_t)leaf_size);
+    job.digests = malloc(job.leaves * SHA256_DIGEST_LENGTH);
+    if (!job.digests) {
+        fprintf(stderr, "out of memory for %zu leaf digests\n", job.leaves);
+        close(fd);
+        return -1;
+    }
+    pthread_mutex_init(&job.mu, NULL);
+    if (threads > job.leaves) {
+        threads = (unsigned)job.leaves;
+    }
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    unsigned started = 0;
+    for (; tids && started < threads; started++) {
+        if (pthread_create(&tids[started], NULL, tree_worker, &job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        tree_worker(&job);
+    }
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    pthread_mutex_destroy(&job.mu);
+    close(fd);
+
+    int rc = job.failed ? -1 : 0;
+    if (rc == 0 && leaves_path) {
+        FILE *lf = strcmp(leaves_path, "-") == 0 ? stdout : fopen(leaves_path, "w");
+        if (!lf) {
+            perror("fopen");
+            rc = -1;
+        } else {
+            for (size_t i = 0; i < job.leaves; i++) {
+                unsigned long long off = (unsigned long long)i * leaf_size;
+                unsigned long long len = (unsigned long long)st.st_size - off;
+                if (len > leaf_size) {
+                    len = leaf_size;
+                }
+                fprintf(lf, "%zu %llu %llu ", i, off, len);
+                print_hex(lf, job.digests + i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH);
+                fputc('\n', lf);
+            }
+            if (lf != stdout && fclose(lf) != 0) {
+                perror("fclose");
+                rc = -1;
+            }
+        }
+    }
+    if (rc == 0) {
+        merkle_root(job.digests, job.leaves);
+        memcpy(out, job.digests, SHA256_DIGEST_LENGTH);
+    }
+    free(job.digests);
+    return rc;
+}
+
+// ---- many-files mode ----
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_BUSY, SLOT_DONE, SLOT_FAILED };
+
+struct batch_slot {
+    char *path;
+    int state;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+};
+
+// Bounded ring between the producer (main thread, which also prints) and
+// the hashing workers: [tail, take) are being hashed, [take, head) queued.
+struct batch {
+    struct batch_slot slots[BATCH_RING];
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    size_t head, take, tail;
+    int eof;
+    int failed;
+};
+
+static int hash_one(EVP_MD_CTX *md, unsigned char *buf, const char *path, unsigned char *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1;
+    for (;;) {
+        ssize_t r = read(fd, buf, BATCH_BUF);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            ok = 0;
+        }
+        if (r <= 0 || !ok) {
+            break;
+        }
+        ok = EVP_DigestUpdate(md, buf, (size_t)r) == 1;
+    }
+    close(fd);
+    unsigned int dlen = 0;
+    return ok && EVP_DigestFinal_ex(md, out, &dlen) == 1 ? 0 : -1;
+}
+
+static void *batch_worker(void *arg) {
+    struct batch *b = arg;
+    unsigned char *buf = malloc(BATCH_BUF);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    for (;;) {
+        pthread_mutex_lock(&b->mu);
+        while (b->take == b->head && !b->eof) {
+            pthread_cond_wait(&b->cv, &b->mu);
+        }
+        if (b->take == b->head) {
+            pthread_mutex_unlock(&b->mu);
+            break;
+        }
+        struct batch_slot *slot = &b->slots[b->take++ % BATCH_RING];
+        slot->state = SLOT_BUSY;
+        pthread_mutex_unlock(&b->mu);
+
+        int rc = buf && md ? hash_one(md, buf, slot->path, slot->digest) : -1;
+
+        pthread_mutex_lock(&b->mu);
+        slot->state = rc == 0 ? SLOT_DONE : SLOT_FAILED;
+        pthread_cond_broadcast(&b->cv);
+        pthread_mutex_unlock(&b->mu);
+    }
+    EVP_MD_CTX_free(md);
+    free(buf);
+    return NULL;
+}
+
+// Prints finished results in order; called with b->mu held.
+static void batch_flush(struct batch *b) {
+    while (b->tail != b->head) {
+        struct batch_slot *slot = &b->slots[b->tail % BATCH_RING];
+        if (slot->state == SLOT_DONE) {
+            print_hex(stdout, slot->digest, SHA256_DIGEST_LENGTH);
+            printf("  %s\n", slot->path);
+        } else if (slot->state == SLOT_FAILED) {
+            b->failed = 1;
+        } else {
+            break;
+        }
+        free(slot->path);
+        slot->path = NULL;
+        slot->state = SLOT_FREE;
+        b->tail++;
+    }
+}
+
+static void batch_push(struct batch *b, const char *path) {
+    char *copy = strdup(path);
+    if (!copy) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&b->mu);
+    for (;;) {
+        batch_flush(b);
+        if (b->head - b->tail < BATCH_RING) {
+            break;
+        }
+        pthread_cond_wait(&b->cv, &b->mu);
+    }
+    struct batch_slot *slot = &b->slots[b->head++ % BATCH_RING];
+    slot->path = copy;
+    slot->state = SLOT_QUEUED;
+    pthread_cond_broadcast(&b->cv);
+    pthread_mutex_unlock(&b->mu);
+}
+
+static struct batch *walk_batch;
+
+static int walk_visit(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    if (type == FTW_F) {
+        batch_push(walk_batch, path);
+    } else if (type == FTW_DNR || type == FTW_NS) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        pthread_mutex_lock(&walk_batch->mu);
+        walk_batch->failed = 1;
+        pthread_mutex_unlock(&walk_batch->mu);
+    }
+    return 0;
+}
+
+static int hash_many(const char *dir, const char *list, int nul, unsigned threads) {
+    static struct batch b;
+    pthread_mutex_init(&b.mu, NULL);
+    pthread_cond_init(&b.cv, NULL);
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    unsigned started = 0;
+    for (; tids && started < threads; started++) {
+        if (pthread_create(&tids[started], NULL, batch_worker, &b) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        fprintf(stderr, "cannot start hashing threads\n");
+        free(tids);
+        return -1;
+    }
+
+    int rc = 0;
+    if (dir) {
+        walk_batch = &b;
+        if (nftw(dir, walk_visit, 64, FTW_PHYS) != 0) {
+            perror("nftw");
+            rc = -1;
+        }
+    } else {
+        FILE *in = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+        if (!in) {
+            perror("fopen");
+            rc = -1;
+        } else {
+            char *line = NULL;
+            size_t cap = 0;
+            ssize_t n;
+            while ((n = getdelim(&line, &cap, nul ? '\0' : '\n', in)) > 0) {
+                if (line[n - 1] == (nul ? '\0' : '\n')) {
+                    line[--n] = '\0';
+                }
+                if (n > 0) {
+                    batch_push(&b, line);
+                }
+            }
+            if (ferror(in)) {
+                fprintf(stderr, "read error: %s\n", list);
+                rc = -1;
+            }
+            free(line);
+            if (in != stdin) {
+                fclose(in);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&b.mu);
+    b.eof = 1;
+    pthread_cond_broadcast(&b.cv);
+    for (;;) {
+        batch_flush(&b);
+        if (b.tail == b.head) {
+            break;
+        }
+        pthread_cond_wait(&b.cv, &b.mu);
+    }
+    pthread_mutex_unlock(&b.mu);
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    return rc != 0 || b.failed ? -1 : 0;
+}
+
+// Parses a byte count with an optional K/M/G (binary) suffix.
+static int parse_size(const char *s, size_t *out) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s) {
+        return -1;
+    }
+    switch (*end) {
+    case 'K': case 'k': v <<= 10; end++; break;
+    case 'M': case 'm': v <<= 20; end++; break;
+    case 'G': case 'g': v <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    *out = (size_t)v;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--tree [--leaf-size=SIZE] [-j N] [--leaves=FILE|-]] <file>\n"
+            "       %s [-j N] -r <dir> | --files-from=<list|-> [-0]\n"
+            "  default      plain SHA-256 of the whole file\n"
+            "  --tree       Merkle root (RFC 6962) of SHA-256 leaves hashed in parallel\n"
+            "  --leaf-size  leaf size, e.g. 4M (default 1M)\n"
+            "  -j           hashing threads (default: all cores)\n"
+            "  --leaves     also write \"index offset length hex\" per leaf\n"
+            "  -r           SHA-256 of every regular file under dir\n"
+            "  --files-from SHA-256 of each file named in list, one per line\n"
+            "  -0           list names are NUL-separated (find -print0)\n",
+            prog, prog);
+}
+
+int main(int argc, char **argv) {
+    int tree = 0;
+    size_t leaf_size = DEFAULT_LEAF_SIZE;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = ncpu > 0 ? (unsigned)ncpu : 1;
+    const char *leaves_path = NULL;
+    const char *dir = NULL;
+    const char *list = NULL;
+    int nul = 0;
+    int argi = 1;
+    for (; argi < argc; argi++) {
+        if (strcmp(argv[argi], "--tree") == 0) {
+            tree = 1;
+        } else if (strncmp(argv[argi], "--leaf-size=", 12) == 0) {
+            if (parse_size(argv[argi] + 12, &leaf_size) != 0 || leaf_size < 4096 || leaf_size > (1u << 30)) {
+                fprintf(stderr, "Leaf size must be between 4K and 1G\n");
+                return 1;
+            }
+        } else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            threads = (unsigned)strtoul(argv[++argi], NULL, 10);
+            if (threads == 0) {
+                threads = ncpu > 0 ? (unsigned)ncpu : 1;
+            }
+        } else if (strncmp(argv[argi], "--leaves=", 9) == 0) {
+            leaves_path = argv[argi] + 9;
+        } else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc) {
+            dir = argv[++argi];
+        } else if (strncmp(argv[argi], "--files-from=", 13) == 0) {
+            list = argv[argi] + 13;
+        } else if (strcmp(argv[argi], "-0") == 0) {
+            nul = 1;
+        } else {
+            break;
+        }
+    }
+    if (dir || list) {
+        if (argi != argc || tree || leaves_path || (dir && list)) {
+            usage(argv[0]);
+            return 1;
+        }
+        return hash_many(dir, list, nul, threads) == 0 ? 0 : 1;
+    }
+    if (argi + 1 != argc || (!tree && leaves_path) || nul) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *path = argv[argi];
+    unsigned char out[SHA256_DIGEST_LENGTH];
+    int rc = tree ? hash_tree(path, leaf_size, threads, leaves_path, out) : hash_stream(path, out);
+    if (rc != 0) {
+        return 1;
     }
+    print_hex(stdout, out, SHA256_DIGEST_LENGTH);
     printf("  %s\n", path);
     return 0;
 }
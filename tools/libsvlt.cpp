@@ -0,0 +1,545 @@
+// libsvlt: the C ABI in svlt.h over the v2 format code in svlt_format.h,
+// which aesgcm_file uses as well. A stream is processed segment by
+// segment on the calling thread; aesgcm_file layers its parallel pipeline
+// and I/O backends over the same primitives.
+// Compile with:
+//   g++ -std=c++17 -O2 -fPIC -fvisibility=hidden -shared -o libsvlt.so tools/libsvlt.cpp -lcrypto -lz
+// adding -DSVLT_HAVE_ZSTD -lzstd and/or -DSVLT_HAVE_LZ4 -llz4 as for aesgcm_file.
+
+#define SVLT_LIBRARY 1
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <new>
+#include "svlt_format.h"
+#include "svlt.h"
+
+namespace {
+
+enum class Stage { Setup, Streaming, Done, Failed };
+
+int fail(Stage &stage, int code) {
+    stage = Stage::Failed;
+    return code;
+}
+
+int bad_call(const char *what) {
+    svlt_diag("%s", what);
+    return SVLT_EINVAL;
+}
+
+// Setters and init only apply before a handle starts streaming.
+template <typename Handle>
+int check_setup(const Handle *h) {
+    if (!h) return bad_call("null handle");
+    return h->stage == Stage::Setup ? SVLT_OK : bad_call("handle already initialized");
+}
+
+} // namespace
+
+struct svlt_encryptor {
+    Stage stage = Stage::Setup;
+    V2Header h;
+    bool embed_sha256 = false;
+    uint64_t rekey_bytes = DEFAULT_REKEY_BYTES;
+    CipherCtx ctx;
+    EpochKey keys;
+    PlainDigest digest;
+    size_t header_sent = 0;
+    std::vector<unsigned char> pending; // the segment being filled, h.segment_size bytes
+    size_t pending_len = 0;
+    CodecScratch codec;
+    uint64_t index = 0;
+};
+
+struct svlt_decryptor {
+    Stage stage = Stage::Setup;
+    bool have_key = false;
+    unsigned char key[KEY_LEN];
+    std::string passphrase;
+    KdfLimits kdf_limits;
+    V2Header h;
+    size_t header_need = V2_FIXED_HEADER_LEN;
+    bool header_done = false;
+    CipherCtx ctx;
+    EpochKey keys;
+    PlainDigest digest;
+    size_t trailer = 0;
+    unsigned char held[MAX_DIGEST_TRAILER]; // last plaintext bytes, possibly the trailer
+    size_t held_len = 0;
+    std::vector<unsigned char> buf; // a record split across update() calls
+    size_t buf_len = 0;
+    CodecScratch codec;
+    uint64_t index = 0;
+
+    ~svlt_decryptor() {
+        OPENSSL_cleanse(key, KEY_LEN);
+        if (!passphrase.empty()) OPENSSL_cleanse(&passphrase[0], passphrase.size());
+    }
+};
+
+extern "C" {
+
+uint32_t svlt_abi_version(void) { return SVLT_ABI_VERSION; }
+
+const char *svlt_strerror(int code) {
+    switch (code) {
+    case SVLT_OK: return "success";
+    case SVLT_EINVAL: return "invalid argument or call sequence";
+    case SVLT_ENOSPC: return "output buffer too small";
+    case SVLT_EFORMAT: return "unsupported or malformed stream";
+    case SVLT_EAUTH: return "authentication failed";
+    case SVLT_ECRYPTO: return "cryptographic operation failed";
+    case SVLT_ENOMEM: return "out of memory";
+    default: return "unknown error";
+    }
+}
+
+const char *svlt_last_error(void) { return svlt_diag_buf; }
+
+int svlt_codec_supported(int codec) { return codec == SVLT_CODEC_NONE || codec_built_in(codec) ? 1 : 0; }
+
+// ---- encryption ----
+
+int svlt_encryptor_new(svlt_encryptor **out) {
+    if (!out) return bad_call("null handle pointer");
+    *out = new (std::nothrow) svlt_encryptor;
+    if (!*out) return SVLT_ENOMEM;
+    (*out)->h.segment_size = DEFAULT_SEGMENT_SIZE;
+    (*out)->h.has_kdf = true;
+    return SVLT_OK;
+}
+
+void svlt_encryptor_free(svlt_encryptor *e) { delete e; }
+
+int svlt_encryptor_set_segment_size(svlt_encryptor *e, uint32_t segment_size) {
+    if (int rc = check_setup(e)) return rc;
+    if (segment_size < MIN_SEGMENT_SIZE || segment_size > MAX_SEGMENT_SIZE) {
+        return bad_call("segment size must be between 4K and 64M");
+    }
+    e->h.segment_size = segment_size;
+    return SVLT_OK;
+}
+
+static int set_kdf(svlt_encryptor *e, const KdfParams &k) {
+    if (int rc = check_setup(e)) return rc;
+    if (!kdf_params_valid(k)) return bad_call("unsupported KDF parameters");
+    e->h.kdf = k;
+    return SVLT_OK;
+}
+
+int svlt_encryptor_set_pbkdf2(svlt_encryptor *e, uint32_t iterations) {
+    KdfParams k = legacy_kdf();
+    k.iterations = iterations;
+    return set_kdf(e, k);
+}
+
+int svlt_encryptor_set_argon2id(svlt_encryptor *e, uint32_t passes, uint32_t memory_kib, uint32_t lanes) {
+    KdfParams k;
+    k.t_cost = passes;
+    k.m_cost_kib = memory_kib;
+    k.lanes = lanes;
+    return set_kdf(e, k);
+}
+
+int svlt_encryptor_set_compression(svlt_encryptor *e, int codec, int level) {
+    if (int rc = check_setup(e)) return rc;
+    if (codec == SVLT_CODEC_NONE) {
+        e->h.codec = CODEC_NONE;
+        e->h.codec_level = 0;
+        return SVLT_OK;
+    }
+    if (codec < 0 || codec > 0xff || !codec_built_in(static_cast<unsigned char>(codec))) {
+        return bad_call("codec not supported by this build");
+    }
+    const unsigned char c = static_cast<unsigned char>(codec);
+    if (level == 0) level = int(codec_default_level(c));
+    if (level < 1 || uint32_t(level) > codec_max_level(c)) return bad_call("compression level out of range");
+    e->h.codec = c;
+    e->h.codec_level = static_cast<unsigned char>(level);
+    return SVLT_OK;
+}
+
+int svlt_encryptor_set_embed_sha256(svlt_encryptor *e, int on) {
+    if (int rc = check_setup(e)) return rc;
+    e->embed_sha256 = on != 0;
+    return SVLT_OK;
+}
+
+int svlt_encryptor_set_rekey_interval(svlt_encryptor *e, uint64_t bytes) {
+    if (int rc = check_setup(e)) return rc;
+    e->rekey_bytes = bytes;
+    return SVLT_OK;
+}
+
+int svlt_encryptor_set_sparse(svlt_encryptor *e, int on) {
+    if (int rc = check_setup(e)) return rc;
+    e->h.sparse = on != 0;
+    return SVLT_OK;
+}
+
+// Fills in the salts and nonce, keys the cipher from the KDF output and
+// lays out the header.
+static int start_encryptor(svlt_encryptor *e, const unsigned char *master) {
+    V2Header &h = e->h;
+    if (e->embed_sha256) h.digests.assign(1, DIGEST_SHA256);
+    // The stream's length is unknown, so any interval rotates.
+    h.rekey_segments = rekey_interval(e->rekey_bytes, h.segment_size, UINT64_MAX);
+    if (h.rekey_segments > 0) h.has_file_salt = true;
+    if (RAND_bytes(h.nonce, NONCE_LEN) != 1 || (h.has_file_salt && RAND_bytes(h.file_salt, SALT_LEN) != 1)) {
+        print_openssl_errors();
+        return fail(e->stage, SVLT_ECRYPTO);
+    }
+    build_v2_header(h);
+    unsigned char key[KEY_LEN];
+    bool ok = v2_subkey(master, h, key) && (e->ctx = new_segment_ctx(true, key)) != nullptr &&
+              e->digest.init(h.digests);
+    e->keys.reset(key);
+    OPENSSL_cleanse(key, KEY_LEN);
+    if (!ok) return fail(e->stage, SVLT_ECRYPTO);
+    e->pending.resize(h.segment_size);
+    e->stage = Stage::Streaming;
+    return SVLT_OK;
+}
+
+int svlt_encrypt_init(svlt_encryptor *e, const char *passphrase, size_t passphrase_len) {
+    if (int rc = check_setup(e)) return rc;
+    if (!passphrase || passphrase_len == 0) return bad_call("empty passphrase");
+    if (RAND_bytes(e->h.salt, SALT_LEN) != 1) {
+        print_openssl_errors();
+        return fail(e->stage, SVLT_ECRYPTO);
+    }
+    std::string pass(passphrase, passphrase_len);
+    unsigned char master[KEY_LEN];
+    bool derived = derive_key(pass, e->h.kdf, e->h.salt, master);
+    OPENSSL_cleanse(&pass[0], pass.size());
+    int rc = derived ? start_encryptor(e, master) : fail(e->stage, SVLT_ECRYPTO);
+    OPENSSL_cleanse(master, KEY_LEN);
+    return rc;
+}
+
+int svlt_encrypt_init_key(svlt_encryptor *e, const uint8_t key[SVLT_KEY_LEN]) {
+    if (int rc = check_setup(e)) return rc;
+    if (!key) return bad_call("null key");
+    // The key replaces the KDF output, so the header records no KDF; a
+    // file salt still gives every stream its own subkey.
+    e->h.has_kdf = false;
+    e->h.has_file_salt = true;
+    if (RAND_bytes(e->h.salt, SALT_LEN) != 1) {
+        print_openssl_errors();
+        return fail(e->stage, SVLT_ECRYPTO);
+    }
+    return start_encryptor(e, key);
+}
+
+size_t svlt_encrypt_output_size(const svlt_encryptor *e) {
+    if (!e || e->stage == Stage::Setup) return 0;
+    return e->h.raw.size() + 2 * v2_max_record(e->h);
+}
+
+static void put_header(svlt_encryptor *e, unsigned char *out, size_t out_cap, size_t &pos) {
+    size_t n = std::min(e->h.raw.size() - e->header_sent, out_cap - pos);
+    if (n > 0) memcpy(out + pos, e->h.raw.data() + e->header_sent, n);
+    e->header_sent += n;
+    pos += n;
+}
+
+static bool seal_next(svlt_encryptor *e, const unsigned char *src, size_t len, bool final, unsigned char *out,
+                      size_t &pos) {
+    bool packed = false;
+    size_t n = seal_v2_segment(e->ctx.get(), e->keys, e->h, e->index, final, src, len, e->codec, out + pos, packed);
+    if (n == 0) return false;
+    ++e->index;
+    pos += n;
+    return true;
+}
+
+int svlt_encrypt_update(svlt_encryptor *e, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                        size_t out_cap, size_t *out_len) {
+    if (!e || !in_used || !out_len || (!in && in_len > 0) || (!out && out_cap > 0)) return bad_call("null argument");
+    *in_used = *out_len = 0;
+    if (e->stage != Stage::Streaming) return bad_call("encryptor not streaming");
+    size_t pos = 0, used = 0;
+    put_header(e, out, out_cap, pos);
+    const size_t seg = e->h.segment_size, rec = v2_max_record(e->h);
+    // A full segment is only sealed once more input shows it is not the last.
+    while (e->header_sent == e->h.raw.size()) {
+        if (e->pending_len == seg && used < in_len) {
+            if (out_cap - pos < rec) break;
+            if (!seal_next(e, e->pending.data(), seg, false, out, pos)) return fail(e->stage, SVLT_ECRYPTO);
+            e->pending_len = 0;
+        }
+        if (e->pending_len == 0 && in_len - used > seg) {
+            // Straight from the caller's buffer, no copy.
+            if (out_cap - pos < rec) break;
+            e->digest.update(in + used, seg);
+            if (!seal_next(e, in + used, seg, false, out, pos)) return fail(e->stage, SVLT_ECRYPTO);
+            used += seg;
+            continue;
+        }
+        if (used == in_len) break;
+        size_t take = std::min(in_len - used, seg - e->pending_len);
+        if (take == 0) break;
+        memcpy(e->pending.data() + e->pending_len, in + used, take);
+        e->digest.update(in + used, take);
+        e->pending_len += take;
+        used += take;
+    }
+    *in_used = used;
+    *out_len = pos;
+    return in_len > 0 && used == 0 && pos == 0 ? SVLT_ENOSPC : SVLT_OK;
+}
+
+int svlt_encrypt_final(svlt_encryptor *e, uint8_t *out, size_t out_cap, size_t *out_len) {
+    if (!e || !out_len || (!out && out_cap > 0)) return bad_call("null argument");
+    *out_len = 0;
+    if (e->stage != Stage::Streaming) return bad_call("encryptor not streaming");
+    const size_t seg = e->h.segment_size, trailer = trailer_len(e->h);
+    const size_t records = e->pending_len + trailer > seg ? 2 : 1;
+    if (out_cap < e->h.raw.size() - e->header_sent + records * v2_max_record(e->h)) {
+        svlt_diag("final needs %zu bytes of output", e->h.raw.size() - e->header_sent + records * v2_max_record(e->h));
+        return SVLT_ENOSPC;
+    }
+    size_t pos = 0;
+    put_header(e, out, out_cap, pos);
+    unsigned char sums[MAX_DIGEST_TRAILER];
+    if (e->digest.active() && !e->digest.final(sums)) return fail(e->stage, SVLT_ECRYPTO);
+    // The trailer goes after the plaintext; what does not fit spills over.
+    size_t fit = std::min(trailer, seg - e->pending_len);
+    memcpy(e->pending.data() + e->pending_len, sums, fit);
+    e->pending_len += fit;
+    bool ok = true;
+    if (fit < trailer) {
+        ok = seal_next(e, e->pending.data(), e->pending_len, false, out, pos);
+        memcpy(e->pending.data(), sums + fit, trailer - fit);
+        e->pending_len = trailer - fit;
+    }
+    ok = ok && seal_next(e, e->pending.data(), e->pending_len, true, out, pos);
+    OPENSSL_cleanse(e->pending.data(), e->pending.size());
+    if (!ok) return fail(e->stage, SVLT_ECRYPTO);
+    e->stage = Stage::Done;
+    *out_len = pos;
+    return SVLT_OK;
+}
+
+// ---- decryption ----
+
+int svlt_decryptor_new(svlt_decryptor **out) {
+    if (!out) return bad_call("null handle pointer");
+    *out = new (std::nothrow) svlt_decryptor;
+    return *out ? SVLT_OK : SVLT_ENOMEM;
+}
+
+void svlt_decryptor_free(svlt_decryptor *d) { delete d; }
+
+int svlt_decryptor_set_kdf_limits(svlt_decryptor *d, uint32_t max_memory_kib, uint32_t max_passes,
+                                  uint32_t max_iterations) {
+    if (int rc = check_setup(d)) return rc;
+    KdfLimits limits;
+    if (max_memory_kib) limits.max_m_cost_kib = max_memory_kib;
+    if (max_passes) limits.max_t_cost = max_passes;
+    if (max_iterations) limits.max_iterations = max_iterations;
+    d->kdf_limits = limits;
+    return SVLT_OK;
+}
+
+int svlt_decrypt_init(svlt_decryptor *d, const char *passphrase, size_t passphrase_len) {
+    if (int rc = check_setup(d)) return rc;
+    if (!passphrase || passphrase_len == 0) return bad_call("empty passphrase");
+    d->passphrase.assign(passphrase, passphrase_len);
+    d->stage = Stage::Streaming;
+    return SVLT_OK;
+}
+
+int svlt_decrypt_init_key(svlt_decryptor *d, const uint8_t key[SVLT_KEY_LEN]) {
+    if (int rc = check_setup(d)) return rc;
+    if (!key) return bad_call("null key");
+    memcpy(d->key, key, KEY_LEN);
+    d->have_key = true;
+    d->stage = Stage::Streaming;
+    return SVLT_OK;
+}
+
+size_t svlt_decrypt_output_size(const svlt_decryptor *d) {
+    if (!d || !d->header_done) return 0;
+    return size_t(d->h.segment_size) + d->trailer;
+}
+
+// Collects header bytes; once the header is complete, derives the key.
+static int take_header(svlt_decryptor *d, const uint8_t *in, size_t in_len, size_t &used) {
+    V2Header &h = d->h;
+    while (!d->header_done && used < in_len) {
+        size_t take = std::min(d->header_need - h.raw.size(), in_len - used);
+        h.raw.append(in + used, take);
+        used += take;
+        if (h.raw.size() < d->header_need) break;
+        if (d->header_need == V2_FIXED_HEADER_LEN) {
+            if (memcmp(h.raw.data(), MAGIC, 4) != 0) {
+                svlt_diag("not an SVLT stream");
+                return SVLT_EFORMAT;
+            }
+            if (h.raw[4] != VERSION_V2) {
+                svlt_diag("%s", h.raw[4] == VERSION_V1 ? "v1 files carry one tag at the end and cannot be streamed"
+                                                       : "unsupported format version");
+                return SVLT_EFORMAT;
+            }
+            size_t ext_len = 0;
+            if (!parse_v2_fixed(h, ext_len)) return SVLT_EFORMAT;
+            d->header_need += ext_len;
+            if (ext_len > 0) continue;
+        }
+        if (!parse_v2_extensions(h.raw.data() + V2_FIXED_HEADER_LEN, h.raw.size() - V2_FIXED_HEADER_LEN, h,
+                                 d->kdf_limits)) {
+            return SVLT_EFORMAT;
+        }
+        unsigned char master[KEY_LEN], key[KEY_LEN];
+        bool ok = d->have_key ? (memcpy(master, d->key, KEY_LEN), true)
+                              : derive_key(d->passphrase, h.kdf, h.salt, master);
+        ok = ok && v2_subkey(master, h, key) && (d->ctx = new_segment_ctx(false, key)) != nullptr &&
+             d->digest.init(h.digests);
+        d->keys.reset(key);
+        OPENSSL_cleanse(master, KEY_LEN);
+        OPENSSL_cleanse(key, KEY_LEN);
+        if (!d->passphrase.empty()) {
+            OPENSSL_cleanse(&d->passphrase[0], d->passphrase.size());
+            d->passphrase.clear();
+        }
+        if (!ok) return SVLT_ECRYPTO;
+        d->trailer = trailer_len(h);
+        d->header_done = true;
+    }
+    return SVLT_OK;
+}
+
+// Length of the record starting at p given n bytes of it: 0 if a framed
+// record's length prefix is not all there yet, SIZE_MAX if it is invalid.
+static size_t record_len(const svlt_decryptor *d, const unsigned char *p, size_t n) {
+    if (!v2_framed(d->h)) return size_t(d->h.segment_size) + TAG_LEN;
+    if (n < RECORD_LEN_PREFIX) return 0;
+    size_t sealed = v2_record_sealed(d->h, p);
+    if (sealed == 0) {
+        svlt_diag("invalid length for segment %llu", static_cast<unsigned long long>(d->index));
+        return SIZE_MAX;
+    }
+    return RECORD_LEN_PREFIX + sealed + TAG_LEN;
+}
+
+// Appends n bytes of input to the record buffered in buf. buf grows with
+// the bytes that have actually arrived, up to one full record, so neither
+// the header's segment size nor a length prefix alone can make a short
+// hostile stream allocate a large buffer.
+static void hold_input(svlt_decryptor *d, const unsigned char *p, size_t n) {
+    if (n == 0) return;
+    if (d->buf.size() < d->buf_len + n) {
+        d->buf.resize(std::min(std::max(2 * d->buf.size(), d->buf_len + n), v2_max_record(d->h)));
+    }
+    memcpy(d->buf.data() + d->buf_len, p, n);
+    d->buf_len += n;
+}
+
+// Opens one record into out + pos. The last `trailer` plaintext bytes seen
+// so far stay in held, since they may turn out to be the digest trailer.
+static bool open_next(svlt_decryptor *d, const unsigned char *rec, size_t len, bool final, unsigned char *out,
+                      size_t &pos) {
+    const size_t skip = v2_framed(d->h) ? RECORD_LEN_PREFIX : 0;
+    if (len < skip + TAG_LEN) {
+        svlt_diag("truncated segment %llu", static_cast<unsigned long long>(d->index));
+        return false;
+    }
+    unsigned char *dst = out + pos;
+    memcpy(dst, d->held, d->held_len);
+    size_t plain = 0;
+    if (!open_v2_segment(d->ctx.get(), d->keys, d->h, d->index, final, rec + skip, len - skip - TAG_LEN,
+                         dst + d->held_len, d->codec, plain)) {
+        return false;
+    }
+    size_t total = d->held_len + plain;
+    size_t ready = total > d->trailer ? total - d->trailer : 0;
+    d->digest.update(dst, ready);
+    d->held_len = total - ready;
+    memmove(d->held, dst + ready, d->held_len);
+    pos += ready;
+    ++d->index;
+    return true;
+}
+
+int svlt_decrypt_update(svlt_decryptor *d, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                        size_t out_cap, size_t *out_len) {
+    if (!d || !in_used || !out_len || (!in && in_len > 0) || (!out && out_cap > 0)) return bad_call("null argument");
+    *in_used = *out_len = 0;
+    if (d->stage != Stage::Streaming) return bad_call("decryptor not streaming");
+    size_t used = 0, pos = 0;
+    int rc = take_header(d, in, in_len, used);
+    if (rc != SVLT_OK) return fail(d->stage, rc);
+    // A record is only opened once more input shows it is not the last.
+    while (d->header_done) {
+        const size_t room = size_t(d->h.segment_size) + d->held_len;
+        if (d->buf_len > 0) {
+            size_t need = record_len(d, d->buf.data(), d->buf_len);
+            if (need == 0) need = RECORD_LEN_PREFIX;
+            if (need == SIZE_MAX) return fail(d->stage, SVLT_EFORMAT);
+            size_t take = std::min(need - d->buf_len, in_len - used);
+            hold_input(d, in + used, take);
+            used += take;
+            if (d->buf_len < need || used == in_len) break;
+            if (record_len(d, d->buf.data(), d->buf_len) != d->buf_len) continue; // only the prefix so far
+            if (out_cap - pos < room) break;
+            if (!open_next(d, d->buf.data(), d->buf_len, false, out, pos)) return fail(d->stage, SVLT_EAUTH);
+            d->buf_len = 0;
+            continue;
+        }
+        const size_t avail = in_len - used;
+        size_t need = record_len(d, in + used, avail);
+        if (need == SIZE_MAX) return fail(d->stage, SVLT_EFORMAT);
+        if (need > 0 && avail > need) {
+            if (out_cap - pos < room) break;
+            if (!open_next(d, in + used, need, false, out, pos)) return fail(d->stage, SVLT_EAUTH);
+            used += need;
+            continue;
+        }
+        hold_input(d, in + used, avail);
+        used += avail;
+        break;
+    }
+    *in_used = used;
+    *out_len = pos;
+    return in_len > 0 && used == 0 && pos == 0 ? SVLT_ENOSPC : SVLT_OK;
+}
+
+int svlt_decrypt_final(svlt_decryptor *d, uint8_t *out, size_t out_cap, size_t *out_len) {
+    if (!d || !out_len || (!out && out_cap > 0)) return bad_call("null argument");
+    *out_len = 0;
+    if (d->stage != Stage::Streaming) return bad_call("decryptor not streaming");
+    if (!d->header_done) {
+        svlt_diag("stream ends inside the header");
+        return fail(d->stage, SVLT_EFORMAT);
+    }
+    // Whatever is buffered must be exactly the final record.
+    size_t need = d->buf_len == 0 ? 0 : record_len(d, d->buf.data(), d->buf_len);
+    if (d->buf_len == 0 || (v2_framed(d->h) && need != d->buf_len)) {
+        svlt_diag("stream truncated before its final segment");
+        return fail(d->stage, SVLT_EAUTH);
+    }
+    if (out_cap < size_t(d->h.segment_size) + d->held_len) {
+        svlt_diag("final needs %zu bytes of output", size_t(d->h.segment_size) + d->held_len);
+        return SVLT_ENOSPC;
+    }
+    size_t pos = 0;
+    if (!open_next(d, d->buf.data(), d->buf_len, true, out, pos)) return fail(d->stage, SVLT_EAUTH);
+    d->buf_len = 0;
+    if (d->held_len != d->trailer) {
+        svlt_diag("stream too short for its digest trailer");
+        return fail(d->stage, SVLT_EAUTH);
+    }
+    unsigned char sums[MAX_DIGEST_TRAILER];
+    if (d->digest.active() && !d->digest.final(sums)) return fail(d->stage, SVLT_ECRYPTO);
+    if (d->trailer > 0 && CRYPTO_memcmp(sums, d->held, d->trailer) != 0) {
+        svlt_diag("plaintext digest does not match the embedded trailer");
+        return fail(d->stage, SVLT_EAUTH);
+    }
+    d->stage = Stage::Done;
+    *out_len = pos;
+    return SVLT_OK;
+}
+
+} // extern "C"
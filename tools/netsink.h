@@ -0,0 +1,1093 @@
+// Network output for aesgcm_file: an output path of tcp://HOST:PORT/NAME,
+// unix:SOCKET#NAME or http://HOST[:PORT]/PATH ships the file to a receiver
+// while it is being written, so encrypting and uploading overlap instead of
+// a local copy being written first and sent afterwards. Header-only so each
+// tool still compiles as a single translation unit.
+//
+// The byte stream is cut into units: whole writes (records, from the v2
+// pipeline) gathered until a unit holds at least unit_size bytes, so with
+// segments of unit_size or more a unit is exactly one segment. Units go out
+// over `streams` connections at once, each carrying one unit at a time and
+// waiting for its ack. A fixed pool of two units per stream bounds memory;
+// once every unit is queued or in flight, write() blocks, and the cipher
+// pipeline stalls behind it until the receiver acks something. A unit whose
+// connection fails, or whose ack does not come back in time, goes back to
+// the head of the queue and is resent, by whichever stream is free, once
+// that stream has reconnected. Only that unit is resent, never the file. A
+// unit that fails SINK_MAX_ATTEMPTS times, or any explicit refusal from the
+// receiver, fails the output. The receiver publishes the file only on
+// commit, which is sent after every unit has been acked, so it never
+// exposes a partial file.
+//
+// Native protocol (tcp://, unix:), big-endian. Each message gets a one-byte
+// status back (0 = ok) before the next is sent on that connection:
+//   hello   [4] "SVSK" [1] version (1) [16] transfer id [32] auth
+//           [2] name length [name]
+//   write   'W' [8] offset [4] length [length bytes]
+//   commit  'C' [8] total length
+//   abort   'A'
+// The transfer id is random per output, and every connection of a transfer
+// opens with it, so the receiver assembles one file from all of them. auth
+// is HMAC-SHA256(SVLT_SINK_TOKEN, transfer id || name) when that variable
+// is set and zeros otherwise; a receiver started with a token rejects any
+// other value. `aesgcm_file --sink-listen` runs such a receiver. It keeps
+// at most SINK_MAX_CONNS connections and SINK_MAX_TRANSFERS unfinished
+// transfers open, and drops a connection whose write starts further past
+// the data received than a sender can have outstanding; all of these look
+// like a lost connection, so a real sender backs off and retries. Write
+// payloads are copied to the staging file SINK_RECV_PIECE bytes at a time
+// as they arrive, so a connection never holds more than that in memory.
+//
+// HTTP: every unit is a PUT to PATH carrying Content-Range: bytes
+// FIRST-LAST/*. The commit is an empty PUT with Content-Range: bytes
+// */TOTAL (the resumable-upload convention) and an abort is a DELETE. All
+// requests carry X-SVLT-Transfer: <hex id>, plus Authorization: Bearer
+// $SVLT_SINK_TOKEN when set. A 2xx or 308 response is an ack, a 5xx or 429
+// a transient failure (the unit is resent), and anything else a refusal.
+// There is no TLS: the data is already sealed, but the token is not, so
+// use a local TLS-terminating proxy for anything off-host.
+
+#ifndef SVLT_NETSINK_H
+#define SVLT_NETSINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+static const unsigned SINK_DEFAULT_STREAMS = 4;
+static const unsigned SINK_MAX_STREAMS = 64;
+static const unsigned SINK_MAX_ATTEMPTS = 6;  // per unit, backing off 0.2 s doubling to 5 s
+static const unsigned SINK_TIMEOUT_SECS = 30; // connect, send, and wait for an ack
+static const unsigned SINK_IDLE_SECS = 300;   // receiver: drop uncommitted transfers idle this long
+static const size_t SINK_MAX_CONNS = 512;     // receiver: connections open at once, all transfers
+static const size_t SINK_MAX_TRANSFERS = 128; // receiver: transfers holding a staging file at once
+static const size_t SINK_RECV_PIECE = 1 << 20; // receiver: payload bytes buffered per connection
+// Receiver: how far past the furthest byte received a write may start, in
+// units; a sender keeps at most 2 * SINK_MAX_STREAMS + 1 units outstanding,
+// each under twice the smallest full one.
+static const uint64_t SINK_MAX_AHEAD_UNITS = 2 * (2 * uint64_t(SINK_MAX_STREAMS) + 1);
+static const uint32_t SINK_MAX_UNIT = 256u << 20;
+static const size_t SINK_MAX_NAME = 255;
+static const size_t SINK_ID_LEN = 16;
+static const size_t SINK_AUTH_LEN = 32;
+static const unsigned char SINK_VERSION = 1;
+static const unsigned char SINK_OP_WRITE = 'W';
+static const unsigned char SINK_OP_COMMIT = 'C';
+static const unsigned char SINK_OP_ABORT = 'A';
+static const unsigned char SINK_OK = 0;
+static const unsigned char SINK_EREQUEST = 1; // malformed, unknown transfer, or incomplete commit
+static const unsigned char SINK_EAUTH = 2;
+static const unsigned char SINK_EIO = 3;
+
+enum class SinkKind { Tcp, Unix, Http };
+
+struct SinkUrl {
+    SinkKind kind = SinkKind::Tcp;
+    std::string host, port; // tcp, http
+    std::string socket;     // unix
+    std::string name;       // object name (tcp, unix) or request path (http)
+};
+
+static inline bool is_sink_url(const std::string &s) {
+    return s.compare(0, 6, "tcp://") == 0 || s.compare(0, 5, "unix:") == 0 || s.compare(0, 7, "http://") == 0 ||
+           s.compare(0, 8, "https://") == 0;
+}
+
+// The receiver writes NAME into its directory, so it must be a plain file name.
+static inline bool sink_name_ok(const std::string &name) {
+    return !name.empty() && name.size() <= SINK_MAX_NAME && name[0] != '.' &&
+           name.find('/') == std::string::npos && name.find('\0') == std::string::npos;
+}
+
+// Splits "HOST:PORT" or "[V6]:PORT"; the port may be omitted when dflt is set.
+static inline bool sink_split_host(const std::string &s, const char *dflt, SinkUrl &u) {
+    size_t colon;
+    if (!s.empty() && s[0] == '[') {
+        size_t close = s.find(']');
+        if (close == std::string::npos) return false;
+        u.host = s.substr(1, close - 1);
+        colon = close + 1 < s.size() && s[close + 1] == ':' ? close + 1 : std::string::npos;
+        if (colon == std::string::npos && close + 1 != s.size()) return false;
+    } else {
+        colon = s.rfind(':');
+        u.host = s.substr(0, colon);
+    }
+    u.port = colon == std::string::npos ? (dflt ? dflt : "") : s.substr(colon + 1);
+    return !u.host.empty() && !u.port.empty();
+}
+
+// Parses an output URL, or with listen a receiver address (tcp://HOST:PORT
+// or unix:SOCKET, no name). Prints why on failure.
+static inline bool parse_sink_url(const std::string &s, SinkUrl &u, bool listen) {
+    bool ok = false;
+    if (s.compare(0, 5, "unix:") == 0) {
+        u.kind = SinkKind::Unix;
+        size_t hash = listen ? std::string::npos : s.find('#', 5);
+        u.socket = s.substr(5, hash == std::string::npos ? std::string::npos : hash - 5);
+        u.name = hash == std::string::npos ? "" : s.substr(hash + 1);
+        ok = !u.socket.empty() && u.socket.size() < sizeof(sockaddr_un::sun_path) && (listen || sink_name_ok(u.name));
+    } else if (s.compare(0, 6, "tcp://") == 0) {
+        u.kind = SinkKind::Tcp;
+        size_t slash = s.find('/', 6);
+        if (listen == (slash == std::string::npos)) {
+            u.name = listen ? "" : s.substr(slash + 1);
+            ok = sink_split_host(s.substr(6, slash == std::string::npos ? std::string::npos : slash - 6), nullptr,
+                                 u) &&
+                 (listen || sink_name_ok(u.name));
+        }
+    } else if (s.compare(0, 7, "http://") == 0 && !listen) {
+        u.kind = SinkKind::Http;
+        size_t slash = s.find('/', 7);
+        u.name = slash == std::string::npos ? "/" : s.substr(slash);
+        ok = sink_split_host(s.substr(7, slash == std::string::npos ? std::string::npos : slash - 7), "80", u) &&
+             u.name.find_first_of(" \r\n") == std::string::npos;
+    } else if (s.compare(0, 8, "https://") == 0) {
+        fprintf(stderr, "%s: https is not supported; use http:// through a local TLS proxy\n", s.c_str());
+        return false;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: invalid %s (expected %s)\n", s.c_str(), listen ? "listen address" : "sink URL",
+                listen ? "tcp://HOST:PORT or unix:SOCKET"
+                       : "tcp://HOST:PORT/NAME, unix:SOCKET#NAME or http://HOST[:PORT]/PATH, NAME a plain file name");
+    }
+    return ok;
+}
+
+// send()/recv() exactly len bytes; false on error, timeout or EOF.
+static inline bool sink_io(int fd, void *buf, size_t len, bool out) {
+    unsigned char *p = static_cast<unsigned char *>(buf);
+    while (len > 0) {
+        ssize_t n = out ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+// Sends a header and a payload without copying them together.
+static inline bool sink_sendv(int fd, const void *head, size_t head_len, const unsigned char *data, size_t len) {
+    iovec iov[2] = {{const_cast<void *>(head), head_len}, {const_cast<unsigned char *>(data), len}};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        size_t left = size_t(n);
+        while (msg.msg_iovlen > 0 && left >= msg.msg_iov->iov_len) {
+            left -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = static_cast<unsigned char *>(msg.msg_iov->iov_base) + left;
+            msg.msg_iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+static inline void sink_be64(unsigned char *p, uint64_t v) {
+    for (int i = 7; i >= 0; --i, v >>= 8) p[i] = static_cast<unsigned char>(v);
+}
+
+static inline uint64_t sink_get_be64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void sink_timeouts(int fd, unsigned secs) {
+    timeval tv{time_t(secs), 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Connects to the receiver (SO_SNDTIMEO also bounds connect on Linux).
+// -1 with err set on failure.
+static inline int sink_connect(const SinkUrl &u, std::string &err) {
+    if (u.kind == SinkKind::Unix) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, u.socket.c_str(), u.socket.size());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0) {
+            sink_timeouts(fd, SINK_TIMEOUT_SECS);
+            if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) return fd;
+            ::close(fd);
+        }
+        err = std::string("connect: ") + strerror(errno);
+        return -1;
+    }
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(u.host.c_str(), u.port.c_str(), &hints, &res);
+    if (rc != 0) {
+        err = std::string("resolve ") + u.host + ": " + gai_strerror(rc);
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        sink_timeouts(fd, SINK_TIMEOUT_SECS);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            err = std::string("connect: ") + strerror(errno);
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        // Every message ends in a wait for the ack; do not let Nagle hold its tail.
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// HMAC-SHA256(token, id || name), or zeros without a token.
+static inline void sink_auth(const std::string &token, const unsigned char *id, const std::string &name,
+                             unsigned char *out) {
+    memset(out, 0, SINK_AUTH_LEN);
+    if (token.empty()) return;
+    unsigned char msg[SINK_ID_LEN + SINK_MAX_NAME];
+    memcpy(msg, id, SINK_ID_LEN);
+    memcpy(msg + SINK_ID_LEN, name.data(), name.size());
+    unsigned int len = SINK_AUTH_LEN;
+    HMAC(EVP_sha256(), token.data(), int(token.size()), msg, SINK_ID_LEN + name.size(), out, &len);
+}
+
+static inline std::string sink_token() {
+    const char *t = getenv("SVLT_SINK_TOKEN");
+    return t ? t : "";
+}
+
+// One output streamed to a receiver. write() and commit() are called from
+// one thread (OutputFile's owner); the stream threads only touch units
+// handed to them through the queue.
+class NetworkSink {
+public:
+    NetworkSink() = default;
+    NetworkSink(const NetworkSink &) = delete;
+    NetworkSink &operator=(const NetworkSink &) = delete;
+    ~NetworkSink() { abort(); }
+
+    bool open(const std::string &url, unsigned streams, size_t unit_size) {
+        if (!parse_sink_url(url, url_, false)) return false;
+        label_ = url;
+        token_ = sink_token();
+        if (RAND_bytes(id_, SINK_ID_LEN) != 1) {
+            fprintf(stderr, "%s: cannot generate a transfer id\n", label_.c_str());
+            return false;
+        }
+        static const char hex[] = "0123456789abcdef";
+        for (size_t i = 0; i < SINK_ID_LEN; ++i) {
+            id_hex_[2 * i] = hex[id_[i] >> 4];
+            id_hex_[2 * i + 1] = hex[id_[i] & 15];
+        }
+        id_hex_[2 * SINK_ID_LEN] = '\0';
+        if (url_.kind != SinkKind::Http) sink_auth(token_, id_, url_.name, auth_);
+
+        unit_fill_ = std::min<size_t>(std::max<size_t>(unit_size, 4096), SINK_MAX_UNIT / 2);
+        unit_cap_ = 2 * unit_fill_; // so a record just over unit_fill_ still fits one unit
+        streams = std::max(1u, std::min(streams, SINK_MAX_STREAMS));
+        units_.resize(2 * size_t(streams) + 1);
+        for (Unit &u : units_) {
+            u.data.reset(new (std::nothrow) unsigned char[unit_cap_]);
+            if (!u.data) {
+                fprintf(stderr, "out of memory for sink buffers\n");
+                return false;
+            }
+            free_.push_back(&u);
+        }
+        cur_ = take_free_locked();
+        for (unsigned i = 0; i < streams; ++i) threads_.emplace_back([this] { stream_main(); });
+        open_ = true;
+        return true;
+    }
+
+    bool write(const unsigned char *p, size_t len) {
+        while (len > 0) {
+            if (cur_->len > 0 && cur_->len + len > unit_cap_ && !submit(true)) return false;
+            size_t n = std::min(len, unit_cap_ - cur_->len);
+            memcpy(cur_->data.get() + cur_->len, p, n);
+            cur_->len += n;
+            p += n;
+            len -= n;
+            if (cur_->len >= unit_fill_ && !submit(true)) return false;
+        }
+        return true;
+    }
+
+    // Sends what is left, waits for every ack, then commits.
+    bool commit() {
+        if (cur_ && cur_->len > 0 && !submit(false)) return false;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [&] { return failed_ || (ready_.empty() && in_flight_ == 0); });
+        }
+        stop_streams();
+        if (failed_) return false;
+        bool ok = false;
+        std::string err;
+        for (unsigned attempt = 0; attempt < SINK_MAX_ATTEMPTS && !ok; ++attempt) {
+            if (attempt > 0) backoff(attempt);
+            int fd = connect_stream(err);
+            if (fd == -2) break;
+            if (fd < 0) continue;
+            int r = send_commit(fd, total_, err);
+            if (fd >= 0) ::close(fd);
+            ok = r == 0;
+            if (r > 0) break; // refused
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: commit failed: %s\n", label_.c_str(), err.c_str());
+            return false; // abort() still tells the receiver to drop it
+        }
+        open_ = false;
+        return true;
+    }
+
+    // Drops the transfer: stops sending and tells the receiver to discard
+    // what it has (best effort; it also expires idle transfers itself).
+    void abort() {
+        if (!open_) return;
+        open_ = false;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            failed_ = true;
+        }
+        cv_.notify_all();
+        stop_streams();
+        std::string err;
+        int fd = connect_stream(err);
+        if (fd >= 0) {
+            if (url_.kind == SinkKind::Http) {
+                http_request(fd, "DELETE", nullptr, 0, err);
+            } else {
+                unsigned char op = SINK_OP_ABORT, status;
+                if (sink_io(fd, &op, 1, true)) sink_io(fd, &status, 1, false);
+            }
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+private:
+    struct Unit {
+        std::unique_ptr<unsigned char[]> data;
+        size_t len = 0;
+        uint64_t offset = 0;
+        unsigned attempts = 0;
+    };
+
+    Unit *take_free_locked() {
+        Unit *u = free_.back();
+        free_.pop_back();
+        u->len = 0;
+        u->offset = total_;
+        u->attempts = 0;
+        return u;
+    }
+
+    // Queues the current unit and, if next, waits for a free one: this
+    // wait is the backpressure on the writer.
+    bool submit(bool next) {
+        std::unique_lock<std::mutex> lk(mu_);
+        if (failed_) return false;
+        total_ += cur_->len;
+        ready_.push_back(cur_);
+        cur_ = nullptr;
+        cv_.notify_all();
+        if (!next) return true;
+        cv_.wait(lk, [&] { return failed_ || !free_.empty(); });
+        if (failed_) return false;
+        cur_ = take_free_locked();
+        return true;
+    }
+
+    void fail_locked(const std::string &what) {
+        if (!failed_) fprintf(stderr, "%s: %s\n", label_.c_str(), what.c_str());
+        failed_ = true;
+        cv_.notify_all();
+    }
+
+    void stop_streams() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            closing_ = true;
+        }
+        cv_.notify_all();
+        for (auto &t : threads_) t.join();
+        threads_.clear();
+    }
+
+    static void backoff(unsigned attempt) {
+        unsigned ms = std::min(5000u, 200u << std::min(attempt - 1, 5u));
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    void stream_main() {
+        int fd = -1;
+        std::string err;
+        for (;;) {
+            Unit *u;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&] { return failed_ || closing_ || !ready_.empty(); });
+                if (failed_ || ready_.empty()) break;
+                u = ready_.front();
+                ready_.pop_front();
+                ++in_flight_;
+            }
+            int r = -1; // 0 acked, > 0 refused, < 0 transport failure
+            if (fd < 0) fd = connect_stream(err);
+            if (fd == -2) {
+                r = 1;
+                fd = -1;
+            } else if (fd >= 0) {
+                r = send_unit(fd, *u, err);
+            }
+            std::unique_lock<std::mutex> lk(mu_);
+            --in_flight_;
+            if (r == 0) {
+                free_.push_back(u);
+                cv_.notify_all();
+                continue;
+            }
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+            if (r > 0) {
+                fail_locked(err);
+                break;
+            }
+            if (++u->attempts >= SINK_MAX_ATTEMPTS) {
+                fail_locked(err + " (gave up on the unit at offset " + std::to_string(u->offset) + " after " +
+                            std::to_string(SINK_MAX_ATTEMPTS) + " attempts)");
+                break;
+            }
+            if (!failed_) {
+                fprintf(stderr, "warning: %s: %s; resending %zu bytes at offset %llu\n", label_.c_str(), err.c_str(),
+                        u->len, static_cast<unsigned long long>(u->offset));
+            }
+            ready_.push_front(u);
+            cv_.notify_all();
+            unsigned attempt = u->attempts;
+            lk.unlock();
+            backoff(attempt);
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    // A connected stream ready for units: fd, -1 to retry, -2 if refused.
+    int connect_stream(std::string &err) {
+        int fd = sink_connect(url_, err);
+        if (fd < 0 || url_.kind == SinkKind::Http) return fd;
+        unsigned char hello[4 + 1 + SINK_ID_LEN + SINK_AUTH_LEN + 2 + SINK_MAX_NAME];
+        size_t n = 0;
+        memcpy(hello, "SVSK", 4);
+        n += 4;
+        hello[n++] = SINK_VERSION;
+        memcpy(hello + n, id_, SINK_ID_LEN);
+        n += SINK_ID_LEN;
+        memcpy(hello + n, auth_, SINK_AUTH_LEN);
+        n += SINK_AUTH_LEN;
+        hello[n++] = static_cast<unsigned char>(url_.name.size() >> 8);
+        hello[n++] = static_cast<unsigned char>(url_.name.size());
+        memcpy(hello + n, url_.name.data(), url_.name.size());
+        n += url_.name.size();
+        unsigned char status = 0;
+        if (!sink_io(fd, hello, n, true) || !sink_io(fd, &status, 1, false)) {
+            err = "receiver closed the connection during hello";
+            ::close(fd);
+            return -1;
+        }
+        if (status != SINK_OK) {
+            err = status == SINK_EAUTH ? "receiver rejected the token (check SVLT_SINK_TOKEN)"
+                                       : "receiver refused the transfer (status " + std::to_string(status) + ")";
+            ::close(fd);
+            return -2;
+        }
+        return fd;
+    }
+
+    // 0 acked, > 0 refused, < 0 transport failure (err says why).
+    int send_unit(int &fd, const Unit &u, std::string &err) {
+        if (url_.kind == SinkKind::Http) {
+            char range[80];
+            snprintf(range, sizeof(range), "bytes %llu-%llu/*", static_cast<unsigned long long>(u.offset),
+                     static_cast<unsigned long long>(u.offset + u.len - 1));
+            return http_request(fd, "PUT", range, u.len, err, u.data.get());
+        }
+        unsigned char head[1 + 8 + 4];
+        head[0] = SINK_OP_WRITE;
+        sink_be64(head + 1, u.offset);
+        for (int i = 0; i < 4; ++i) head[9 + i] = static_cast<unsigned char>(u.len >> (24 - 8 * i));
+        return native_op(fd, head, sizeof(head), u.data.get(), u.len, err);
+    }
+
+    int send_commit(int &fd, uint64_t total, std::string &err) {
+        if (url_.kind == SinkKind::Http) {
+            char range[48];
+            snprintf(range, sizeof(range), "bytes */%llu", static_cast<unsigned long long>(total));
+            return http_request(fd, "PUT", range, 0, err);
+        }
+        unsigned char msg[1 + 8];
+        msg[0] = SINK_OP_COMMIT;
+        sink_be64(msg + 1, total);
+        return native_op(fd, msg, sizeof(msg), nullptr, 0, err);
+    }
+
+    static int native_op(int fd, const unsigned char *head, size_t head_len, const unsigned char *data, size_t len,
+                         std::string &err) {
+        unsigned char status = 0;
+        if (!sink_sendv(fd, head, head_len, data, len) || !sink_io(fd, &status, 1, false)) {
+            err = errno == EAGAIN || errno == EWOULDBLOCK ? "timed out waiting for the receiver"
+                                                            : "connection to the receiver lost";
+            return -1;
+        }
+        if (status != SINK_OK) {
+            err = "receiver refused the " + std::string(head[0] == SINK_OP_COMMIT ? "commit" : "write") +
+                  " (status " + std::to_string(status) + ")";
+            return 1;
+        }
+        return 0;
+    }
+
+    // One request/response on a keep-alive connection; closes fd when the
+    // server will not reuse it.
+    int http_request(int &fd, const char *method, const char *range, size_t len, std::string &err,
+                     const unsigned char *body = nullptr) {
+        char head[1024 + SINK_MAX_NAME];
+        std::string host = url_.host.find(':') != std::string::npos ? "[" + url_.host + "]" : url_.host;
+        int n = snprintf(head, sizeof(head),
+                         "%s %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %zu\r\n%s%s%sX-SVLT-Transfer: %s\r\n"
+                         "%s%s%s\r\n",
+                         method, url_.name.c_str(), host.c_str(), url_.port.c_str(), len, range ? "Content-Range: " : "",
+                         range ? range : "", range ? "\r\n" : "", id_hex_, token_.empty() ? "" : "Authorization: Bearer ",
+                         token_.c_str(), token_.empty() ? "" : "\r\n");
+        if (n < 0 || size_t(n) >= sizeof(head)) {
+            err = "request too long";
+            return 1;
+        }
+        if (!sink_sendv(fd, head, size_t(n), body, len)) {
+            err = "connection to the server lost";
+            return -1;
+        }
+        // Read the status line and headers, then skip any body.
+        char resp[8192];
+        size_t got = 0, end = 0;
+        while (end == 0) {
+            if (got == sizeof(resp)) {
+                err = "oversized response headers";
+                return -1;
+            }
+            ssize_t r = recv(fd, resp + got, sizeof(resp) - got, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) {
+                err = r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? "timed out waiting for the server"
+                                                                         : "server closed the connection";
+                return -1;
+            }
+            got += size_t(r);
+            for (size_t i = 3; i < got && end == 0; ++i) {
+                if (memcmp(resp + i - 3, "\r\n\r\n", 4) == 0) end = i + 1;
+            }
+        }
+        int status = 0, minor = 1;
+        if (sscanf(resp, "HTTP/1.%d %d", &minor, &status) != 2) {
+            err = "malformed response";
+            return -1;
+        }
+        bool keep = minor >= 1;
+        uint64_t body_len = 0;
+        std::string headers(resp, end);
+        for (char &c : headers) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        size_t cl = headers.find("\r\ncontent-length:");
+        if (cl != std::string::npos) body_len = strtoull(headers.c_str() + cl + 17, nullptr, 10);
+        size_t conn = headers.find("\r\nconnection:");
+        if (conn != std::string::npos) {
+            size_t eol = headers.find("\r\n", conn + 2);
+            std::string v = headers.substr(conn + 13, eol - conn - 13);
+            if (v.find("close") != std::string::npos) keep = false;
+            if (v.find("keep-alive") != std::string::npos) keep = true;
+        }
+        uint64_t extra = got - end;
+        body_len = body_len > extra ? body_len - extra : 0;
+        while (body_len > 0 && keep) {
+            size_t want = size_t(std::min<uint64_t>(body_len, sizeof(resp)));
+            ssize_t r = recv(fd, resp, want, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) keep = false;
+            else body_len -= uint64_t(r);
+        }
+        if (!keep) {
+            ::close(fd);
+            fd = -1;
+        }
+        if ((status >= 200 && status < 300) || status == 308) return 0;
+        err = std::string(method) + " answered HTTP " + std::to_string(status);
+        return status >= 500 || status == 429 || status == 408 ? -1 : 1;
+    }
+
+    SinkUrl url_;
+    std::string label_, token_;
+    unsigned char id_[SINK_ID_LEN] = {0};
+    char id_hex_[2 * SINK_ID_LEN + 1] = {0};
+    unsigned char auth_[SINK_AUTH_LEN] = {0};
+    size_t unit_fill_ = 0, unit_cap_ = 0;
+    std::vector<Unit> units_; // allocated once; each unit is free, current, queued or in flight
+    Unit *cur_ = nullptr;     // being filled by write()
+    uint64_t total_ = 0;      // bytes queued so far, also the offset of cur_
+    bool open_ = false;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<Unit *> free_;
+    std::deque<Unit *> ready_; // retries go to the front
+    size_t in_flight_ = 0;
+    bool failed_ = false, closing_ = false;
+    std::vector<std::thread> threads_;
+};
+
+// ---- receiver ----
+
+static volatile sig_atomic_t sink_stop = 0;
+
+static inline void sink_on_signal(int) {
+    sink_stop = 1;
+}
+
+static inline bool sink_peer_same_uid(int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+class SinkReceiver {
+public:
+    SinkReceiver(std::string dir, std::string token) : dir_(std::move(dir)), token_(std::move(token)) {}
+
+    // Runs until SIGINT/SIGTERM; lfd is a listening socket.
+    int serve(int lfd, bool unix_socket) {
+        std::list<Conn> conns;
+        bool full = false;
+        while (!sink_stop) {
+            pollfd pfd{lfd, POLLIN, 0};
+            int pr = poll(&pfd, 1, 1000);
+            for (auto it = conns.begin(); it != conns.end();) {
+                if (it->done) {
+                    it->thread.join();
+                    it = conns.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            expire(time(nullptr));
+            if (pr <= 0 || !(pfd.revents & POLLIN)) continue;
+            int cfd = accept(lfd, nullptr, nullptr);
+            if (cfd < 0) continue;
+            if (unix_socket && !sink_peer_same_uid(cfd)) {
+                ::close(cfd);
+                continue;
+            }
+            // Senders see a dropped connection as transient and retry later.
+            if (conns.size() >= SINK_MAX_CONNS) {
+                if (!full) fprintf(stderr, "refusing connections: %zu already open\n", conns.size());
+                full = true;
+                ::close(cfd);
+                continue;
+            }
+            full = false;
+            int one = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            sink_timeouts(cfd, SINK_IDLE_SECS);
+            conns.emplace_back();
+            Conn &c = conns.back();
+            c.fd = cfd;
+            c.thread = std::thread([this, &c] {
+                handle(c.fd);
+                ::close(c.fd);
+                c.done = true;
+            });
+        }
+        for (Conn &c : conns) shutdown(c.fd, SHUT_RDWR);
+        for (Conn &c : conns) c.thread.join();
+        std::unique_lock<std::mutex> lk(mu_);
+        for (auto &kv : transfers_) discard(lk, *kv.second);
+        return 0;
+    }
+
+private:
+    struct Conn {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    struct Transfer {
+        std::string name, tmp;
+        int fd = -1;
+        std::map<uint64_t, uint64_t> extents; // start -> end of the bytes written so far
+        unsigned conns = 0;
+        unsigned writers = 0;  // pwrites under way on fd, outside mu_
+        uint64_t high = 0;     // end of the furthest bytes written
+        uint64_t max_unit = 0; // longest write so far
+        time_t idle_since = 0;
+        bool closing = false;  // a commit or discard is waiting for the writers
+        bool finished = false; // committed or aborted
+        uint64_t committed = UINT64_MAX;
+    };
+
+    // Unfinished transfers, each holding a staging file; under mu_.
+    size_t open_transfers() const {
+        size_t n = 0;
+        for (const auto &kv : transfers_) n += kv.second->fd >= 0;
+        return n;
+    }
+
+    // write_at: drop the connection instead of answering, so the sender
+    // resends the unit later.
+    static constexpr unsigned char DEFER = 0xff;
+
+    // Records [lo, hi), merging overlaps: resent units land twice.
+    static void add_extent(Transfer &t, uint64_t lo, uint64_t hi) {
+        auto it = t.extents.upper_bound(lo);
+        if (it != t.extents.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second >= lo) {
+                lo = prev->first;
+                hi = std::max(hi, prev->second);
+                it = t.extents.erase(prev);
+            }
+        }
+        while (it != t.extents.end() && it->first <= hi) {
+            hi = std::max(hi, it->second);
+            it = t.extents.erase(it);
+        }
+        t.extents[lo] = hi;
+    }
+
+    // Stops new writes to t and waits for those under way to finish, since
+    // their pwrite may still be using t.fd.
+    void quiesce(std::unique_lock<std::mutex> &lk, Transfer &t) {
+        t.closing = true;
+        writers_done_.wait(lk, [&t] { return t.writers == 0; });
+    }
+
+    void discard(std::unique_lock<std::mutex> &lk, Transfer &t) {
+        quiesce(lk, t);
+        if (t.fd >= 0) {
+            ::close(t.fd);
+            t.fd = -1;
+            unlink(t.tmp.c_str());
+        }
+        t.finished = true;
+    }
+
+    void expire(time_t now) {
+        std::unique_lock<std::mutex> lk(mu_);
+        for (auto it = transfers_.begin(); it != transfers_.end();) {
+            Transfer &t = *it->second;
+            if (t.conns == 0 && now - t.idle_since > time_t(SINK_IDLE_SECS)) {
+                if (!t.finished) fprintf(stderr, "dropping idle incomplete transfer of %s\n", t.name.c_str());
+                discard(lk, t);
+                it = transfers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Reads a hello and joins or starts its transfer.
+    std::shared_ptr<Transfer> hello(int fd, unsigned char &status) {
+        unsigned char msg[4 + 1 + SINK_ID_LEN + SINK_AUTH_LEN + 2];
+        status = SINK_EREQUEST;
+        if (!sink_io(fd, msg, sizeof(msg), false) || memcmp(msg, "SVSK", 4) != 0 || msg[4] != SINK_VERSION) {
+            return nullptr;
+        }
+        size_t name_len = size_t(msg[sizeof(msg) - 2]) << 8 | msg[sizeof(msg) - 1];
+        char name_buf[SINK_MAX_NAME];
+        if (name_len > SINK_MAX_NAME || !sink_io(fd, name_buf, name_len, false)) return nullptr;
+        std::string name(name_buf, name_len);
+        const unsigned char *id = msg + 5;
+        unsigned char expect[SINK_AUTH_LEN];
+        sink_auth(token_, id, name, expect);
+        if (!token_.empty() && CRYPTO_memcmp(expect, msg + 5 + SINK_ID_LEN, SINK_AUTH_LEN) != 0) {
+            status = SINK_EAUTH;
+            return nullptr;
+        }
+        if (!sink_name_ok(name)) return nullptr;
+        std::string key(reinterpret_cast<const char *>(id), SINK_ID_LEN);
+        std::lock_guard<std::mutex> lk(mu_);
+        auto found = transfers_.find(key);
+        if (found == transfers_.end() && open_transfers() >= SINK_MAX_TRANSFERS) {
+            if (!full_) fprintf(stderr, "refusing transfers: %zu already open\n", SINK_MAX_TRANSFERS);
+            full_ = true;
+            status = DEFER;
+            return nullptr;
+        }
+        full_ = false;
+        std::shared_ptr<Transfer> &t = found == transfers_.end() ? transfers_[key] : found->second;
+        if (!t) {
+            t = std::make_shared<Transfer>();
+            t->name = name;
+            std::string tmp = dir_ + "/." + name + ".XXXXXX";
+            t->fd = mkstemp(&tmp[0]);
+            t->tmp = tmp;
+            if (t->fd < 0) {
+                fprintf(stderr, "mkstemp %s: %s\n", tmp.c_str(), strerror(errno));
+                transfers_.erase(key);
+                status = SINK_EIO;
+                return nullptr;
+            }
+        } else if (t->name != name) {
+            return nullptr;
+        }
+        ++t->conns;
+        status = SINK_OK;
+        return t;
+    }
+
+    void handle(int fd) {
+        unsigned char status;
+        std::shared_ptr<Transfer> t = hello(fd, status);
+        if (status != DEFER) sink_io(fd, &status, 1, true);
+        if (!t) return;
+        std::unique_ptr<unsigned char[]> buf; // allocated on the first write
+        unsigned char op;
+        while (sink_io(fd, &op, 1, false)) {
+            status = SINK_EREQUEST;
+            unsigned char arg[12];
+            if (op == SINK_OP_WRITE && sink_io(fd, arg, 12, false)) {
+                uint64_t off = sink_get_be64(arg);
+                uint32_t len = uint32_t(arg[8]) << 24 | uint32_t(arg[9]) << 16 | uint32_t(arg[10]) << 8 | arg[11];
+                if (len > SINK_MAX_UNIT || off > UINT64_MAX - len) break;
+                if (!buf) buf.reset(new (std::nothrow) unsigned char[SINK_RECV_PIECE]);
+                if (!buf) break;
+                status = receive_write(fd, *t, buf.get(), len, off);
+                if (status == DEFER) break;
+            } else if (op == SINK_OP_COMMIT && sink_io(fd, arg, 8, false)) {
+                status = commit(*t, sink_get_be64(arg));
+            } else if (op == SINK_OP_ABORT) {
+                std::unique_lock<std::mutex> lk(mu_);
+                discard(lk, *t);
+                status = SINK_OK;
+            } else {
+                break;
+            }
+            if (!sink_io(fd, &status, 1, true)) break;
+        }
+        std::lock_guard<std::mutex> lk(mu_);
+        --t->conns;
+        t->idle_since = time(nullptr);
+    }
+
+    // Reads a write's len payload bytes from the connection through buf
+    // (SINK_RECV_PIECE bytes) and stores each piece at its offset as it
+    // arrives. A refused write still consumes its payload so the connection
+    // stays in step; DEFER means drop the connection.
+    unsigned char receive_write(int cfd, Transfer &t, unsigned char *buf, uint32_t len, uint64_t off) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            // A write far past anything received would only grow a sparse
+            // staging file; a real sender's is never more than its
+            // outstanding units ahead.
+            uint64_t ahead = SINK_MAX_AHEAD_UNITS * std::max<uint64_t>({t.max_unit, len, 4096});
+            if (off > t.high && off - t.high > ahead) {
+                fprintf(stderr, "deferring write to %s at %llu: %llu bytes past the data received\n",
+                        t.name.c_str(), static_cast<unsigned long long>(off),
+                        static_cast<unsigned long long>(off - t.high));
+                return DEFER;
+            }
+        }
+        unsigned char status = SINK_OK;
+        for (uint32_t done = 0; done < len;) {
+            size_t n = std::min<size_t>(len - done, SINK_RECV_PIECE);
+            if (!sink_io(cfd, buf, n, false)) return DEFER;
+            if (status == SINK_OK) status = write_piece(t, buf, n, off + done);
+            done += uint32_t(n);
+        }
+        if (status != SINK_OK) return status;
+        std::lock_guard<std::mutex> lk(mu_);
+        if (t.finished || t.closing) return SINK_EREQUEST;
+        add_extent(t, off, off + len);
+        t.high = std::max(t.high, off + len);
+        t.max_unit = std::max<uint64_t>(t.max_unit, len);
+        return SINK_OK;
+    }
+
+    unsigned char write_piece(Transfer &t, const unsigned char *p, size_t len, uint64_t off) {
+        int fd;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (t.finished || t.closing) return SINK_EREQUEST;
+            fd = t.fd;
+            ++t.writers; // keeps fd open until the pwrite is done
+        }
+        // Units never overlap unless one is resent, so the pwrites need no lock.
+        bool ok = true;
+        for (size_t done = 0; done < len;) {
+            ssize_t n = pwrite(fd, p + done, len - done, off_t(off + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "write %s: %s\n", t.tmp.c_str(), strerror(errno));
+                ok = false;
+                break;
+            }
+            done += size_t(n);
+        }
+        std::lock_guard<std::mutex> lk(mu_);
+        if (--t.writers == 0) writers_done_.notify_all();
+        return ok ? SINK_OK : SINK_EIO;
+    }
+
+    // Publishes the file once its writes cover exactly [0, total). A commit
+    // resent after a lost ack finds it already done.
+    unsigned char commit(Transfer &t, uint64_t total) {
+        std::unique_lock<std::mutex> lk(mu_);
+        if (!t.finished) quiesce(lk, t);
+        if (t.finished) return t.committed == total ? SINK_OK : SINK_EREQUEST;
+        bool complete = total == 0 ? t.extents.empty()
+                                   : t.extents.size() == 1 && t.extents.begin()->first == 0 &&
+                                         t.extents.begin()->second == total;
+        if (!complete) {
+            fprintf(stderr, "refusing commit of %s: received bytes do not cover [0, %llu)\n", t.name.c_str(),
+                    static_cast<unsigned long long>(total));
+            t.closing = false;
+            return SINK_EREQUEST;
+        }
+        std::string path = dir_ + "/" + t.name;
+        bool ok = fsync(t.fd) == 0;
+        ok = ::close(t.fd) == 0 && ok;
+        t.fd = -1;
+        if (!ok || rename(t.tmp.c_str(), path.c_str()) != 0) {
+            fprintf(stderr, "commit %s: %s\n", path.c_str(), strerror(errno));
+            unlink(t.tmp.c_str());
+            t.finished = true;
+            return SINK_EIO;
+        }
+        t.finished = true;
+        t.committed = total;
+        fprintf(stderr, "received %s (%llu bytes)\n", path.c_str(), static_cast<unsigned long long>(total));
+        return SINK_OK;
+    }
+
+    std::string dir_, token_;
+    std::mutex mu_;
+    std::condition_variable writers_done_;
+    std::map<std::string, std::shared_ptr<Transfer>> transfers_; // by transfer id
+    bool full_ = false; // SINK_MAX_TRANSFERS reached; reported once per episode
+};
+
+// Listens on tcp://HOST:PORT or unix:SOCKET (0600, same-uid peers only)
+// and writes every committed transfer into dir. Runs until SIGINT/SIGTERM.
+static inline int run_sink_receiver(const std::string &listen_url, const std::string &dir) {
+    SinkUrl u;
+    if (!parse_sink_url(listen_url, u, true)) return 1;
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s: not a directory\n", dir.c_str());
+        return 1;
+    }
+    std::string token = sink_token();
+    int lfd = -1;
+    if (u.kind == SinkKind::Unix) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, u.socket.c_str(), u.socket.size());
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(u.socket.c_str());
+        mode_t old_umask = umask(077);
+        if (lfd >= 0 && (bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(lfd, 64) != 0)) {
+            ::close(lfd);
+            lfd = -1;
+        }
+        umask(old_umask);
+    } else {
+        addrinfo hints{}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int rc = getaddrinfo(u.host == "*" ? nullptr : u.host.c_str(), u.port.c_str(), &hints, &res);
+        if (rc != 0) {
+            fprintf(stderr, "%s: %s\n", listen_url.c_str(), gai_strerror(rc));
+            return 1;
+        }
+        for (addrinfo *ai = res; ai && lfd < 0; ai = ai->ai_next) {
+            lfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (lfd < 0) continue;
+            int one = 1;
+            setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(lfd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(lfd, 64) != 0) {
+                ::close(lfd);
+                lfd = -1;
+            }
+        }
+        freeaddrinfo(res);
+    }
+    if (lfd < 0) {
+        std::perror(("bind " + listen_url).c_str());
+        return 1;
+    }
+    signal(SIGINT, sink_on_signal);
+    signal(SIGTERM, sink_on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "sink receiver listening on %s, writing to %s\n", listen_url.c_str(), dir.c_str());
+    if (u.kind == SinkKind::Tcp && token.empty()) {
+        fprintf(stderr, "warning: SVLT_SINK_TOKEN is not set; anyone who can connect can upload\n");
+    }
+    SinkReceiver receiver(dir, token);
+    int rc = receiver.serve(lfd, u.kind == SinkKind::Unix);
+    ::close(lfd);
+    if (u.kind == SinkKind::Unix) unlink(u.socket.c_str());
+    return rc;
+}
+
+#endif // SVLT_NETSINK_H
@@ -0,0 +1,132 @@
+/* libsvlt: streaming encryption and decryption of SVLT v2 files (the format
+ * aesgcm_file writes, see svlt_format.h) behind a plain C ABI, for callers
+ * such as cgo or Rust FFI. Handles are opaque and single-threaded; every
+ * call copies from caller-owned input spans into caller-owned output spans
+ * and never allocates per call once a handle is set up.
+ *
+ * Both directions are zlib-style loops: update() consumes what it can of
+ * the input and writes whole records to the output, reporting how much of
+ * each it used, and final() flushes the rest once the input has ended. An
+ * output buffer of svlt_*_output_size() bytes always lets a call make
+ * progress. Decrypted plaintext is released one segment at a time, each
+ * after its tag verifies; the stream is only complete and authentic once
+ * svlt_decrypt_final() returns SVLT_OK. After any error a handle only
+ * accepts svlt_*_free().
+ *
+ * Keys come either from a passphrase, run through the KDF recorded in the
+ * header (Argon2id by default, as in the Go agent), or from a caller-held
+ * 32-byte key, which then stands in for the KDF output and is narrowed to a
+ * per-file subkey by a random file salt.
+ *
+ * Build with `make libsvlt`: bin/libsvlt.so and bin/libsvlt.a, linking
+ * -lcrypto -lz (plus -lzstd / -llz4 when built with those codecs).
+ */
+
+#ifndef SVLT_H
+#define SVLT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SVLT_API __attribute__((visibility("default")))
+#else
+#define SVLT_API
+#endif
+
+/* Bumped on any incompatible change to this header. */
+#define SVLT_ABI_VERSION 1
+#define SVLT_KEY_LEN 32
+
+/* Return codes. */
+#define SVLT_OK 0
+#define SVLT_EINVAL (-1)  /* bad argument, or a call out of sequence */
+#define SVLT_ENOSPC (-2)  /* output buffer too small to make progress */
+#define SVLT_EFORMAT (-3) /* not a v2 stream, or a header this build cannot read */
+#define SVLT_EAUTH (-4)   /* wrong key, or tampered or truncated data */
+#define SVLT_ECRYPTO (-5) /* key derivation, cipher or codec failure */
+#define SVLT_ENOMEM (-6)
+
+/* KDFs for passphrase keys. */
+#define SVLT_KDF_PBKDF2 1
+#define SVLT_KDF_ARGON2ID 2
+
+/* Per-segment compression codecs. */
+#define SVLT_CODEC_NONE 0
+#define SVLT_CODEC_ZLIB 1
+#define SVLT_CODEC_ZSTD 2
+#define SVLT_CODEC_LZ4 3
+
+typedef struct svlt_encryptor svlt_encryptor;
+typedef struct svlt_decryptor svlt_decryptor;
+
+SVLT_API uint32_t svlt_abi_version(void);
+SVLT_API const char *svlt_strerror(int code);
+/* The detail behind this thread's most recent error, or "". */
+SVLT_API const char *svlt_last_error(void);
+/* Whether this build can read and write segments compressed with codec. */
+SVLT_API int svlt_codec_supported(int codec);
+
+/* ---- encryption ----
+ * svlt_encryptor_new, optional setters, one svlt_encrypt_init*, then
+ * svlt_encrypt_update as often as needed and svlt_encrypt_final once. */
+
+SVLT_API int svlt_encryptor_new(svlt_encryptor **out);
+SVLT_API void svlt_encryptor_free(svlt_encryptor *e);
+/* 4K..64M, default 1M. */
+SVLT_API int svlt_encryptor_set_segment_size(svlt_encryptor *e, uint32_t segment_size);
+SVLT_API int svlt_encryptor_set_pbkdf2(svlt_encryptor *e, uint32_t iterations);
+/* Default t=1, m=65536 KiB, p=4. */
+SVLT_API int svlt_encryptor_set_argon2id(svlt_encryptor *e, uint32_t passes, uint32_t memory_kib, uint32_t lanes);
+/* level 0 picks the codec's default. */
+SVLT_API int svlt_encryptor_set_compression(svlt_encryptor *e, int codec, int level);
+/* Seals a SHA-256 of the plaintext at the end of the stream. */
+SVLT_API int svlt_encryptor_set_embed_sha256(svlt_encryptor *e, int on);
+/* Seals every `bytes` of plaintext (rounded down to whole segments, default
+ * 64 GiB) under a fresh key derived from the stream's subkey, so no single
+ * AES-GCM key covers an unbounded stream. 0 keeps one key for the stream. */
+SVLT_API int svlt_encryptor_set_rekey_interval(svlt_encryptor *e, uint64_t bytes);
+/* Stores every all-zero segment as a short run record instead of sealed
+ * zeros, for inputs such as thin disk images. Decryptors hand runs back as
+ * zeros; the stream is then unreadable by libsvlt before this call existed. */
+SVLT_API int svlt_encryptor_set_sparse(svlt_encryptor *e, int on);
+
+SVLT_API int svlt_encrypt_init(svlt_encryptor *e, const char *passphrase, size_t passphrase_len);
+SVLT_API int svlt_encrypt_init_key(svlt_encryptor *e, const uint8_t key[SVLT_KEY_LEN]);
+SVLT_API size_t svlt_encrypt_output_size(const svlt_encryptor *e);
+SVLT_API int svlt_encrypt_update(svlt_encryptor *e, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                                 size_t out_cap, size_t *out_len);
+/* Writes everything still pending, or nothing and SVLT_ENOSPC. */
+SVLT_API int svlt_encrypt_final(svlt_encryptor *e, uint8_t *out, size_t out_cap, size_t *out_len);
+
+/* ---- decryption ----
+ * svlt_decryptor_new, optional setters, one svlt_decrypt_init*, then update
+ * and final. The key is derived once the header has been read, inside
+ * svlt_decrypt_update. */
+
+SVLT_API int svlt_decryptor_new(svlt_decryptor **out);
+SVLT_API void svlt_decryptor_free(svlt_decryptor *d);
+/* Caps what the KDF named in a stream's unauthenticated header may cost:
+ * Argon2id memory and passes, and PBKDF2 iterations. A header over them
+ * fails with SVLT_EFORMAT before anything is derived. 0 keeps a default
+ * (1048576 KiB, 8 passes, 10000000 iterations). */
+SVLT_API int svlt_decryptor_set_kdf_limits(svlt_decryptor *d, uint32_t max_memory_kib, uint32_t max_passes,
+                                           uint32_t max_iterations);
+SVLT_API int svlt_decrypt_init(svlt_decryptor *d, const char *passphrase, size_t passphrase_len);
+SVLT_API int svlt_decrypt_init_key(svlt_decryptor *d, const uint8_t key[SVLT_KEY_LEN]);
+/* 0 until the header has been read; no output is written before that. */
+SVLT_API size_t svlt_decrypt_output_size(const svlt_decryptor *d);
+SVLT_API int svlt_decrypt_update(svlt_decryptor *d, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                                 size_t out_cap, size_t *out_len);
+/* Opens the final segment and checks any embedded digest. */
+SVLT_API int svlt_decrypt_final(svlt_decryptor *d, uint8_t *out, size_t out_cap, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SVLT_H */
@@ -0,0 +1,156 @@
+// Google Benchmark microbenchmarks of the SVLT v2 parser: decoding headers
+// with and without every extension record, rejecting malformed ones,
+// walking framed records' length prefixes (the stream's segment table), and
+// opening and authenticating one segment, successfully or not. They guard
+// the restore path's fixed cost per file and per segment as the header
+// grows; tools/svlt_fuzz.cpp covers what the same code does with hostile
+// input. `make bench-parser` builds and runs them:
+//   ./bin/svlt_bench --benchmark_filter=Header
+// Link with -lbenchmark.
+
+#define SVLT_LIBRARY 1
+
+#include <benchmark/benchmark.h>
+#include <openssl/rand.h>
+#include <vector>
+#include "svlt_format.h"
+
+namespace {
+
+const unsigned char BENCH_KEY[KEY_LEN] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                          17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+
+// A header as aesgcm_file writes it; full adds every extension record.
+V2Header make_header(uint32_t segment_size, bool full) {
+    V2Header h;
+    h.segment_size = segment_size;
+    RAND_bytes(h.salt, SALT_LEN);
+    RAND_bytes(h.nonce, NONCE_LEN);
+    if (full) {
+        h.has_file_salt = true;
+        RAND_bytes(h.file_salt, SALT_LEN);
+        h.has_kdf = true;
+        h.digests.assign(1, DIGEST_SHA256);
+        h.digests.push_back(DIGEST_BLAKE2B_256);
+        h.codec = CODEC_ZLIB;
+        h.codec_level = 6;
+        h.rekey_segments = 1 << 16;
+        h.sparse = true;
+    }
+    build_v2_header(h);
+    return h;
+}
+
+void BM_HeaderDecode(benchmark::State &state) {
+    const V2Header src = make_header(DEFAULT_SEGMENT_SIZE, state.range(0) != 0);
+    for (auto _ : state) {
+        V2Header h;
+        size_t n = parse_v2_header(src.raw.data(), src.raw.size(), h);
+        benchmark::DoNotOptimize(n);
+        benchmark::DoNotOptimize(h.segment_size);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(src.raw.size()));
+}
+BENCHMARK(BM_HeaderDecode)->Arg(0)->Arg(1)->ArgName("extensions");
+
+// Malformed headers must fail as cheaply as valid ones parse: an oversized
+// segment size, an extension area longer than the input, a duplicate
+// record, and an unknown record after a full set.
+void BM_HeaderReject(benchmark::State &state) {
+    V2Header src = make_header(DEFAULT_SEGMENT_SIZE, true);
+    std::vector<unsigned char> bad(src.raw.data(), src.raw.data() + src.raw.size());
+    const size_t ext_at = V2_FIXED_HEADER_LEN - 2;
+    switch (state.range(0)) {
+    case 0:
+        put_be32(bad.data() + 5, uint32_t(MAX_SEGMENT_SIZE) + 1);
+        break;
+    case 1:
+        bad[ext_at] = 0xff;
+        bad[ext_at + 1] = 0xff;
+        break;
+    case 2:
+    case 3: {
+        const unsigned char dup[] = {state.range(0) == 2 ? EXT_SPARSE : (unsigned char)0x7f, 0, 0};
+        bad.insert(bad.end(), dup, dup + sizeof(dup));
+        size_t ext = bad.size() - V2_FIXED_HEADER_LEN;
+        bad[ext_at] = (unsigned char)(ext >> 8);
+        bad[ext_at + 1] = (unsigned char)ext;
+        break;
+    }
+    }
+    for (auto _ : state) {
+        V2Header h;
+        size_t n = parse_v2_header(bad.data(), bad.size(), h);
+        if (n != 0) state.SkipWithError("malformed header parsed");
+        benchmark::DoNotOptimize(n);
+    }
+}
+BENCHMARK(BM_HeaderReject)->DenseRange(0, 3)->ArgName("case");
+
+// Walks the length prefixes of N framed records, as framed_offsets and the
+// streaming decryptor do before opening anything: records per second.
+void BM_RecordTableDecode(benchmark::State &state) {
+    const V2Header h = make_header(4096, true);
+    const size_t count = size_t(state.range(0));
+    std::vector<unsigned char> table;
+    uint64_t rng = 88172645463325252ull;
+    for (size_t i = 0; i < count; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t sealed = 1 + rng % (h.segment_size + 1);
+        size_t at = table.size();
+        table.resize(at + RECORD_LEN_PREFIX + sealed + TAG_LEN);
+        put_be32(table.data() + at, uint32_t(sealed));
+    }
+    for (auto _ : state) {
+        size_t off = 0, n = 0;
+        while (off + RECORD_LEN_PREFIX <= table.size()) {
+            size_t sealed = v2_record_sealed(h, table.data() + off);
+            if (sealed == 0) break;
+            off += RECORD_LEN_PREFIX + sealed + TAG_LEN;
+            ++n;
+        }
+        if (n != count) state.SkipWithError("record walk stopped early");
+        benchmark::DoNotOptimize(n);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(count));
+}
+BENCHMARK(BM_RecordTableDecode)->Arg(1 << 8)->Arg(1 << 14);
+
+// Opens and authenticates one segment, with its tag intact or flipped (a
+// tampered segment costs a full GCM pass as well), or a sparse run record.
+void BM_SegmentOpen(benchmark::State &state) {
+    const uint32_t seg = uint32_t(state.range(0));
+    const int kind = int(state.range(1)); // 0 intact, 1 tampered, 2 zero run
+    const V2Header h = make_header(seg, kind == 2);
+    std::vector<unsigned char> plain(seg, 0x5a), rec(v2_max_record(h)), out(seg);
+    if (kind == 2) std::fill(plain.begin(), plain.end(), 0);
+    CodecScratch scratch;
+    EpochKey keys;
+    keys.reset(BENCH_KEY);
+    CipherCtx enc = new_segment_ctx(true, BENCH_KEY), dec = new_segment_ctx(false, BENCH_KEY);
+    bool packed = false;
+    size_t n = seal_v2_segment(enc.get(), keys, h, 7, false, plain.data(), seg, scratch, rec.data(), packed);
+    const size_t skip = v2_framed(h) ? RECORD_LEN_PREFIX : 0;
+    if (kind == 1) rec[n - 1] ^= 1;
+    EpochKey dkeys;
+    dkeys.reset(BENCH_KEY);
+    for (auto _ : state) {
+        size_t len = 0;
+        bool zeros = false;
+        bool ok = open_v2_segment(dec.get(), dkeys, h, 7, false, rec.data() + skip, n - skip - TAG_LEN, out.data(),
+                                  scratch, len, &zeros);
+        if (ok != (kind != 1)) state.SkipWithError("segment opened unexpectedly");
+        benchmark::DoNotOptimize(len);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(seg));
+}
+BENCHMARK(BM_SegmentOpen)
+    ->ArgsProduct({{4096, 64 << 10, 1 << 20}, {0, 1}})
+    ->Args({1 << 20, 2})
+    ->ArgNames({"segment", "kind"});
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,1220 @@
+// The SVLT file formats and the code that reads and writes them: header
+// records, key derivation, and sealing, opening and compressing segments.
+// aesgcm_file and libsvlt (svlt.h) both build on it, so the tool and the
+// library share one engine. Header-only so each tool still compiles as a
+// single translation unit. Messages go through svlt_diag(): to stderr in the
+// tools, into a per-thread buffer in the library (SVLT_LIBRARY).
+//
+// Nothing on the per-file or per-segment path allocates once its contexts
+// exist: headers and digest lists live in InlineBytes, HKDF and SHA-256 run
+// on OpenSSL's allocation-free low-level SHA-256, cipher contexts are
+// rekeyed rather than recreated, and codec state sits in a reusable
+// CodecScratch.
+//
+// Format v1 (binary):
+//   [4 bytes] magic "SVLT"
+//   [1 byte ] version (0x01)
+//   [16 bytes] salt
+//   [12 bytes] nonce (IV)
+//   [..] ciphertext (plaintext encrypted)
+//   [16 bytes] GCM tag
+//
+// AAD is the prefix: magic + version + salt + nonce.
+//
+// Format v2 (segmented, written by default):
+//   [4 bytes] magic "SVLT"
+//   [1 byte ] version (0x02)
+//   [4 bytes] segment size S (big-endian)
+//   [16 bytes] salt
+//   [12 bytes] base nonce
+//   [2 bytes] extension length E (big-endian), followed by E bytes
+//   then segments, each [ciphertext][16 bytes GCM tag]. Every segment but
+//   the last carries exactly S bytes of ciphertext; the last carries 0..S.
+//
+// Segment i is sealed with nonce = base nonce XOR be64(i) (low 8 bytes) and
+// AAD = header || be64(i) || final-flag, so segments can be processed in
+// parallel or individually while reordering and truncation are detected.
+//
+// The extension area is a sequence of [1 byte type][2 bytes length][value]
+// records, authenticated as part of the header. Unknown types are rejected.
+//   0x01 file salt (16 bytes): the file key is HKDF-SHA256 of the KDF
+//        output keyed by this salt. Written in batch mode so many files
+//        share one KDF run while still getting distinct keys.
+//   0x02 KDF: [1 byte id] then big-endian u32 parameters.
+//        0x01 PBKDF2-HMAC-SHA256: [iterations]
+//        0x02 Argon2id (RFC 9106, v0x13): [passes t][memory KiB m][lanes p]
+//        Without this record the key is PBKDF2 with 200000 iterations, as
+//        in v1. New files use Argon2id t=1, m=64 MiB, p=4 unless --kdf says
+//        otherwise, matching DeriveKey in internal/crypto/crypto.go.
+//   0x03 digest trailer: 1 or 2 algorithm ids (0x01 SHA-256, 0x02
+//        BLAKE2b-256). Those digests of the file's plaintext are appended,
+//        back to back, to the plaintext before it is segmented, so they are
+//        authenticated and sit in the last one or two segments, where they
+//        can be read without decrypting the rest of the file.
+//   0x04 compression: [1 byte codec][1 byte level]. Codecs 0x01 zlib,
+//        0x02 zstd, 0x03 lz4 (whose level is the acceleration factor).
+//        Segments are then framed as [4 bytes sealed length N (big-endian)]
+//        [N bytes ciphertext][16 bytes GCM tag], 1 <= N <= S + 1, and the
+//        sealed payload is [1 byte method][body]: method 0 is the segment's
+//        plaintext as is, method 1 its compressed form. Segments compress
+//        independently and all but the last still hold exactly S bytes of
+//        plaintext; a segment that would not shrink is stored with method 0.
+//   0x05 key rotation: [4 bytes K (big-endian), K >= 1]. Segment i is then
+//        sealed under its epoch key HKDF-SHA256(file key, salt = be64(i / K),
+//        "SVLT v2 epoch key"), so no one AES-GCM key covers more than K
+//        segments however long the stream runs. The file key is the
+//        per-file subkey (0x01), which is always present alongside. Written
+//        when a file may outgrow the rotation interval (64 GiB by default).
+//   0x06 sparse (no value): segments are framed as for 0x04, with or
+//        without compression, and a sealed payload may also be method 2, a
+//        run of zeros: [1 byte 2][4 bytes plaintext length L (big-endian)].
+//        Such a segment stands for L zero bytes (L = S unless it is the
+//        last) and costs a 25-byte record instead of S + 16, so holes in a
+//        sparse input are neither read nor encrypted, yet stay bound to
+//        their index like any other segment.
+
+#ifndef SVLT_FORMAT_H
+#define SVLT_FORMAT_H
+
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef SVLT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SVLT_HAVE_LZ4
+#include <lz4.h>
+#endif
+#include "argon2id.h"
+
+static constexpr size_t SALT_LEN = 16;
+static constexpr size_t NONCE_LEN = 12;
+static constexpr size_t TAG_LEN = 16;
+static constexpr int PBKDF2_ITERS = 200000; // high enough for modest security
+static constexpr size_t KEY_LEN = 32; // AES-256
+static const unsigned char MAGIC[4] = {'S', 'V', 'L', 'T'};
+static constexpr unsigned char VERSION_V1 = 0x1;
+static constexpr unsigned char VERSION_V2 = 0x2;
+static constexpr size_t V2_FIXED_HEADER_LEN = 4 + 1 + 4 + SALT_LEN + NONCE_LEN + 2;
+static constexpr size_t DEFAULT_SEGMENT_SIZE = 1 << 20; // 1 MiB
+static constexpr size_t MIN_SEGMENT_SIZE = 4096;
+static constexpr size_t MAX_SEGMENT_SIZE = 64 << 20;
+static constexpr size_t MAX_EXT_LEN = 1024;
+static constexpr uint64_t DEFAULT_REKEY_BYTES = uint64_t(64) << 30; // plaintext per epoch key (0x05)
+static constexpr unsigned char EXT_FILE_SALT = 0x01;
+static constexpr unsigned char EXT_KDF = 0x02;
+static constexpr unsigned char EXT_DIGEST = 0x03;
+static constexpr unsigned char EXT_COMPRESSION = 0x04;
+static constexpr unsigned char EXT_REKEY = 0x05;
+static constexpr unsigned char EXT_SPARSE = 0x06;
+static constexpr unsigned char DIGEST_SHA256 = 0x01;
+static constexpr unsigned char DIGEST_BLAKE2B_256 = 0x02;
+static constexpr size_t MAX_DIGEST_TRAILER = 2 * 32;
+static constexpr unsigned char CODEC_NONE = 0x00;
+static constexpr unsigned char CODEC_ZLIB = 0x01;
+static constexpr unsigned char CODEC_ZSTD = 0x02;
+static constexpr unsigned char CODEC_LZ4 = 0x03;
+static constexpr size_t RECORD_LEN_PREFIX = 4; // framed segments: be32 sealed length
+static constexpr unsigned char METHOD_RAW = 0;    // framed payload methods
+static constexpr unsigned char METHOD_PACKED = 1;
+static constexpr unsigned char METHOD_ZEROS = 2;  // 0x06 only
+static constexpr unsigned char KDF_PBKDF2_SHA256 = 0x01;
+static constexpr unsigned char KDF_ARGON2ID = 0x02;
+static constexpr size_t KDF_MAX_ENCODED_LEN = 1 + 3 * 4;
+// Argon2id defaults shared with the Go agent's DeriveKey
+static constexpr uint32_t ARGON2_DEFAULT_T = 1;
+static constexpr uint32_t ARGON2_DEFAULT_M_KIB = 64 * 1024;
+static constexpr uint32_t ARGON2_DEFAULT_P = 4;
+// Bounds on KDF parameters, also applied to untrusted headers
+static constexpr uint32_t PBKDF2_MIN_ITERS = 1000;
+static constexpr uint32_t PBKDF2_MAX_ITERS = 100000000;
+static constexpr uint32_t ARGON2_MAX_T = 64;
+static constexpr uint32_t ARGON2_MAX_M_KIB = 4u * 1024 * 1024; // 4 GiB
+static constexpr uint32_t ARGON2_MAX_P = 64;
+// Default ceilings on what a header may make a reader pay before anything
+// is authenticated; KdfLimits raises or lowers them per reader.
+static constexpr uint32_t KDF_READ_MAX_ITERS = 10000000;
+static constexpr uint32_t KDF_READ_MAX_T = 8;
+static constexpr uint32_t KDF_READ_MAX_M_KIB = 1024 * 1024; // 1 GiB
+
+// Which password KDF turns the passphrase and salt into the master key.
+struct KdfParams {
+    unsigned char id = KDF_ARGON2ID;
+    uint32_t iterations = PBKDF2_ITERS;   // PBKDF2
+    uint32_t t_cost = ARGON2_DEFAULT_T;   // Argon2id passes
+    uint32_t m_cost_kib = ARGON2_DEFAULT_M_KIB;
+    uint32_t lanes = ARGON2_DEFAULT_P;
+
+    bool operator==(const KdfParams &o) const {
+        if (id != o.id) return false;
+        if (id == KDF_PBKDF2_SHA256) return iterations == o.iterations;
+        return t_cost == o.t_cost && m_cost_kib == o.m_cost_kib && lanes == o.lanes;
+    }
+};
+
+// The most a header's KDF record may ask of this reader.
+struct KdfLimits {
+    uint32_t max_iterations = KDF_READ_MAX_ITERS; // PBKDF2
+    uint32_t max_t_cost = KDF_READ_MAX_T;         // Argon2id passes
+    uint32_t max_m_cost_kib = KDF_READ_MAX_M_KIB;
+};
+
+// The fixed KDF of v1 files and of v2 files without a KDF extension.
+static inline KdfParams legacy_kdf() {
+    KdfParams k;
+    k.id = KDF_PBKDF2_SHA256;
+    k.iterations = PBKDF2_ITERS;
+    return k;
+}
+
+#ifdef SVLT_LIBRARY
+// The last message on this thread, returned by svlt_last_error().
+static thread_local char svlt_diag_buf[256];
+
+__attribute__((format(printf, 1, 2))) static inline void svlt_diag(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(svlt_diag_buf, sizeof(svlt_diag_buf), fmt, ap);
+    va_end(ap);
+    size_t n = strlen(svlt_diag_buf);
+    if (n > 0 && svlt_diag_buf[n - 1] == '\n') svlt_diag_buf[n - 1] = '\0';
+}
+
+// Keeps the most recent OpenSSL error and clears the queue.
+static inline void print_openssl_errors() {
+    unsigned long e = ERR_peek_last_error();
+    if (e != 0) {
+        char msg[200];
+        ERR_error_string_n(e, msg, sizeof(msg));
+        svlt_diag("%s", msg);
+    }
+    ERR_clear_error();
+}
+#else
+__attribute__((format(printf, 1, 2))) static inline void svlt_diag(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+static inline void print_openssl_errors() { ERR_print_errors_fp(stderr); }
+#endif
+
+static inline void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline uint32_t get_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static inline void put_be64(unsigned char *p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static inline uint64_t get_be64(const unsigned char *p) {
+    return (uint64_t(get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+// Bytes in inline storage for up to N, with the few std::vector calls the
+// header and digest code uses, so building or parsing a header costs no
+// heap allocation. Overrunning N is a bug and aborts.
+template <size_t N>
+class InlineBytes {
+public:
+    unsigned char *data() { return buf_; }
+    const unsigned char *data() const { return buf_; }
+    size_t size() const { return len_; }
+    bool empty() const { return len_ == 0; }
+    const unsigned char *begin() const { return buf_; }
+    const unsigned char *end() const { return buf_ + len_; }
+    unsigned char operator[](size_t i) const { return buf_[i]; }
+
+    void clear() { len_ = 0; }
+    void assign(size_t n, unsigned char v) {
+        check(n);
+        memset(buf_, v, n);
+        len_ = n;
+    }
+    void resize(size_t n) {
+        check(n);
+        if (n > len_) memset(buf_ + len_, 0, n - len_);
+        len_ = n;
+    }
+    void push_back(unsigned char v) {
+        check(len_ + 1);
+        buf_[len_++] = v;
+    }
+    void append(const unsigned char *p, size_t n) {
+        check(len_ + n);
+        if (n > 0) memcpy(buf_ + len_, p, n);
+        len_ += n;
+    }
+
+private:
+    static void check(size_t n) {
+        if (n > N) abort();
+    }
+
+    unsigned char buf_[N];
+    size_t len_ = 0;
+};
+
+// Digest algorithm ids, in the order their digests are printed or sealed.
+using DigestAlgs = InlineBytes<2>;
+
+static inline bool kdf_params_valid(const KdfParams &k) {
+    if (k.id == KDF_PBKDF2_SHA256) {
+        return k.iterations >= PBKDF2_MIN_ITERS && k.iterations <= PBKDF2_MAX_ITERS;
+    }
+    if (k.id == KDF_ARGON2ID) {
+        return k.t_cost >= 1 && k.t_cost <= ARGON2_MAX_T && k.lanes >= 1 && k.lanes <= ARGON2_MAX_P &&
+               k.m_cost_kib >= 8 * k.lanes && k.m_cost_kib <= ARGON2_MAX_M_KIB;
+    }
+    return false;
+}
+
+// Serializes the id and parameters as stored in the EXT_KDF record.
+static inline size_t kdf_encode(const KdfParams &k, unsigned char *out) {
+    out[0] = k.id;
+    if (k.id == KDF_PBKDF2_SHA256) {
+        put_be32(out + 1, k.iterations);
+        return 1 + 4;
+    }
+    put_be32(out + 1, k.t_cost);
+    put_be32(out + 5, k.m_cost_kib);
+    put_be32(out + 9, k.lanes);
+    return 1 + 3 * 4;
+}
+
+// Human/CLI form, accepted back by parse_kdf: "pbkdf2:200000" or
+// "argon2id:t=1,m=64M,p=4".
+static inline std::string kdf_spec(const KdfParams &k) {
+    char buf[96];
+    if (k.id == KDF_PBKDF2_SHA256) {
+        snprintf(buf, sizeof(buf), "pbkdf2:%u", k.iterations);
+    } else if (k.m_cost_kib % 1024 == 0) {
+        snprintf(buf, sizeof(buf), "argon2id:t=%u,m=%uM,p=%u", k.t_cost, k.m_cost_kib / 1024, k.lanes);
+    } else {
+        snprintf(buf, sizeof(buf), "argon2id:t=%u,m=%uK,p=%u", k.t_cost, k.m_cost_kib, k.lanes);
+    }
+    return buf;
+}
+
+static inline bool kdf_within(const KdfParams &k, const KdfLimits &limits) {
+    if (k.id == KDF_PBKDF2_SHA256) {
+        return k.iterations <= limits.max_iterations;
+    }
+    return k.t_cost <= limits.max_t_cost && k.m_cost_kib <= limits.max_m_cost_kib;
+}
+
+// Decodes an EXT_KDF record, refusing parameters past limits so that a
+// header cannot make the reader spend memory or time before its first tag
+// is checked.
+static inline bool kdf_decode(const unsigned char *p, size_t len, KdfParams &k, const KdfLimits &limits) {
+    if (len == 1 + 4 && p[0] == KDF_PBKDF2_SHA256) {
+        k.id = KDF_PBKDF2_SHA256;
+        k.iterations = get_be32(p + 1);
+    } else if (len == 1 + 3 * 4 && p[0] == KDF_ARGON2ID) {
+        k.id = KDF_ARGON2ID;
+        k.t_cost = get_be32(p + 1);
+        k.m_cost_kib = get_be32(p + 5);
+        k.lanes = get_be32(p + 9);
+    } else {
+        svlt_diag("unsupported KDF in header\n");
+        return false;
+    }
+    if (!kdf_params_valid(k)) {
+        svlt_diag("unsupported KDF in header\n");
+        return false;
+    }
+    if (!kdf_within(k, limits)) {
+        svlt_diag("header asks for KDF %s, over this reader's limit\n", kdf_spec(k).c_str());
+        return false;
+    }
+    return true;
+}
+
+static inline bool derive_key(const std::string &passphrase, const KdfParams &kdf, const unsigned char *salt,
+                              unsigned char *out_key) {
+    if (!kdf_params_valid(kdf)) {
+        svlt_diag("unsupported KDF parameters\n");
+        return false;
+    }
+    if (kdf.id == KDF_ARGON2ID) {
+        // Same inputs as argon2.IDKey(passphrase, salt, t, m, p, 32) in the agent
+        return argon2id_hash(kdf.t_cost, kdf.m_cost_kib, kdf.lanes, passphrase.data(), passphrase.size(), salt,
+                             SALT_LEN, out_key, KEY_LEN);
+    }
+    // PBKDF2-HMAC-SHA256
+    if (!PKCS5_PBKDF2_HMAC(passphrase.c_str(), passphrase.size(),
+                           salt, SALT_LEN,
+                           static_cast<int>(kdf.iterations),
+                           EVP_sha256(),
+                           KEY_LEN,
+                           out_key)) {
+        print_openssl_errors();
+        return false;
+    }
+    return true;
+}
+
+
+// OpenSSL 3 allocates on every EVP digest or HKDF init, so HMAC and the
+// plaintext SHA-256 use the low-level SHA-256 calls (the same assembly,
+// deprecated but still shipped) to keep the per-file path allocation-free.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+class HmacSha256 {
+public:
+    HmacSha256(const unsigned char *key, size_t len) {
+        unsigned char k[SHA256_CBLOCK] = {0};
+        if (len > sizeof(k)) {
+            SHA256(key, len, k);
+        } else {
+            memcpy(k, key, len);
+        }
+        unsigned char pad[SHA256_CBLOCK];
+        for (size_t i = 0; i < sizeof(pad); ++i) pad[i] = k[i] ^ 0x36;
+        SHA256_Init(&inner_);
+        SHA256_Update(&inner_, pad, sizeof(pad));
+        for (size_t i = 0; i < sizeof(pad); ++i) pad[i] = k[i] ^ 0x5c;
+        SHA256_Init(&outer_);
+        SHA256_Update(&outer_, pad, sizeof(pad));
+        OPENSSL_cleanse(k, sizeof(k));
+        OPENSSL_cleanse(pad, sizeof(pad));
+    }
+    ~HmacSha256() {
+        OPENSSL_cleanse(&inner_, sizeof(inner_));
+        OPENSSL_cleanse(&outer_, sizeof(outer_));
+    }
+
+    void update(const unsigned char *p, size_t n) { SHA256_Update(&inner_, p, n); }
+
+    void final(unsigned char *out) {
+        unsigned char h[SHA256_DIGEST_LENGTH];
+        SHA256_Final(h, &inner_);
+        SHA256_Update(&outer_, h, sizeof(h));
+        SHA256_Final(out, &outer_);
+        OPENSSL_cleanse(h, sizeof(h));
+    }
+
+private:
+    SHA256_CTX inner_, outer_;
+};
+
+// HKDF-SHA256 (RFC 5869) extract-and-expand; out_len is at most 255 * 32.
+static inline bool hkdf_sha256(const unsigned char *ikm, size_t ikm_len, const unsigned char *salt, size_t salt_len,
+                               const char *info, unsigned char *out, size_t out_len) {
+    if (out_len > 255 * SHA256_DIGEST_LENGTH) {
+        svlt_diag("HKDF output too long\n");
+        return false;
+    }
+    unsigned char prk[SHA256_DIGEST_LENGTH], t[SHA256_DIGEST_LENGTH];
+    HmacSha256 extract(salt, salt_len);
+    extract.update(ikm, ikm_len);
+    extract.final(prk);
+    for (unsigned char i = 1; out_len > 0; ++i) {
+        HmacSha256 expand(prk, sizeof(prk));
+        if (i > 1) expand.update(t, sizeof(t));
+        expand.update(reinterpret_cast<const unsigned char *>(info), strlen(info));
+        expand.update(&i, 1);
+        expand.final(t);
+        size_t n = std::min(out_len, sizeof(t));
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+    OPENSSL_cleanse(prk, sizeof(prk));
+    OPENSSL_cleanse(t, sizeof(t));
+    return true;
+}
+
+static inline size_t digest_len(unsigned char alg) {
+    return alg == DIGEST_SHA256 || alg == DIGEST_BLAKE2B_256 ? 32 : 0;
+}
+
+static inline void to_hex(const unsigned char *p, size_t n, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; ++i) {
+        out[2 * i] = digits[p[i] >> 4];
+        out[2 * i + 1] = digits[p[i] & 0xf];
+    }
+    out[2 * n] = '\0';
+}
+
+
+// Running digests of the plaintext, in the order of the algorithm ids given.
+class PlainDigest {
+public:
+    PlainDigest() = default;
+    PlainDigest(const PlainDigest &) = delete;
+    PlainDigest &operator=(const PlainDigest &) = delete;
+
+    bool init(const DigestAlgs &algs) {
+        algs_ = algs;
+        for (unsigned char alg : algs_) {
+            if (alg == DIGEST_SHA256) {
+                SHA256_Init(&sha_);
+            } else {
+                blake2b_init(b2_, 32);
+            }
+        }
+        return true;
+    }
+    bool active() const { return !algs_.empty(); }
+    const DigestAlgs &algs() const { return algs_; }
+
+    size_t size() const {
+        size_t n = 0;
+        for (unsigned char alg : algs_) n += digest_len(alg);
+        return n;
+    }
+
+    void update(const unsigned char *p, size_t n) {
+        if (n == 0) return;
+        if (uses(DIGEST_SHA256)) SHA256_Update(&sha_, p, n);
+        if (uses(DIGEST_BLAKE2B_256)) blake2b_update(b2_, p, n);
+    }
+
+    // Writes size() bytes: every digest, in algs() order.
+    bool final(unsigned char *out) {
+        for (unsigned char alg : algs_) {
+            if (alg == DIGEST_SHA256) {
+                SHA256_Final(out, &sha_);
+            } else {
+                blake2b_final(b2_, out);
+            }
+            out += digest_len(alg);
+        }
+        return true;
+    }
+
+private:
+    bool uses(unsigned char alg) const { return std::find(algs_.begin(), algs_.end(), alg) != algs_.end(); }
+
+    DigestAlgs algs_;
+    SHA256_CTX sha_;
+    Blake2bState b2_;
+};
+#pragma GCC diagnostic pop
+
+
+// ---- segment compression ----
+
+static const char *codec_name(unsigned char codec) {
+    switch (codec) {
+    case CODEC_ZLIB: return "zlib";
+    case CODEC_ZSTD: return "zstd";
+    case CODEC_LZ4: return "lz4";
+    default: return "none";
+    }
+}
+
+static inline bool codec_built_in(unsigned char codec) {
+    switch (codec) {
+    case CODEC_ZLIB: return true;
+#ifdef SVLT_HAVE_ZSTD
+    case CODEC_ZSTD: return true;
+#endif
+#ifdef SVLT_HAVE_LZ4
+    case CODEC_LZ4: return true;
+#endif
+    default: return false;
+    }
+}
+
+// One worker's compression state: the buffer compressed bodies pass
+// through, and each codec's stream or context, created on first use and
+// reset for every segment afterwards, so a warm worker compresses and
+// decompresses without allocating. zlib allocates through operator new
+// here, where aesgcm_file counts it.
+class CodecScratch {
+public:
+    CodecScratch() = default;
+    CodecScratch(const CodecScratch &) = delete;
+    CodecScratch &operator=(const CodecScratch &) = delete;
+    ~CodecScratch() {
+        if (deflating_) deflateEnd(&def_);
+        if (inflating_) inflateEnd(&inf_);
+#ifdef SVLT_HAVE_ZSTD
+        ZSTD_freeCCtx(zc_);
+        ZSTD_freeDCtx(zd_);
+#endif
+    }
+
+    std::vector<unsigned char> buf; // compressed bodies, sized on first use
+
+    // Compresses len bytes into at most cap bytes of dst. Returns the
+    // compressed size, or 0 when the result does not fit (or the codec
+    // fails), which callers treat as incompressible.
+    size_t compress(unsigned char codec, unsigned char level, const unsigned char *src, size_t len,
+                    unsigned char *dst, size_t cap) {
+        switch (codec) {
+        case CODEC_ZLIB: {
+            // Same stream as compress2(); a level change needs a fresh one.
+            if (deflating_ && level != def_level_) {
+                deflateEnd(&def_);
+                deflating_ = false;
+            }
+            if (!deflating_) {
+                def_ = z_stream{};
+                def_.zalloc = zalloc;
+                def_.zfree = zfree;
+                if (deflateInit(&def_, level) != Z_OK) return 0;
+                deflating_ = true;
+                def_level_ = level;
+            } else if (deflateReset(&def_) != Z_OK) {
+                return 0;
+            }
+            def_.next_in = const_cast<Bytef *>(src);
+            def_.avail_in = uInt(len);
+            def_.next_out = dst;
+            def_.avail_out = uInt(cap);
+            return deflate(&def_, Z_FINISH) == Z_STREAM_END ? size_t(def_.total_out) : 0;
+        }
+#ifdef SVLT_HAVE_ZSTD
+        case CODEC_ZSTD: {
+            if (!zc_ && !(zc_ = ZSTD_createCCtx())) return 0;
+            size_t n = ZSTD_compressCCtx(zc_, dst, cap, src, len, level);
+            return ZSTD_isError(n) ? 0 : n;
+        }
+#endif
+#ifdef SVLT_HAVE_LZ4
+        case CODEC_LZ4: {
+            int n = LZ4_compress_fast(reinterpret_cast<const char *>(src), reinterpret_cast<char *>(dst), int(len),
+                                      int(cap), level);
+            return n > 0 ? size_t(n) : 0;
+        }
+#endif
+        default:
+            return 0;
+        }
+    }
+
+    // Decompresses src into dst, which holds cap bytes; out receives the size.
+    bool decompress(unsigned char codec, const unsigned char *src, size_t len, unsigned char *dst, size_t cap,
+                    size_t &out) {
+        switch (codec) {
+        case CODEC_ZLIB: {
+            if (!inflating_) {
+                inf_ = z_stream{};
+                inf_.zalloc = zalloc;
+                inf_.zfree = zfree;
+                if (inflateInit(&inf_) != Z_OK) return false;
+                inflating_ = true;
+            } else if (inflateReset(&inf_) != Z_OK) {
+                return false;
+            }
+            inf_.next_in = const_cast<Bytef *>(src);
+            inf_.avail_in = uInt(len);
+            inf_.next_out = dst;
+            inf_.avail_out = uInt(cap);
+            if (inflate(&inf_, Z_FINISH) != Z_STREAM_END) return false;
+            out = inf_.total_out;
+            return true;
+        }
+#ifdef SVLT_HAVE_ZSTD
+        case CODEC_ZSTD: {
+            if (!zd_ && !(zd_ = ZSTD_createDCtx())) return false;
+            size_t n = ZSTD_decompressDCtx(zd_, dst, cap, src, len);
+            if (ZSTD_isError(n)) return false;
+            out = n;
+            return true;
+        }
+#endif
+#ifdef SVLT_HAVE_LZ4
+        case CODEC_LZ4: {
+            int n = LZ4_decompress_safe(reinterpret_cast<const char *>(src), reinterpret_cast<char *>(dst),
+                                        int(len), int(cap));
+            if (n < 0) return false;
+            out = size_t(n);
+            return true;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+
+private:
+    static voidpf zalloc(voidpf, uInt items, uInt size) {
+        return ::operator new(size_t(items) * size, std::nothrow);
+    }
+    static void zfree(voidpf, voidpf p) { ::operator delete(p); }
+
+    z_stream def_{}, inf_{};
+    bool deflating_ = false, inflating_ = false;
+    unsigned char def_level_ = 0;
+#ifdef SVLT_HAVE_ZSTD
+    ZSTD_CCtx *zc_ = nullptr;
+    ZSTD_DCtx *zd_ = nullptr;
+#endif
+};
+
+// Level used when none is given, and the highest accepted (lz4's level is
+// its acceleration factor).
+static inline uint32_t codec_default_level(unsigned char codec) {
+    return codec == CODEC_ZLIB ? 6 : codec == CODEC_ZSTD ? 3 : 1;
+}
+
+static inline uint32_t codec_max_level(unsigned char codec) {
+    return codec == CODEC_ZLIB ? 9 : codec == CODEC_ZSTD ? 22 : 255;
+}
+
+static constexpr size_t COMPRESS_PROBE = 16 << 10;
+
+// Compresses a segment for sealing if that saves at least 1/64 of it, else
+// returns 0. Large segments are tried on their first 16 KiB before the rest, so
+// already-compressed or encrypted input costs little more than a copy.
+// The result is left in s.buf.
+static inline size_t compress_segment(unsigned char codec, unsigned char level, const unsigned char *src, size_t len,
+                                      CodecScratch &s) {
+    const size_t cap = len - len / 64;
+    if (len < 256 || cap == 0) {
+        return 0;
+    }
+    if (s.buf.size() < cap) {
+        s.buf.resize(cap);
+    }
+    if (len >= 4 * COMPRESS_PROBE &&
+        s.compress(codec, level, src, COMPRESS_PROBE, s.buf.data(), COMPRESS_PROBE - COMPRESS_PROBE / 64) == 0) {
+        return 0;
+    }
+    return s.compress(codec, level, src, len, s.buf.data(), cap);
+}
+
+// ---- v2 segmented format ----
+
+struct V2Header {
+    uint32_t segment_size = 0;
+    unsigned char salt[SALT_LEN];
+    unsigned char nonce[NONCE_LEN];
+    bool has_file_salt = false;
+    unsigned char file_salt[SALT_LEN];
+    bool has_kdf = false;
+    KdfParams kdf = legacy_kdf();
+    DigestAlgs digests;                 // algorithms sealed at the end of the final segment
+    unsigned char codec = CODEC_NONE;   // set: segments are framed records (see 0x04)
+    unsigned char codec_level = 0;
+    uint32_t rekey_segments = 0; // set: segments per epoch key (see 0x05)
+    bool sparse = false;         // set: framed, and zero segments are method 2 (see 0x06)
+    InlineBytes<V2_FIXED_HEADER_LEN + MAX_EXT_LEN> raw; // exact header bytes, authenticated with every segment
+};
+
+using V2Extensions = InlineBytes<MAX_EXT_LEN>;
+
+static inline void put_ext(V2Extensions &ext, unsigned char type, const unsigned char *val, size_t len) {
+    ext.push_back(type);
+    ext.push_back(static_cast<unsigned char>(len >> 8));
+    ext.push_back(static_cast<unsigned char>(len));
+    ext.append(val, len);
+}
+
+static inline void build_v2_header(V2Header &h) {
+    V2Extensions ext;
+    if (h.has_file_salt) {
+        put_ext(ext, EXT_FILE_SALT, h.file_salt, SALT_LEN);
+    }
+    if (h.has_kdf) {
+        unsigned char kdf[KDF_MAX_ENCODED_LEN];
+        put_ext(ext, EXT_KDF, kdf, kdf_encode(h.kdf, kdf));
+    }
+    if (!h.digests.empty()) {
+        put_ext(ext, EXT_DIGEST, h.digests.data(), h.digests.size());
+    }
+    if (h.codec != CODEC_NONE) {
+        const unsigned char c[2] = {h.codec, h.codec_level};
+        put_ext(ext, EXT_COMPRESSION, c, sizeof(c));
+    }
+    if (h.rekey_segments > 0) {
+        unsigned char k[4];
+        put_be32(k, h.rekey_segments);
+        put_ext(ext, EXT_REKEY, k, sizeof(k));
+    }
+    if (h.sparse) {
+        put_ext(ext, EXT_SPARSE, nullptr, 0);
+    }
+    h.raw.assign(V2_FIXED_HEADER_LEN, 0);
+    unsigned char *p = h.raw.data();
+    memcpy(p, MAGIC, 4);
+    p[4] = VERSION_V2;
+    put_be32(p + 5, h.segment_size);
+    memcpy(p + 9, h.salt, SALT_LEN);
+    memcpy(p + 9 + SALT_LEN, h.nonce, NONCE_LEN);
+    p[9 + SALT_LEN + NONCE_LEN] = static_cast<unsigned char>(ext.size() >> 8);
+    p[10 + SALT_LEN + NONCE_LEN] = static_cast<unsigned char>(ext.size());
+    h.raw.append(ext.data(), ext.size());
+}
+
+// Decodes the extension records; any unknown, duplicate or malformed
+// record fails, since it may change how segments must be interpreted.
+static inline bool parse_v2_extensions(const unsigned char *p, size_t len, V2Header &h,
+                                       const KdfLimits &limits = KdfLimits()) {
+    while (len > 0) {
+        if (len < 3) {
+            svlt_diag("malformed header extension\n");
+            return false;
+        }
+        unsigned char type = p[0];
+        size_t vlen = (size_t(p[1]) << 8) | p[2];
+        p += 3;
+        len -= 3;
+        if (vlen > len) {
+            svlt_diag("malformed header extension\n");
+            return false;
+        }
+        if (type == EXT_FILE_SALT && vlen == SALT_LEN && !h.has_file_salt) {
+            memcpy(h.file_salt, p, SALT_LEN);
+            h.has_file_salt = true;
+        } else if (type == EXT_KDF && !h.has_kdf) {
+            if (!kdf_decode(p, vlen, h.kdf, limits)) {
+                return false;
+            }
+            h.has_kdf = true;
+        } else if (type == EXT_DIGEST && h.digests.empty() && vlen >= 1 && vlen <= 2) {
+            for (size_t i = 0; i < vlen; ++i) {
+                if (digest_len(p[i]) == 0 || (i > 0 && p[i] == p[0])) {
+                    svlt_diag("unsupported digest trailer\n");
+                    return false;
+                }
+                h.digests.push_back(p[i]);
+            }
+        } else if (type == EXT_COMPRESSION && h.codec == CODEC_NONE && vlen == 2 && p[0] != CODEC_NONE) {
+            if (!codec_built_in(p[0])) {
+                svlt_diag("segments are compressed with %s (0x%02x), which this build does not support\n",
+                          codec_name(p[0]), p[0]);
+                return false;
+            }
+            h.codec = p[0];
+            h.codec_level = p[1];
+        } else if (type == EXT_REKEY && h.rekey_segments == 0 && vlen == 4 && get_be32(p) > 0) {
+            h.rekey_segments = get_be32(p);
+        } else if (type == EXT_SPARSE && !h.sparse && vlen == 0) {
+            h.sparse = true;
+        } else {
+            svlt_diag("unsupported header extension 0x%02x (%zu bytes)\n", type, vlen);
+            return false;
+        }
+        p += vlen;
+        len -= vlen;
+    }
+    if (h.rekey_segments > 0 && !h.has_file_salt) {
+        svlt_diag("key rotation without a file salt\n");
+        return false;
+    }
+    return true;
+}
+
+// Decodes the V2_FIXED_HEADER_LEN bytes at the start of h.raw; ext_len
+// receives the length of the extension area that follows them.
+static inline bool parse_v2_fixed(V2Header &h, size_t &ext_len) {
+    const unsigned char *p = h.raw.data();
+    h.segment_size = get_be32(p + 5);
+    if (h.segment_size < MIN_SEGMENT_SIZE || h.segment_size > MAX_SEGMENT_SIZE) {
+        svlt_diag("invalid segment size: %u\n", h.segment_size);
+        return false;
+    }
+    memcpy(h.salt, p + 9, SALT_LEN);
+    memcpy(h.nonce, p + 9 + SALT_LEN, NONCE_LEN);
+    ext_len = (size_t(p[9 + SALT_LEN + NONCE_LEN]) << 8) | p[10 + SALT_LEN + NONCE_LEN];
+    if (ext_len > MAX_EXT_LEN) {
+        svlt_diag("header extensions too large (%zu bytes)\n", ext_len);
+        return false;
+    }
+    return true;
+}
+
+// Decodes a whole v2 header from the n bytes at p, for callers that hold
+// it in memory (the parser fuzz target and benchmarks). Returns its length,
+// or 0 if it is malformed or longer than n. Never reads past p + n, and
+// the extension length is capped before anything depends on it.
+static inline size_t parse_v2_header(const unsigned char *p, size_t n, V2Header &h,
+                                     const KdfLimits &limits = KdfLimits()) {
+    if (n < V2_FIXED_HEADER_LEN || memcmp(p, MAGIC, 4) != 0 || p[4] != VERSION_V2) {
+        svlt_diag("not a v2 header\n");
+        return 0;
+    }
+    h.raw.clear();
+    h.raw.append(p, V2_FIXED_HEADER_LEN);
+    size_t ext_len = 0;
+    if (!parse_v2_fixed(h, ext_len)) {
+        return 0;
+    }
+    if (n - V2_FIXED_HEADER_LEN < ext_len) {
+        svlt_diag("failed to read header\n");
+        return 0;
+    }
+    h.raw.append(p + V2_FIXED_HEADER_LEN, ext_len);
+    return parse_v2_extensions(p + V2_FIXED_HEADER_LEN, ext_len, h, limits) ? V2_FIXED_HEADER_LEN + ext_len : 0;
+}
+
+static inline size_t trailer_len(const V2Header &h) {
+    size_t n = 0;
+    for (unsigned char alg : h.digests) n += digest_len(alg);
+    return n;
+}
+
+// Whether segments are stored as length-prefixed records (0x04, 0x06).
+static inline bool v2_framed(const V2Header &h) {
+    return h.codec != CODEC_NONE || h.sparse;
+}
+
+// Largest segment as stored: a full segment plus its tag, and the length
+// prefix and method byte when framed.
+static inline size_t v2_max_record(const V2Header &h) {
+    return v2_framed(h) ? RECORD_LEN_PREFIX + 1 + size_t(h.segment_size) + TAG_LEN : size_t(h.segment_size) + TAG_LEN;
+}
+
+// The sealed length N in a framed record's length prefix, or 0 when it is
+// out of range (1 <= N <= S + 1). Every reader checks prefixes here, so no
+// prefix can make one size a buffer or read past a full segment.
+static inline size_t v2_record_sealed(const V2Header &h, const unsigned char *prefix) {
+    size_t sealed = get_be32(prefix);
+    return sealed >= 1 && sealed <= size_t(h.segment_size) + 1 ? sealed : 0;
+}
+
+// Whether len bytes at p are all zero: compares 16-byte words so a
+// segment of data usually bails out on its first word.
+static inline bool all_zero(const unsigned char *p, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint64_t a, b;
+        memcpy(&a, p + i, 8);
+        memcpy(&b, p + i + 8, 8);
+        if (a | b) return false;
+    }
+    for (; i < len; ++i) {
+        if (p[i]) return false;
+    }
+    return true;
+}
+
+// The key segments are sealed with, given the KDF output for h.salt: a
+// per-file subkey when the header carries a file salt, else that output.
+static inline bool v2_subkey(const unsigned char *master, const V2Header &h, unsigned char *key) {
+    if (!h.has_file_salt) {
+        memcpy(key, master, KEY_LEN);
+        return true;
+    }
+    return hkdf_sha256(master, KEY_LEN, h.file_salt, SALT_LEN, "SVLT v2 file key", key, KEY_LEN);
+}
+
+// Segments per epoch key for a rotation interval of `bytes` (0 = none) and
+// segment size S, or 0 when a stream of at most `expected` bytes (UINT64_MAX
+// if unknown) fits in one epoch anyway and the header can stay without 0x05.
+static inline uint32_t rekey_interval(uint64_t bytes, uint32_t segment_size, uint64_t expected) {
+    if (bytes == 0 || expected <= bytes) {
+        return 0;
+    }
+    return uint32_t(std::min<uint64_t>(std::max<uint64_t>(bytes / segment_size, 1), UINT32_MAX));
+}
+
+// The key a worker's context holds for a file. With 0x05 each epoch key is
+// derived the first time the worker reaches one of its segments and kept
+// until the next epoch, so rotation costs one HKDF and one rekey per worker
+// and epoch, nothing per segment. Without 0x05 the context keeps the file
+// key it was created or rekeyed with.
+struct EpochKey {
+    static constexpr uint64_t NONE = UINT64_MAX;
+    unsigned char file_key[KEY_LEN];
+    uint64_t epoch = NONE;
+
+    EpochKey() = default;
+    EpochKey(const EpochKey &) = delete;
+    EpochKey &operator=(const EpochKey &) = delete;
+    ~EpochKey() { clear(); }
+
+    void reset(const unsigned char *key) {
+        memcpy(file_key, key, KEY_LEN);
+        epoch = NONE;
+    }
+    void clear() {
+        OPENSSL_cleanse(file_key, KEY_LEN);
+        epoch = NONE;
+    }
+};
+
+
+// Segment i uses the base nonce with its low 64 bits XORed with i.
+static inline void segment_nonce(const unsigned char *base, uint64_t index, unsigned char *out) {
+    unsigned char ctr[8];
+    put_be64(ctr, index);
+    memcpy(out, base, NONCE_LEN);
+    for (int i = 0; i < 8; ++i) {
+        out[NONCE_LEN - 8 + i] ^= ctr[i];
+    }
+}
+
+// AAD for segment i is header || be64(i) || final-flag, so reordered,
+// dropped or truncated segments all fail authentication.
+static inline bool segment_aad(EVP_CIPHER_CTX *ctx, bool encrypt, const V2Header &h, uint64_t index, bool final) {
+    unsigned char trailer[9];
+    put_be64(trailer, index);
+    trailer[8] = final ? 1 : 0;
+    int outlen;
+    if (encrypt) {
+        return 1 == EVP_EncryptUpdate(ctx, nullptr, &outlen, h.raw.data(), h.raw.size()) &&
+               1 == EVP_EncryptUpdate(ctx, nullptr, &outlen, trailer, sizeof(trailer));
+    }
+    return 1 == EVP_DecryptUpdate(ctx, nullptr, &outlen, h.raw.data(), h.raw.size()) &&
+           1 == EVP_DecryptUpdate(ctx, nullptr, &outlen, trailer, sizeof(trailer));
+}
+
+struct CipherCtxFree {
+    void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+};
+using CipherCtx = std::unique_ptr<EVP_CIPHER_CTX, CipherCtxFree>;
+
+// Replaces the key of a context from new_segment_ctx in place; its cipher
+// and IV length stay, so nothing is reallocated.
+static inline bool rekey_segment_ctx(EVP_CIPHER_CTX *ctx, bool encrypt, const unsigned char *key) {
+    if (1 != (encrypt ? EVP_EncryptInit_ex(ctx, nullptr, nullptr, key, nullptr)
+                      : EVP_DecryptInit_ex(ctx, nullptr, nullptr, key, nullptr))) {
+        print_openssl_errors();
+        return false;
+    }
+    return true;
+}
+
+// Rekeys ctx for segment index when it starts a new epoch of a rotating file.
+static inline bool select_epoch_key(EVP_CIPHER_CTX *ctx, bool encrypt, const V2Header &h, EpochKey &k,
+                                    uint64_t index) {
+    if (h.rekey_segments == 0 || index / h.rekey_segments == k.epoch) {
+        return true;
+    }
+    const uint64_t epoch = index / h.rekey_segments;
+    unsigned char salt[8], key[KEY_LEN];
+    put_be64(salt, epoch);
+    bool ok = hkdf_sha256(k.file_key, KEY_LEN, salt, sizeof(salt), "SVLT v2 epoch key", key, KEY_LEN) &&
+              rekey_segment_ctx(ctx, encrypt, key);
+    OPENSSL_cleanse(key, KEY_LEN);
+    k.epoch = ok ? epoch : EpochKey::NONE;
+    return ok;
+}
+
+// Creates an AES-256-GCM context keyed once; each segment only resets the IV.
+static inline CipherCtx new_segment_ctx(bool encrypt, const unsigned char *key) {
+    CipherCtx ctx(EVP_CIPHER_CTX_new());
+    if (!ctx) {
+        print_openssl_errors();
+        return nullptr;
+    }
+    int ok = encrypt ? EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, nullptr, nullptr)
+                     : EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, nullptr, nullptr);
+    ok = ok && EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, NONCE_LEN, nullptr);
+    if (!ok) {
+        print_openssl_errors();
+        return nullptr;
+    }
+    if (!rekey_segment_ctx(ctx.get(), encrypt, key)) {
+        return nullptr;
+    }
+    return ctx;
+}
+
+// Encrypts one segment; out receives len bytes of ciphertext followed by the tag.
+static inline bool seal_segment(EVP_CIPHER_CTX *ctx, const V2Header &h, uint64_t index, bool final,
+                                const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char nonce[NONCE_LEN];
+    segment_nonce(h.nonce, index, nonce);
+    int outlen = 0, finlen = 0;
+    if (1 != EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce) ||
+        !segment_aad(ctx, true, h, index, final) ||
+        (len > 0 && 1 != EVP_EncryptUpdate(ctx, out, &outlen, in, len)) ||
+        1 != EVP_EncryptFinal_ex(ctx, out + outlen, &finlen) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_LEN, out + len)) {
+        print_openssl_errors();
+        return false;
+    }
+    return true;
+}
+
+// Decrypts and authenticates one segment of len ciphertext bytes followed by
+// its tag. Returns false without printing on a tag mismatch.
+static inline bool open_segment(EVP_CIPHER_CTX *ctx, const V2Header &h, uint64_t index, bool final,
+                                const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char nonce[NONCE_LEN];
+    segment_nonce(h.nonce, index, nonce);
+    unsigned char tag[TAG_LEN];
+    memcpy(tag, in + len, TAG_LEN);
+    int outlen = 0, finlen = 0;
+    if (1 != EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce) ||
+        !segment_aad(ctx, false, h, index, final) ||
+        (len > 0 && 1 != EVP_DecryptUpdate(ctx, out, &outlen, in, len)) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_LEN, tag)) {
+        print_openssl_errors();
+        return false;
+    }
+    return EVP_DecryptFinal_ex(ctx, out + outlen, &finlen) > 0;
+}
+
+// Seals a framed segment: out receives be32(1 + len), the encrypted
+// method || body, and the tag. Returns the record length, or 0 on error.
+static inline size_t seal_record(EVP_CIPHER_CTX *ctx, const V2Header &h, uint64_t index, bool final,
+                                 unsigned char method, const unsigned char *body, size_t len, unsigned char *out) {
+    unsigned char nonce[NONCE_LEN];
+    segment_nonce(h.nonce, index, nonce);
+    put_be32(out, static_cast<uint32_t>(1 + len));
+    unsigned char *ct = out + RECORD_LEN_PREFIX;
+    int outlen = 0, bodylen = 0, finlen = 0;
+    if (1 != EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce) ||
+        !segment_aad(ctx, true, h, index, final) || 1 != EVP_EncryptUpdate(ctx, ct, &outlen, &method, 1) ||
+        (len > 0 && 1 != EVP_EncryptUpdate(ctx, ct + 1, &bodylen, body, len)) ||
+        1 != EVP_EncryptFinal_ex(ctx, ct + 1 + len, &finlen) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_LEN, ct + 1 + len)) {
+        print_openssl_errors();
+        return 0;
+    }
+    return RECORD_LEN_PREFIX + 1 + len + TAG_LEN;
+}
+
+// Decrypts and authenticates a framed segment whose sealed payload is the
+// len bytes at in (followed by the tag). The method byte is decrypted first
+// so the body lands where it is needed: in plain (method 0, no copy) or in
+// packed (method 1, still compressed; method 2, the run length). Nothing is
+// decompressed here, so only authenticated data ever reaches the codec.
+static inline bool open_record(EVP_CIPHER_CTX *ctx, const V2Header &h, uint64_t index, bool final,
+                               const unsigned char *in, size_t len, unsigned char &method, unsigned char *plain,
+                               std::vector<unsigned char> &packed) {
+    unsigned char nonce[NONCE_LEN];
+    segment_nonce(h.nonce, index, nonce);
+    unsigned char tag[TAG_LEN];
+    memcpy(tag, in + len, TAG_LEN);
+    int outlen = 0, bodylen = 0, finlen = 0;
+    if (len < 1 || 1 != EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce) ||
+        !segment_aad(ctx, false, h, index, final) || 1 != EVP_DecryptUpdate(ctx, &method, &outlen, in, 1)) {
+        print_openssl_errors();
+        return false;
+    }
+    unsigned char *dst = plain;
+    if (method != 0) {
+        if (packed.size() < len - 1) {
+            packed.resize(len - 1);
+        }
+        dst = packed.data();
+    }
+    if ((len > 1 && 1 != EVP_DecryptUpdate(ctx, dst, &bodylen, in + 1, len - 1)) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_LEN, tag)) {
+        print_openssl_errors();
+        return false;
+    }
+    return EVP_DecryptFinal_ex(ctx, dst + bodylen, &finlen) > 0;
+}
+
+// Opens a framed segment into out (capacity h.segment_size) and checks it
+// holds a full segment unless final. Returns the plaintext length via len.
+// A run of zeros is written out as zeros, unless zeros is given: then it is
+// set instead, and out is left alone for the caller to skip.
+static inline bool open_framed_segment(EVP_CIPHER_CTX *ctx, const V2Header &h, uint64_t index, bool final,
+                                       const unsigned char *in, size_t sealed, unsigned char *out,
+                                       CodecScratch &scratch, size_t &len, bool *zeros = nullptr) {
+    unsigned char method = 0;
+    if (!open_record(ctx, h, index, final, in, sealed, method, out, scratch.buf)) {
+        svlt_diag("decryption failed: authentication tag mismatch in segment %llu\n",
+                  static_cast<unsigned long long>(index));
+        return false;
+    }
+    if (zeros) {
+        *zeros = false;
+    }
+    if (method == METHOD_RAW) {
+        len = sealed - 1;
+    } else if (method == METHOD_ZEROS && h.sparse && sealed == 1 + 4) {
+        len = get_be32(scratch.buf.data());
+        if (len <= h.segment_size) {
+            if (zeros) {
+                *zeros = true;
+            } else {
+                memset(out, 0, len);
+            }
+        }
+    } else if (method != METHOD_PACKED || h.codec == CODEC_NONE ||
+               !scratch.decompress(h.codec, scratch.buf.data(), sealed - 1, out, h.segment_size, len)) {
+        svlt_diag("segment %llu does not decompress\n", static_cast<unsigned long long>(index));
+        return false;
+    }
+    if (len > h.segment_size || (!final && len != h.segment_size)) {
+        svlt_diag("segment %llu holds %zu bytes, expected %u\n", static_cast<unsigned long long>(index), len,
+                  h.segment_size);
+        return false;
+    }
+    return true;
+}
+
+// Seals segment `index` of len plaintext bytes at src into out (room for
+// v2_max_record(h)), compressing it through scratch first when the header
+// asks for a codec, under the epoch key keys selects for it. In a sparse
+// file a segment of zeros becomes a method 2 record, and src may be null
+// for one the caller already knows is zeros (a hole it did not read).
+// Returns the bytes written, or 0 on error; packed tells whether the
+// compressed form was kept, zeros whether the segment was a run of zeros.
+static inline size_t seal_v2_segment(EVP_CIPHER_CTX *ctx, EpochKey &keys, const V2Header &h, uint64_t index,
+                                     bool final, const unsigned char *src, size_t len, CodecScratch &scratch,
+                                     unsigned char *out, bool &packed, bool *zeros = nullptr) {
+    packed = false;
+    bool hole = h.sparse && len > 0 && (!src || all_zero(src, len));
+    if (zeros) {
+        *zeros = hole;
+    }
+    if (!select_epoch_key(ctx, true, h, keys, index)) {
+        return 0;
+    }
+    if (hole) {
+        unsigned char run[4];
+        put_be32(run, static_cast<uint32_t>(len));
+        return seal_record(ctx, h, index, final, METHOD_ZEROS, run, sizeof(run), out);
+    }
+    if (!v2_framed(h)) {
+        return seal_segment(ctx, h, index, final, src, len, out) ? len + TAG_LEN : 0;
+    }
+    size_t n = h.codec == CODEC_NONE ? 0 : compress_segment(h.codec, h.codec_level, src, len, scratch);
+    packed = n > 0;
+    return packed ? seal_record(ctx, h, index, final, METHOD_PACKED, scratch.buf.data(), n, out)
+                  : seal_record(ctx, h, index, final, METHOD_RAW, src, len, out);
+}
+
+// Opens segment `index` into out (room for h.segment_size), under the epoch
+// key keys selects for it. sealed is the ciphertext length before the tag;
+// for framed segments it is the value of the length prefix and in points
+// just past the prefix. len receives the plaintext length; see
+// open_framed_segment for zeros.
+static inline bool open_v2_segment(EVP_CIPHER_CTX *ctx, EpochKey &keys, const V2Header &h, uint64_t index,
+                                   bool final, const unsigned char *in, size_t sealed, unsigned char *out,
+                                   CodecScratch &scratch, size_t &len, bool *zeros = nullptr) {
+    if (!select_epoch_key(ctx, false, h, keys, index)) {
+        return false;
+    }
+    if (zeros) {
+        *zeros = false;
+    }
+    if (v2_framed(h)) {
+        return open_framed_segment(ctx, h, index, final, in, sealed, out, scratch, len, zeros);
+    }
+    len = sealed;
+    if (!open_segment(ctx, h, index, final, in, sealed, out)) {
+        svlt_diag("decryption failed: authentication tag mismatch in segment %llu\n",
+                  static_cast<unsigned long long>(index));
+        return false;
+    }
+    return true;
+}
+
+#endif // SVLT_FORMAT_H
@@ -0,0 +1,527 @@
+// Fuzz target for the SVLT v2 container parser: the fixed header and its
+// extension records, the framed records' length prefixes, and libsvlt's
+// streaming decryptor, which is the path untrusted input takes into a
+// restore. Each input is parsed twice, once from memory (parse_v2_header
+// then a walk over the record prefixes) and once as a stream fed to
+// svlt_decrypt_update in uneven chunks under a fixed key, and the two must
+// agree on any stream that authenticates. Inputs whose header names a KDF
+// are streamed once more under a passphrase, so the KDF actually runs on
+// whatever parameters the header asks for.
+//
+// Every input also runs under an allocation budget: the bytes requested
+// through operator new while it is processed may not exceed its own length
+// plus a fixed allowance for codec state. A segment size, extension length,
+// record prefix or KDF memory cost can therefore never buy an allocation the
+// input does not pay for; a breach aborts, which both drivers report as a
+// crash. Argon2id allocates its memory through operator new, so the KDF is
+// charged like everything else, and its time counts towards --slow-ms. The
+// decoder's KDF limits are set to fit inside both, as any embedder sizing
+// them for its own budget would.
+//
+// `make fuzz` builds it for libFuzzer (clang, with ASan and UBSan):
+//   ./bin/svlt_fuzz -max_len=300000 -timeout=5 corpus/
+// `make fuzz-replay` builds the same target with a standalone driver
+// (SVLT_FUZZ_STANDALONE) for compilers without libFuzzer. It writes a seed
+// corpus of valid streams (--seed DIR), replays files and directories,
+// optionally with N mutated variants of each (--mutate N), and reports parse
+// and verify latency, failing when any input takes longer than --slow-ms:
+//   ./bin/svlt_fuzz_replay --seed corpus && ./bin/svlt_fuzz_replay --mutate 2000 corpus
+// Link with tools/libsvlt.cpp.
+
+#define SVLT_LIBRARY 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "svlt_format.h"
+#include "svlt.h"
+
+// ---- allocation budget ----
+
+static constexpr size_t ALLOC_ALLOWANCE = 1 << 20; // decryptor, zlib and zstd state
+
+static std::atomic<size_t> alloc_bytes{0};
+
+static void *counted_new(size_t n) {
+    alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+    return malloc(n ? n : 1);
+}
+
+void *operator new(size_t n) {
+    if (void *p = counted_new(n)) return p;
+    throw std::bad_alloc();
+}
+void *operator new(size_t n, const std::nothrow_t &) noexcept { return counted_new(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+
+// ---- target ----
+
+static const uint8_t FUZZ_KEY[SVLT_KEY_LEN] = {
+    0x53, 0x56, 0x4c, 0x54, 0x20, 0x66, 0x75, 0x7a, 0x7a, 0x20, 0x6b, 0x65, 0x79, 0x20, 0x30, 0x31,
+    0x02, 0x03, 0x05, 0x07, 0x0b, 0x0d, 0x11, 0x13, 0x17, 0x1d, 0x1f, 0x25, 0x29, 0x2b, 0x2f, 0x35,
+};
+
+static const char FUZZ_PASS[] = "svlt fuzz passphrase";
+
+// The KDF costs a header may ask for here: Argon2id memory well inside
+// ALLOC_ALLOWANCE, and few enough passes and iterations to stay fast.
+static KdfLimits fuzz_kdf_limits() {
+    KdfLimits limits;
+    limits.max_m_cost_kib = 256;
+    limits.max_t_cost = 2;
+    limits.max_iterations = 20000;
+    return limits;
+}
+
+// Chunk sizes the stream is fed in, so records and prefixes split across calls.
+static const size_t FEED_CHUNKS[] = {61, 1, 4093, 3, 65536, 17};
+
+// Plaintext room for any stream: a full segment plus a held-back trailer.
+static unsigned char *plain_buf() {
+    static unsigned char *buf = static_cast<unsigned char *>(malloc(MAX_SEGMENT_SIZE + MAX_DIGEST_TRAILER));
+    return buf;
+}
+
+struct InputTiming {
+    uint64_t parse_ns = 0;  // memory parse: header and record prefixes
+    uint64_t verify_ns = 0; // libsvlt stream: key setup and every segment opened
+    bool authentic = false;
+};
+
+static uint64_t now_ns() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count());
+}
+
+[[noreturn]] static void fuzz_abort(const char *what, size_t a, size_t b) {
+    fprintf(stderr, "svlt_fuzz: %s (%zu, %zu)\n", what, a, b);
+    abort();
+}
+
+// Walks the record prefixes after the header; end receives where the last
+// whole record ends. Returns the record count, or SIZE_MAX on a bad prefix.
+static size_t walk_records(const V2Header &h, const uint8_t *data, size_t size, size_t off, size_t &end) {
+    size_t count = 0;
+    if (!v2_framed(h)) {
+        const size_t rec = size_t(h.segment_size) + TAG_LEN;
+        size_t body = size - off;
+        end = size;
+        return body < TAG_LEN ? SIZE_MAX : body / rec + (body % rec != 0);
+    }
+    while (size - off >= RECORD_LEN_PREFIX) {
+        size_t sealed = v2_record_sealed(h, data + off);
+        if (sealed == 0 || size - off - RECORD_LEN_PREFIX < sealed + TAG_LEN) {
+            end = off;
+            return SIZE_MAX;
+        }
+        off += RECORD_LEN_PREFIX + sealed + TAG_LEN;
+        ++count;
+    }
+    end = off;
+    return count;
+}
+
+// Streams data through libsvlt under FUZZ_KEY, or under FUZZ_PASS and the
+// KDF its header names.
+static bool stream_decrypt(const uint8_t *data, size_t size, bool passphrase) {
+    svlt_decryptor *d = nullptr;
+    if (svlt_decryptor_new(&d) != SVLT_OK) return false;
+    const KdfLimits limits = fuzz_kdf_limits();
+    bool ok = svlt_decryptor_set_kdf_limits(d, limits.max_m_cost_kib, limits.max_t_cost, limits.max_iterations) ==
+                  SVLT_OK &&
+              (passphrase ? svlt_decrypt_init(d, FUZZ_PASS, strlen(FUZZ_PASS))
+                          : svlt_decrypt_init_key(d, FUZZ_KEY)) == SVLT_OK;
+    unsigned char *out = plain_buf();
+    const size_t cap = MAX_SEGMENT_SIZE + MAX_DIGEST_TRAILER;
+    size_t off = 0, k = 0;
+    while (ok && off < size) {
+        size_t take = std::min(FEED_CHUNKS[k++ % (sizeof(FEED_CHUNKS) / sizeof(FEED_CHUNKS[0]))], size - off);
+        size_t used = 0, wrote = 0;
+        ok = svlt_decrypt_update(d, data + off, take, &used, out, cap, &wrote) == SVLT_OK;
+        if (ok && used == 0 && wrote == 0) fuzz_abort("decryptor made no progress", off, take);
+        if (used > take || wrote > cap) fuzz_abort("decryptor overran a span", used, wrote);
+        off += used;
+    }
+    size_t wrote = 0;
+    ok = ok && svlt_decrypt_final(d, out, cap, &wrote) == SVLT_OK;
+    svlt_decryptor_free(d);
+    return ok;
+}
+
+static InputTiming run_one(const uint8_t *data, size_t size) {
+    InputTiming t;
+    const size_t before = alloc_bytes.load(std::memory_order_relaxed);
+
+    uint64_t t0 = now_ns();
+    V2Header h;
+    size_t hdr = parse_v2_header(data, size, h, fuzz_kdf_limits());
+    size_t records = SIZE_MAX, end = 0;
+    if (hdr > 0) {
+        if (v2_max_record(h) > RECORD_LEN_PREFIX + 1 + MAX_SEGMENT_SIZE + TAG_LEN) {
+            fuzz_abort("segment size escaped its bound", h.segment_size, MAX_SEGMENT_SIZE);
+        }
+        if (h.kdf.id == KDF_ARGON2ID && size_t(h.kdf.m_cost_kib) * 1024 > ALLOC_ALLOWANCE / 2) {
+            fuzz_abort("KDF memory escaped its bound", h.kdf.m_cost_kib, ALLOC_ALLOWANCE / 1024);
+        }
+        records = walk_records(h, data, size, hdr, end);
+    }
+    uint64_t t1 = now_ns();
+    t.authentic = stream_decrypt(data, size, false);
+    // A header without a KDF record always costs the build's fixed PBKDF2,
+    // which no input controls, so only the others are run under a passphrase.
+    if (hdr == 0 || h.has_kdf) {
+        t.authentic = stream_decrypt(data, size, true) || t.authentic;
+    }
+    uint64_t t2 = now_ns();
+    t.parse_ns = t1 - t0;
+    t.verify_ns = t2 - t1;
+
+    // A stream that authenticates parses from memory too, into whole records.
+    if (t.authentic && (hdr == 0 || records == SIZE_MAX || records == 0 || end != size)) {
+        fuzz_abort("stream decrypted but does not parse", hdr, end);
+    }
+    size_t spent = alloc_bytes.load(std::memory_order_relaxed) - before;
+    if (spent > size + ALLOC_ALLOWANCE) {
+        fuzz_abort("allocated more than the input pays for", spent, size);
+    }
+    return t;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run_one(data, size);
+    return 0;
+}
+
+#ifdef SVLT_FUZZ_STANDALONE
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// ---- standalone driver ----
+
+struct ReplayStats {
+    uint64_t inputs = 0;
+    uint64_t authentic = 0;
+    uint64_t parse_total_ns = 0, parse_max_ns = 0;
+    uint64_t verify_total_ns = 0, verify_max_ns = 0;
+    std::string slowest;
+    uint64_t slowest_ns = 0;
+    uint64_t slow = 0;
+};
+
+static bool read_whole(const std::string &path, std::vector<uint8_t> &out) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path.c_str());
+        return false;
+    }
+    out.clear();
+    uint8_t buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static bool write_whole(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (f && fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "cannot write %s\n", path.c_str());
+    return ok;
+}
+
+// Files named on the command line, and the regular files of directories.
+static bool collect_inputs(const std::string &path, std::vector<std::string> &out) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "cannot stat %s\n", path.c_str());
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        out.push_back(path);
+        return true;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        fprintf(stderr, "cannot open %s\n", path.c_str());
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *e = readdir(dir)) {
+        std::string p = path + "/" + e->d_name;
+        if (e->d_name[0] != '.' && stat(p.c_str(), &st) == 0 && S_ISREG(st.st_mode)) names.push_back(p);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    out.insert(out.end(), names.begin(), names.end());
+    return true;
+}
+
+static uint64_t next_rand(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// Offset and count of the 32-bit parameters in the header's KDF record, or
+// 0 if it has none.
+static size_t kdf_fields(const std::vector<uint8_t> &in, size_t &count) {
+    if (in.size() < V2_FIXED_HEADER_LEN) return 0;
+    size_t ext_len = (size_t(in[V2_FIXED_HEADER_LEN - 2]) << 8) | in[V2_FIXED_HEADER_LEN - 1];
+    size_t end = std::min(in.size(), V2_FIXED_HEADER_LEN + ext_len);
+    for (size_t p = V2_FIXED_HEADER_LEN; p + 3 <= end;) {
+        size_t vlen = (size_t(in[p + 1]) << 8) | in[p + 2];
+        if (in[p] == EXT_KDF) {
+            count = (vlen - 1) / 4;
+            return vlen > 1 && p + 3 + vlen <= end ? p + 4 : 0;
+        }
+        p += 3 + vlen;
+    }
+    return 0;
+}
+
+// One malformed variant of a valid stream: a flipped byte, a truncation, a
+// length or KDF cost field overwritten with a hostile value, or a spliced
+// byte run.
+static void mutate(const std::vector<uint8_t> &in, std::vector<uint8_t> &out, uint64_t &rng) {
+    static const uint32_t hostile[] = {0, 1, 0xffffffffu, 0x7fffffffu, uint32_t(MAX_SEGMENT_SIZE) + 1,
+                                       uint32_t(MAX_SEGMENT_SIZE) + 2, 4096, 4097, 4098};
+    static const uint32_t hostile_kdf[] = {0, 1, 2, 3, 8, 256, 257, 20000, 20001, ARGON2_MAX_T, ARGON2_MAX_M_KIB,
+                                           PBKDF2_MAX_ITERS, 0xffffffffu};
+    out = in;
+    if (out.empty()) {
+        out.push_back(uint8_t(next_rand(rng)));
+        return;
+    }
+    size_t at = size_t(next_rand(rng) % out.size());
+    switch (next_rand(rng) % 5) {
+    case 0:
+        out[at] ^= uint8_t(1u << (next_rand(rng) % 8));
+        break;
+    case 1:
+        out.resize(at);
+        break;
+    case 2: {
+        // Segment size, extension length or a record prefix, when they are there.
+        static const size_t fields[] = {5, 9 + SALT_LEN + NONCE_LEN - 2};
+        size_t pos = next_rand(rng) % 2 ? fields[next_rand(rng) % 2] : at;
+        if (pos + 4 <= out.size()) {
+            put_be32(out.data() + pos, hostile[next_rand(rng) % (sizeof(hostile) / sizeof(hostile[0]))]);
+        }
+        // Or the KDF's passes, memory, lanes or iterations.
+        size_t count = 0;
+        if (size_t kdf = kdf_fields(out, count); kdf && next_rand(rng) % 2) {
+            put_be32(out.data() + kdf + 4 * (next_rand(rng) % count),
+                     hostile_kdf[next_rand(rng) % (sizeof(hostile_kdf) / sizeof(hostile_kdf[0]))]);
+        }
+        break;
+    }
+    case 3: {
+        size_t from = size_t(next_rand(rng) % out.size());
+        size_t len = std::min<size_t>(next_rand(rng) % 64 + 1, out.size() - from);
+        std::vector<uint8_t> run(out.begin() + long(from), out.begin() + long(from + len));
+        out.insert(out.begin() + long(at), run.begin(), run.end());
+        break;
+    }
+    default:
+        out.erase(out.begin() + long(at), out.begin() + long(std::min(out.size(), at + 1 + next_rand(rng) % 32)));
+        break;
+    }
+}
+
+static void record(ReplayStats &st, const std::string &name, const InputTiming &t, uint64_t slow_ns) {
+    ++st.inputs;
+    st.authentic += t.authentic;
+    st.parse_total_ns += t.parse_ns;
+    st.verify_total_ns += t.verify_ns;
+    st.parse_max_ns = std::max(st.parse_max_ns, t.parse_ns);
+    st.verify_max_ns = std::max(st.verify_max_ns, t.verify_ns);
+    uint64_t total = t.parse_ns + t.verify_ns;
+    if (total > st.slowest_ns) {
+        st.slowest_ns = total;
+        st.slowest = name;
+    }
+    if (total > slow_ns) {
+        ++st.slow;
+        fprintf(stderr, "slow input: %s took %.1f ms\n", name.c_str(), double(total) / 1e6);
+    }
+}
+
+// Encrypts plain into out with libsvlt under FUZZ_KEY, or under FUZZ_PASS
+// run through kdf (SVLT_KDF_*) at the cheapest cost it allows.
+static bool seal_stream(const std::vector<uint8_t> &plain, uint32_t seg, int codec, bool sha256, bool sparse,
+                        uint64_t rekey, int kdf, std::vector<uint8_t> &out) {
+    svlt_encryptor *e = nullptr;
+    if (svlt_encryptor_new(&e) != SVLT_OK) return false;
+    bool ok = svlt_encryptor_set_segment_size(e, seg) == SVLT_OK &&
+              (codec == SVLT_CODEC_NONE || svlt_encryptor_set_compression(e, codec, 0) == SVLT_OK) &&
+              svlt_encryptor_set_embed_sha256(e, sha256) == SVLT_OK &&
+              svlt_encryptor_set_sparse(e, sparse) == SVLT_OK && svlt_encryptor_set_rekey_interval(e, rekey) == SVLT_OK;
+    if (kdf == SVLT_KDF_PBKDF2) {
+        ok = ok && svlt_encryptor_set_pbkdf2(e, PBKDF2_MIN_ITERS) == SVLT_OK &&
+             svlt_encrypt_init(e, FUZZ_PASS, strlen(FUZZ_PASS)) == SVLT_OK;
+    } else if (kdf == SVLT_KDF_ARGON2ID) {
+        ok = ok && svlt_encryptor_set_argon2id(e, 1, 64, 1) == SVLT_OK &&
+             svlt_encrypt_init(e, FUZZ_PASS, strlen(FUZZ_PASS)) == SVLT_OK;
+    } else {
+        ok = ok && svlt_encrypt_init_key(e, FUZZ_KEY) == SVLT_OK;
+    }
+    std::vector<uint8_t> buf(ok ? svlt_encrypt_output_size(e) : 0);
+    out.clear();
+    size_t off = 0;
+    while (ok && off < plain.size()) {
+        size_t used = 0, wrote = 0;
+        ok = svlt_encrypt_update(e, plain.data() + off, plain.size() - off, &used, buf.data(), buf.size(), &wrote) ==
+             SVLT_OK;
+        out.insert(out.end(), buf.begin(), buf.begin() + long(wrote));
+        off += used;
+    }
+    size_t wrote = 0;
+    ok = ok && svlt_encrypt_final(e, buf.data(), buf.size(), &wrote) == SVLT_OK;
+    out.insert(out.end(), buf.begin(), buf.begin() + long(wrote));
+    svlt_encryptor_free(e);
+    return ok;
+}
+
+// Writes valid streams covering every header extension and record method.
+static bool write_seeds(const std::string &dir) {
+    mkdir(dir.c_str(), 0755);
+    std::vector<uint8_t> text, mixed, tail, tail_aligned;
+    for (size_t i = 0; i < 3 * 4096 + 517; ++i) text.push_back(uint8_t("svlt fuzz seed corpus\n"[i % 22]));
+    mixed.assign(6 * 4096 + 9, 0);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 4096; i < 2 * 4096; ++i) mixed[i] = uint8_t(next_rand(rng));
+    // Data then a hole to the end, with the digest trailer in the final
+    // zero segment or in a segment of its own.
+    tail.assign(6 * 4096 + 300, 0);
+    for (size_t i = 0; i < 4096; ++i) tail[i] = uint8_t(next_rand(rng));
+    tail_aligned.assign(tail.begin(), tail.begin() + 6 * 4096);
+    struct Seed {
+        const char *name;
+        const std::vector<uint8_t> *plain;
+        int codec;
+        bool sha256, sparse;
+        uint64_t rekey;
+        int kdf; // 0: sealed under FUZZ_KEY
+    };
+    const std::vector<uint8_t> empty;
+    const Seed seeds[] = {
+        {"empty", &empty, SVLT_CODEC_NONE, false, false, 0},
+        {"plain", &text, SVLT_CODEC_NONE, false, false, 0},
+        {"sha256", &text, SVLT_CODEC_NONE, true, false, 0},
+        {"zlib", &text, SVLT_CODEC_ZLIB, true, false, 0},
+        {"zstd", &text, SVLT_CODEC_ZSTD, false, false, 0},
+        {"lz4", &text, SVLT_CODEC_LZ4, false, false, 0},
+        {"sparse", &mixed, SVLT_CODEC_NONE, false, true, 0},
+        {"sparse-zlib-sha256", &mixed, SVLT_CODEC_ZLIB, true, true, 0},
+        {"rekey", &mixed, SVLT_CODEC_NONE, false, false, 2 * 4096},
+        {"rekey-sparse", &mixed, SVLT_CODEC_NONE, true, true, 4096},
+        {"sparse-tail-sha256", &tail, SVLT_CODEC_NONE, true, true, 0},
+        {"sparse-tail-aligned-sha256", &tail_aligned, SVLT_CODEC_NONE, true, true, 0},
+        {"pbkdf2", &text, SVLT_CODEC_NONE, false, false, 0, SVLT_KDF_PBKDF2},
+        {"argon2id-zlib", &text, SVLT_CODEC_ZLIB, true, false, 0, SVLT_KDF_ARGON2ID},
+    };
+    int written = 0;
+    for (const Seed &s : seeds) {
+        if (s.codec != SVLT_CODEC_NONE && !svlt_codec_supported(s.codec)) continue;
+        std::vector<uint8_t> out;
+        if (!seal_stream(*s.plain, 4096, s.codec, s.sha256, s.sparse, s.rekey, s.kdf, out)) {
+            fprintf(stderr, "cannot seal seed %s: %s\n", s.name, svlt_last_error());
+            return false;
+        }
+        if (!run_one(out.data(), out.size()).authentic) {
+            fprintf(stderr, "seed %s does not decrypt: %s\n", s.name, svlt_last_error());
+            return false;
+        }
+        if (!write_whole(dir + "/" + s.name + ".svlt", out)) return false;
+        ++written;
+    }
+    printf("wrote %d seeds to %s\n", written, dir.c_str());
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s --seed DIR\n"
+            "       %s [--mutate N] [--slow-ms MS] FILE|DIR...\n",
+            prog, prog);
+}
+
+int main(int argc, char **argv) {
+    uint64_t mutations = 0, slow_ms = 250;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            return write_seeds(argv[++i]) ? 0 : 1;
+        } else if (strcmp(argv[i], "--mutate") == 0 && i + 1 < argc) {
+            mutations = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--slow-ms") == 0 && i + 1 < argc) {
+            slow_ms = strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else if (!collect_inputs(argv[i], inputs)) {
+            return 1;
+        }
+    }
+    if (inputs.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Warm up what is set up once per process (the plaintext buffer, OpenSSL's
+    // cipher tables) so the first input's latency is its own.
+    plain_buf();
+    new_segment_ctx(false, FUZZ_KEY);
+    ReplayStats st, bad;
+    const uint64_t slow_ns = slow_ms * 1000000;
+    std::vector<uint8_t> data, variant;
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        if (!read_whole(inputs[f], data)) return 1;
+        record(st, inputs[f], run_one(data.data(), data.size()), slow_ns);
+        uint64_t rng = 0x2545f4914f6cdd1dull + f;
+        for (uint64_t m = 0; m < mutations; ++m) {
+            mutate(data, variant, rng);
+            if (variant == data) continue;
+            InputTiming t = run_one(variant.data(), variant.size());
+            record(bad, inputs[f] + " mutation " + std::to_string(m), t, slow_ns);
+        }
+    }
+
+    auto report = [](const char *what, const ReplayStats &s) {
+        if (s.inputs == 0) return;
+        printf("%-9s %8llu inputs, %llu authentic; parse avg %.2f us max %.2f us, verify avg %.2f us max %.2f us\n",
+               what, static_cast<unsigned long long>(s.inputs), static_cast<unsigned long long>(s.authentic),
+               double(s.parse_total_ns) / 1e3 / double(s.inputs), double(s.parse_max_ns) / 1e3,
+               double(s.verify_total_ns) / 1e3 / double(s.inputs), double(s.verify_max_ns) / 1e3);
+        printf("          slowest: %s (%.2f ms)\n", s.slowest.c_str(), double(s.slowest_ns) / 1e6);
+    };
+    report("inputs", st);
+    report("mutated", bad);
+    if (bad.authentic > 0) {
+        // Every byte of a stream is bound to its tags, so any change must fail.
+        fprintf(stderr, "%llu mutated inputs still authenticated\n", static_cast<unsigned long long>(bad.authentic));
+        return 1;
+    }
+    if (st.slow + bad.slow > 0) {
+        fprintf(stderr, "%llu inputs took longer than %llu ms\n", static_cast<unsigned long long>(st.slow + bad.slow),
+                static_cast<unsigned long long>(slow_ms));
+        return 1;
+    }
+    return 0;
+}
+
+#endif // SVLT_FUZZ_STANDALONE
@@ -1,5 +1,6 @@
 // Utility to inspect and verify a ShadowVault snapshot metadata JSON file.
 // Validates the Ed25519 signature, summarizes contents, and checks local chunk availability.
+// To also decrypt and re-hash every referenced chunk, use `aesgcm_file --chunks=verify --snapshot=META`.
 // Build with:
 //   cargo install --path .   # or compile standalone with `rustc` after adding dependencies manually
 //